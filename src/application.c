@@ -2,321 +2,947 @@
 #include "logger.h"
 #include "render.h" //Includes SDL
 #include "mandelbrot_cpu.h"
+#include "frame_pipeline.h"
+#include "view_state.h"
+#include "command_queue.h"
+#include "frame_scheduler.h"
+#include "util.h"
+#include "image_ops.h"
+#include "frame_arena.h"
+#include "autotune.h"
+#include "engine.h"
+#include "daemon.h"
+#include "coordinator.h"
+#include "checkpoint.h"
+#include "session.h"
+#include "auto_iterations.h"
+#include "screenshot.h"
+#include "buddhabrot.h"
+#include "frame_export.h"
+#include "view_cache.h"
 
 #if ENABLE_CUDA
 #include "mandelbrot_cuda.h"
 #endif
 
-typedef enum {
-	ENGINE_TYPE_CPU,
-	ENGINE_TYPE_CUDA
-} EngineType;
-
-typedef struct Engine {
-	EngineType type;
-	void (*genImage)(Rectangle coord_rect, int *out_argb);
-	void (*genImageWH)(int w, int h, Rectangle coord_rect, int *out_argb);
-	void (*doAA)(Rectangle coord_rect, int *out_argb, int aa_counter);
-	void (*changeIters)(int diff);
-	void (*changeExponent)(int newExp);
-	int (*resizeFramebuffer)(int new_w, int new_h);
-} Engine;
-
 static Renderer renderer;
 static Engine engine;
+// The CPU engine context behind engine when rendering on the CPU
+static CpuEngine *cpu_engine = NULL;
+#if ENABLE_CUDA
+// The Cuda engine context behind engine when rendering with Cuda
+static CudaEngine *cuda_engine = NULL;
+#endif
 static Rectangle rect;
-static int engine_initialized = 0;
-static int force_rerender = 0;
-static int force_refresh = 0;
-static int quit = 0;
+static atomic_int engine_initialized = 0;
+static atomic_int force_refresh = 0;
+static atomic_int quit = 0;
 
 static int w, h;
 static int disable_aa = 0;
 static int force_cpu = 0;
 static int no_simd = 0;
+static int fixed_point = 0;
+static int no_tune = 0;
+static int retune = 0;
+static int pinned_cpus[MAX_CPU_THREADS];
+static CpuThreadConfig cpu_threading = {0, NULL, 0, 0};
+static float target_frame_time = TARGET_FRAME_TIME_MS;
 static const char *screenshot_dir = ".";
+static int screenshot_w = 0; // 0 for the size of the window
+static int screenshot_h = 0;
+static int supersample = DEFAULT_SUPERSAMPLE;
+static const char *daemon_socket = NULL;
+static const char *output_path = NULL;
+static int custom_view = 0;
+static Rectangle custom_rect;
+static int start_iterations = DEFAULT_ITERATIONS;
+static int start_exponent = DEFAULT_EXPONENT;
+static int start_auto_iters = 0;
+// Set when the options override what the last session ended with
+static int w_given = 0;
+static int h_given = 0;
+static int iterations_given = 0;
+static int fresh = 0;
+// Image of the start view cached by the last session, shown until the engine is up
+static int *cached_image = NULL;
+static char *workers[MAX_WORKERS];
+static int nworkers = 0;
+static int tile_size = COORDINATOR_TILE_SIZE;
+static const char *checkpoint_path = NULL;
+static int no_checkpoint = 0;
+static int resume = 0;
+static const char *record_path = NULL;
+static const char *replay_path = NULL;
+static int headless = 0;
+static int measure_latency = 0;
+static int benchmark = 0;
+// Show the density of orbits instead of escape times
+static int buddhabrot = 0;
+static BuddhaMode buddha_mode = BUDDHA_NORMAL;
+static int nebula = 0;
+// Shared memory the present stage copies every shown frame into, if named
+static const char *export_name = NULL;
+static FrameExport frame_export;
 
-static SDL_mutex *mutex;
+// The event loop owns the view and publishes snapshots of it,
+// everything that needs the engine is queued for the compute stage
+static ViewExchange views;
+static CommandQueue commands;
+// Posted by the event loop after publishing a view or queueing a command
+static SDL_sem *wakeup;
 
-int *framebuffer;
+static FramePipeline pipeline;
+// The frame the present stage showed last, owned by it
+static Frame *shown = NULL;
+static FrameScheduler scheduler;
+// Only used by the compute stage
+static ScreenshotQueue screenshots;
+static AutoIterations auto_iters;
+// Budget picked by the compute stage, read by the event loop when the
+// user takes over the iterations
+static atomic_int auto_budget = 0;
+// Pixel under the mouse, which is also where the wheel zooms to. Written by
+// the event loop, full resolution frames are rendered outward from it.
+static atomic_int focus_x = 0;
+static atomic_int focus_y = 0;
 
-void init_engine() {
-	clock_t time;
-	mandelLog(VERBOSE, "Starting application in resolution %dx%d\n", w, h);
-	time = clock();
-	renderer = createRenderer(w, h);
-	mandelLog(DEBUG, "Creating Renderer took %ld ticks\n", clock() - time);
+// Iterations and exponent the engine is set to, only changed by set_engine_params
+static int engine_iterations = DEFAULT_ITERATIONS;
+static int engine_exponent = DEFAULT_EXPONENT;
+
+// Sets the engine to the given iterations and exponent
+void set_engine_params(int iterations, int exponent) {
+	if(iterations != engine_iterations) {
+		engine.changeIters(iterations - engine_iterations);
+		engine_iterations = iterations;
+	}
+	if(exponent != engine_exponent) {
+		engine.changeExponent(exponent - engine_exponent);
+		engine_exponent = exponent;
+	}
+}
+
+// Renders the jobs one after the other, for engines without a batch call
+int render_batch_sequential(const RenderJob *jobs, int *const *outs, int njobs) {
+	for(int i = 0; i < njobs; i++) {
+		Tile part = renderJobPart(&jobs[i]);
+		set_engine_params(jobs[i].iterations, jobs[i].exponent);
+		engine.genImageWH(part.w, part.h, tileRect(jobs[i].rect, jobs[i].width, jobs[i].height,
+				part), outs[i]);
+	}
+	return 0;
+}
+
+#if ENABLE_CUDA
+// Adapters binding the Cuda engine context to the Engine interface
+void gen_image_cuda(Rectangle coord_rect, int *out_argb) {
+	generateImageCuda(cuda_engine, coord_rect, out_argb);
+}
+
+void gen_image_wh_cuda(int w, int h, Rectangle coord_rect, int *out_argb) {
+	generateImageCudaWH(cuda_engine, w, h, coord_rect, out_argb);
+}
+
+void do_aa_cuda(Rectangle coord_rect, int *out_argb, int aa_counter) {
+	doAntiAliasCuda(cuda_engine, coord_rect, out_argb, aa_counter);
+}
+
+void change_iters_cuda(int diff) {
+	changeIterationsCuda(cuda_engine, diff);
+}
+
+void change_exponent_cuda(int diff) {
+	changeExponentCuda(cuda_engine, diff);
+}
+
+int resize_framebuffer_cuda(int new_w, int new_h) {
+	return resizeFramebufferCuda(cuda_engine, new_w, new_h);
+}
+#endif
+
+// Adapters binding the CPU engine context to the Engine interface
+void gen_image_cpu(Rectangle coord_rect, int *out_argb) {
+	generateImageCpu(cpu_engine, coord_rect, out_argb);
+}
+
+void gen_image_wh_cpu(int w, int h, Rectangle coord_rect, int *out_argb) {
+	generateImageCpuWH(cpu_engine, w, h, coord_rect, out_argb);
+}
+
+int gen_image_focus_cpu(int w, int h, Rectangle coord_rect, int *out_argb,
+		int focus_x, int focus_y, int part, int max_pixels, Tile *changed) {
+	return generateImageCpuFocus(cpu_engine, w, h, coord_rect, out_argb,
+			focus_x, focus_y, part, max_pixels, changed);
+}
+
+void do_aa_cpu(Rectangle coord_rect, int *out_argb, int aa_counter) {
+	doAntiAliasCpu(cpu_engine, coord_rect, out_argb, aa_counter);
+}
+
+void change_iters_cpu(int diff) {
+	changeIterationsCpu(cpu_engine, diff);
+}
+
+void change_exponent_cpu(int diff) {
+	changeExponentCpu(cpu_engine, diff);
+}
+
+int resize_framebuffer_cpu(int new_w, int new_h) {
+	return resizeFramebufferCpu(cpu_engine, new_w, new_h);
+}
+
+int render_batch_cpu(const RenderJob *jobs, int *const *outs, int njobs) {
+	return renderBatchCpu(cpu_engine, jobs, outs, njobs);
+}
+
+int get_stats_cpu(IterStats *stats) {
+	return getIterStatsCpu(cpu_engine, stats);
+}
+
+// Initializes the pixel data generating engine, without any window
+void init_compute_engine() {
 
 #if ENABLE_CUDA
 	// Init pixel data generating engine
 	if(!force_cpu) {
-		if(mandelbrotCudaInit(w, h)) { // Returns nonzero status on error
+		cuda_engine = mandelbrotCudaCreate(w, h);
+		if(cuda_engine == NULL) {
 			mandelLog(WARN, "Could not initialize Cuda Mandelbrot Engine!\n");
 			mandelLog(WARN, "Falling back to slower CPU implementation!\n");
 			force_cpu = 1;
 		} else {
 			engine.type = ENGINE_TYPE_CUDA;
-			engine.genImage = &generateImageCuda;
-			engine.genImageWH = &generateImageCudaWH;
-			engine.doAA = &doAntiAliasCuda;
-			engine.resizeFramebuffer = &resizeFramebufferCuda;
-			engine.changeIters = &changeIterationsCuda;
-			engine.changeExponent = &changeExponentCuda;
+			engine.genImage = &gen_image_cuda;
+			engine.genImageWH = &gen_image_wh_cuda;
+			engine.genImageFocus = NULL;
+			engine.doAA = &do_aa_cuda;
+			engine.resizeFramebuffer = &resize_framebuffer_cuda;
+			engine.changeIters = &change_iters_cuda;
+			engine.changeExponent = &change_exponent_cuda;
+			engine.renderBatch = &render_batch_sequential;
+			engine.getStats = NULL;
 			mandelLog(INFO, "Cuda Mandelbrot Engine successfully initialized\n");
 		}
 	}
 	if(force_cpu) {
 #endif
 		mandelLog(INFO, "Using CPU Rendering. This will impact performance.\n");
-		if(mandelbrotCpuInit(w, h, no_simd)) { // Returns nonzero status on error
+		cpu_engine = mandelbrotCpuCreate(w, h, no_simd, &cpu_threading);
+		if(cpu_engine == NULL) {
 			mandelLog(ERROR, "Could not initialize Cpu Mandelbrot Engine!\n");
 			exit(EXIT_FAILURE);
 		}
+		// Explicit threading or SIMD settings are never overridden by a tuning
+		int explicit_setup = no_simd || cpu_threading.nthreads != 0 ||
+				cpu_threading.cpus != NULL || cpu_threading.numa;
+		if((retune || !no_tune) && !explicit_setup && autotuneCpu(cpu_engine, retune))
+			mandelLog(WARN, "Could not tune CPU rendering, using defaults\n");
+		mandelbrotCpuSetFixedPoint(cpu_engine, fixed_point);
 		engine.type = ENGINE_TYPE_CPU;
-		engine.genImage = &generateImageCpu;
-		engine.genImageWH = &generateImageCpuWH;
-		engine.doAA = &doAntiAliasCpu;
-		engine.resizeFramebuffer = &resizeFramebufferCpu;
-		engine.changeIters = &changeIterationsCpu;
-		engine.changeExponent = &changeExponentCpu;
+		engine.genImage = &gen_image_cpu;
+		engine.genImageWH = &gen_image_wh_cpu;
+		engine.genImageFocus = &gen_image_focus_cpu;
+		engine.doAA = &do_aa_cpu;
+		engine.resizeFramebuffer = &resize_framebuffer_cpu;
+		engine.changeIters = &change_iters_cpu;
+		engine.changeExponent = &change_exponent_cpu;
+		engine.renderBatch = &render_batch_cpu;
+		engine.getStats = &get_stats_cpu;
 		mandelLog(INFO, "CPU Mandelbrot Engine successfully initialized\n");
 #if ENABLE_CUDA
 	}
 #endif
 }
 
-void alloc_framebuffer() {
-	framebuffer = (int *) malloc(w * h * sizeof(int));
-	if(framebuffer == NULL) {
-		mandelLog(ERROR, "Could not allocate memory for Framebuffer!\n");
-		exit(EXIT_FAILURE);
+void cleanup_compute_engine() {
+#if ENABLE_CUDA
+	mandelbrotCudaDestroy(cuda_engine);
+	cuda_engine = NULL;
+#endif
+	mandelbrotCpuDestroy(cpu_engine);
+	cpu_engine = NULL;
+}
+
+void init_engine() {
+	clock_t time;
+	mandelLog(VERBOSE, "Starting application in resolution %dx%d\n", w, h);
+	time = clock();
+	renderer = createRenderer(w, h);
+	mandelLog(DEBUG, "Creating Renderer took %ld ticks\n", clock() - time);
+
+	// The last session's image of the view stays up until the first frame is rendered
+	if(cached_image != NULL) {
+		renderImage(&renderer, w, h, cached_image);
+		mandelLog(DEBUG, "Showing the cached image took %ld ticks\n", clock() - time);
+		free(cached_image);
+		cached_image = NULL;
 	}
+
+	init_compute_engine();
+	set_engine_params(start_iterations, start_exponent);
 }
 
-void realloc_framebuffer(int f_w, int f_h) {
-	framebuffer = (int *) realloc(framebuffer, f_w * f_h * sizeof(int));
-	if(framebuffer == NULL) {
-		mandelLog(ERROR, "Could not allocate memory for Framebuffer!\n");
-		exit(EXIT_FAILURE);
+// Renders the tiles the checkpoint is missing with the local engine
+int render_tiles_local(const RenderJob *job, Checkpoint *cp, int *image) {
+	MandelBuffer tile_buf = {0, 0, 0, NULL};
+	int status = 0;
+
+	init_compute_engine();
+	set_engine_params(job->iterations, job->exponent);
+
+	for(int t = 0; t < cp->ntiles; t++) {
+		if(cp->done[t])
+			continue;
+		Tile tile = tileAt(t, job->width, job->height, job->tile_size);
+		if(mandelBufferResize(&tile_buf, tile.w, tile.h)) {
+			mandelLog(ERROR, "Could not allocate memory for a tile!\n");
+			status = -1;
+			break;
+		}
+		// Rendered as part of the image, so tiles line up with a render of all of it
+		RenderJob part = *job;
+		part.part = tile;
+		if(engine.renderBatch(&part, &tile_buf.rgb_data, 1)) {
+			mandelLog(ERROR, "Could not render tile %d!\n", t);
+			status = -1;
+			break;
+		}
+		for(int row = 0; row < tile.h; row++) {
+			memcpy(image + (tile.y + row) * job->width + tile.x,
+					tile_buf.rgb_data + row * tile.w, tile.w * sizeof(int));
+		}
+		checkpointTile(cp, t, image);
+		mandelLog(DEBUG, "Rendered tile %d (%d/%d)\n", t, cp->ndone, cp->ntiles);
 	}
+
+	mandelBufferFree(&tile_buf);
+	cleanup_compute_engine();
+	return status;
 }
 
-int renderLoop() {
-	init_engine();
-	alloc_framebuffer();
+// Renders a single image without opening a window, either here or on workers.
+// Complete tiles are checkpointed so an interrupted render can be resumed.
+int render_to_file() {
+	RenderJob job = {rect, w, h, start_iterations, DEFAULT_EXPONENT, tile_size, {0, 0, 0, 0}};
+	int *image = frameAlloc(w * h);
+	if(image == NULL) {
+		mandelLog(ERROR, "Could not allocate memory for the image!\n");
+		return -1;
+	}
+
+	// Defaults to a file next to the output
+	char *default_path = NULL;
+	if(checkpoint_path == NULL && !no_checkpoint) {
+		int len = strlen(output_path) + strlen(".checkpoint") + 1;
+		default_path = (char *)malloc(len);
+		if(default_path != NULL)
+			snprintf(default_path, len, "%s.checkpoint", output_path);
+		checkpoint_path = default_path;
+	}
+
+	Checkpoint cp;
+	int status = checkpointOpen(&cp, no_checkpoint ? NULL : checkpoint_path,
+			&job, resume, image);
+	if(status == 0) {
+		if(nworkers > 0)
+			status = coordinateRender(&job, workers, nworkers, &cp, image);
+		else
+			status = render_tiles_local(&job, &cp, image);
+		if(status == 0)
+			writeToBmp(output_path, w, h, image);
+		checkpointClose(&cp, checkpoint_path);
+	}
+
+	free(default_path);
+	frameFree(image);
+	return status;
+}
+
+static double elapsed_ms(Uint64 start) {
+	return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+			(double)SDL_GetPerformanceFrequency();
+}
 
-	engine_initialized = 1;
+// Workers for scaling and downscaling images, NULL to use the calling thread
+ThreadPool *image_pool() {
+	return cpu_engine != NULL ? mandelbrotCpuPool(cpu_engine) : NULL;
+}
+
+// Renders a frame at a reduced resolution that fits the frame time budget
+// and scales it up to the full size of out_argb.
+// Returns nonzero if the frame was rendered in reduced resolution.
+int render_interactive(Rectangle r, int f_w, int f_h, int *out_argb) {
+	static MandelBuffer preview = {0, 0, 0, NULL};
+
+	float scale = schedulerPickScale(&scheduler, f_w, f_h);
+	int s_w = (int)(f_w * scale);
+	int s_h = (int)(f_h * scale);
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	if(scale >= 1.0 || s_w < 1 || s_h < 1) {
+		engine.genImage(r, out_argb);
+		schedulerRecord(&scheduler, f_w * f_h, elapsed_ms(start));
+		return 0;
+	}
+
+	if(mandelBufferResize(&preview, s_w, s_h)) {
+		mandelLog(ERROR, "Could not allocate memory for Preview Buffer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	engine.genImageWH(s_w, s_h, r, preview.rgb_data);
+	schedulerRecord(&scheduler, s_w * s_h, elapsed_ms(start));
+	imageScale(image_pool(), preview.rgb_data, s_w, s_h, out_argb, f_w, f_h, INTERP_NN);
+	return 1;
+}
 
+// Picks the iterations of the next frame from the statistics of the frame
+// just rendered. Returns nonzero if they were raised, which means the frame
+// is missing detail.
+int update_auto_iterations(Rectangle r) {
+	IterStats stats;
+	int have_stats = engine.getStats != NULL && engine.getStats(&stats) == 0;
+	int before = auto_iters.iterations;
+	int after = autoItersUpdate(&auto_iters, r, have_stats ? &stats : NULL);
+	atomic_store(&auto_budget, after);
+	return before > 0 && after > before;
+}
+
+// Compute stage: renders frames and anti-alias passes into the back frame
+// of the pipeline while the present stage uploads and shows the front frame.
+// It is the only thread using the engine.
+int computeLoop() {
 	// aa_counter starts at 0 and ends at 3
 	int aa_counter = 0;
-	Rectangle rect_cache;
-	clock_t time;
+	ViewState state;
+	Uint64 start;
 
-	// stores the size of the framebuffer
-	// when the window gets resized we finish rendering our image with the old framebuffer size
+	// stores the size of the engine framebuffer
 	int f_w = w;
 	int f_h = h;
 
-	while(!quit) {
-		if(f_w != w || f_h != h) {
-			f_w = w;
-			f_h = h;
-			realloc_framebuffer(f_w, f_h);
+	// the most recently published frame, the anti-alias passes build upon it
+	Frame *last = NULL;
+	// set while the published frame is a reduced resolution preview
+	int preview_pending = 0;
+	// ticks of the last view change, used to detect when input goes idle
+	Uint32 last_change = 0;
+	// set when automatic iterations found the last frame to be missing detail
+	int redo = 0;
+	// next part of the focused full resolution frame, 0 before the first one
+	int focus_part = 0;
+
+	screenshotQueueInit(&screenshots, screenshot_dir);
+	while(!atomic_load(&quit)) {
+		// Every post is answered by looking at the newest view below,
+		// so posts for views that were already replaced can be dropped
+		while(SDL_SemTryWait(wakeup) == 0);
+
+		Command command;
+		while(commandPop(&commands, &command)) {
+			if(command.view.auto_iters && auto_iters.iterations > 0)
+				command.view.iterations = auto_iters.iterations;
+			if(command.type == COMMAND_SCREENSHOT)
+				screenshotQueueAdd(&screenshots, &command.view,
+						command.width, command.height, command.supersample);
+		}
+
+		// Any number of inputs since the last frame lead to a single frame
+		int changed = viewLatest(&views, &state) || last == NULL || redo;
+		redo = 0;
+		if(f_w != state.w || f_h != state.h) {
+			f_w = state.w;
+			f_h = state.h;
 			if(engine.resizeFramebuffer(f_w, f_h) == -1) {
 				mandelLog(ERROR, "Could not allocate memory for Engine Framebuffer!\n");
 				exit(EXIT_FAILURE);
 			}
 		}
-		if(force_rerender || memcmp(&rect_cache, &rect, sizeof(Rectangle))) {
-			SDL_LockMutex(mutex);
-			rect_cache = rect;
-			SDL_UnlockMutex(mutex);
-			mandelLog(DEBUG, "Rectangle changed to {%f, %f, %f, %f}\n",
-					rect.x, rect.y, rect.w, rect.h);
+		if(state.auto_iters && auto_iters.iterations == 0)
+			update_auto_iterations(state.rect);
+		set_engine_params(state.auto_iters ? auto_iters.iterations : state.iterations,
+				state.exponent);
+
+		Uint32 now = SDL_GetTicks();
+		int idle = now - last_change >= INTERACTION_IDLE_MS;
+		Frame *back = pipelineBackFrame(&pipeline);
 
+		if(changed) {
+			mandelLog(DEBUG, "Rectangle changed to {%.17g, %.17g, %g, %g}\n",
+					state.rect.x, state.rect.y, state.rect.w, state.rect.h);
 			aa_counter = 0; // Reset Antialias
-			force_rerender = 0;
-			force_refresh = 1;
-
-			time = clock();
-			engine.genImage(rect_cache, framebuffer);
-			mandelLog(DEBUG, "Image generation took %6ld ticks\n", clock() - time);
-			
-		} else if(!disable_aa && aa_counter < MAX_AA_COUNTER) {
+			last_change = now;
+			focus_part = 0;
+
+			if(pipelineResizeBack(&pipeline, f_w, f_h)) {
+				mandelLog(ERROR, "Could not allocate memory for Framebuffer!\n");
+				exit(EXIT_FAILURE);
+			}
+
+			start = SDL_GetPerformanceCounter();
+			preview_pending = render_interactive(state.rect, f_w, f_h, back->buf.rgb_data);
+			mandelLog(DEBUG, "Image generation took %.2f ms\n", elapsed_ms(start));
+			if(state.auto_iters)
+				redo = update_auto_iterations(state.rect);
+
+			back->rect = state.rect;
+			back->view_seq = state.seq;
+			back->final = !preview_pending && disable_aa;
+			last = pipelinePublish(&pipeline);
+		} else if(preview_pending && idle) {
+			// Input went idle, replace the preview with a full resolution frame.
+			// Tiles around the focus come first and each part is shown when
+			// it's done, so the region the user looks at sharpens first.
+			if(focus_part == 0)
+				mandelLog(DEBUG, "Rendering full resolution frame\n");
+			if(pipelineResizeBack(&pipeline, f_w, f_h)) {
+				mandelLog(ERROR, "Could not allocate memory for Framebuffer!\n");
+				exit(EXIT_FAILURE);
+			}
+
+			start = SDL_GetPerformanceCounter();
+			if(engine.genImageFocus != NULL && last->buf.w == f_w && last->buf.h == f_h) {
+				// Parts not rendered yet keep showing the preview
+				memcpy(back->buf.rgb_data, last->buf.rgb_data, f_w * f_h * sizeof(int));
+				int samples = scheduler.pixels_per_ms > 0.0 ?
+						(int)(scheduler.pixels_per_ms * target_frame_time) : f_w * f_h;
+				focus_part = engine.genImageFocus(f_w, f_h, state.rect, back->buf.rgb_data,
+						atomic_load(&focus_x), atomic_load(&focus_y), focus_part, samples,
+						&back->dirty);
+				mandelLog(DEBUG, "Frame part took %.2f ms\n", elapsed_ms(start));
+				preview_pending = focus_part != 0;
+				// Only the part has to be uploaded on top of the last frame
+				back->base_seq = last->seq;
+			} else {
+				engine.genImage(state.rect, back->buf.rgb_data);
+				schedulerRecord(&scheduler, f_w * f_h, elapsed_ms(start));
+				preview_pending = 0;
+			}
+			if(!preview_pending && state.auto_iters)
+				redo = update_auto_iterations(state.rect);
+
+			back->rect = state.rect;
+			back->view_seq = state.seq;
+			back->final = !preview_pending && disable_aa;
+			last = pipelinePublish(&pipeline);
+		} else if(!preview_pending && idle && !disable_aa &&
+				aa_counter < MAX_AA_COUNTER &&
+				last->buf.w == f_w && last->buf.h == f_h) {
 			mandelLog(DEBUG, "Applying Antialias %d\n", aa_counter);
-			engine.doAA(rect_cache, framebuffer, aa_counter);
+			if(pipelineResizeBack(&pipeline, f_w, f_h)) {
+				mandelLog(ERROR, "Could not allocate memory for Framebuffer!\n");
+				exit(EXIT_FAILURE);
+			}
+			// The back frame holds an older image, continue from the published one.
+			// The published frame is only read by the present stage, so this is safe.
+			memcpy(back->buf.rgb_data, last->buf.rgb_data, f_w * f_h * sizeof(int));
+			engine.doAA(state.rect, back->buf.rgb_data, aa_counter);
 
 			aa_counter++;
-			force_refresh = 1;
-		}
-		
-		// Repaint framebuffer to screen with SDL (either after rendering or when forced)
-		if(force_refresh) {
-			renderImage(renderer, f_w, f_h, framebuffer);
-			force_refresh = 0;
+			back->rect = state.rect;
+			back->view_seq = state.seq;
+			back->final = aa_counter >= MAX_AA_COUNTER;
+			last = pipelinePublish(&pipeline);
+		} else if(screenshotPending(&screenshots)) {
+			// Lowest priority, a band that fits the frame time budget at a time so
+			// that new input is picked up quickly
+			int samples = scheduler.pixels_per_ms > 0.0 ?
+					(int)(scheduler.pixels_per_ms * target_frame_time) : SCREENSHOT_BAND_SAMPLES;
+			screenshotRenderBand(&screenshots, &engine, image_pool(), samples);
 		} else {
-			// Check again in 30 milliseconds if there is something to render/update
-			// 30 milliseconds is easily responsive enough and doesn't result in huge idle load
-			SDL_Delay(30);
+			// Sleep until the event loop publishes a view or queues a command, or until
+			// the input goes idle when there is still full resolution or anti-alias work left
+			int work_left = !idle &&
+					(preview_pending || (!disable_aa && aa_counter < MAX_AA_COUNTER));
+			// The drain above may have swallowed the post that came with quit
+			if(atomic_load(&quit))
+				break;
+			if(work_left)
+				SDL_SemWaitTimeout(wakeup, INTERACTION_IDLE_MS - (now - last_change));
+			else
+				SDL_SemWait(wakeup);
+		}
+	}
+
+	screenshotQueueFree(&screenshots);
+	return 0;
+}
+
+// Compute stage in Buddhabrot mode: accumulates the orbits of the newest view
+// in passes and publishes the image after every pass, until it is final
+int buddhaLoop() {
+	ViewState state;
+	int nebula_limits[3] = BUDDHA_NEBULA_LIMITS;
+	int have_view = 0;
+	// Sized so a pass takes about BUDDHA_PASS_MS
+	long pass_samples = BUDDHA_FIRST_PASS;
+
+	// The CPU engine is idle, its workers are shared
+	BuddhaEngine *buddha = buddhaCreate(image_pool(), no_simd);
+	if(buddha == NULL)
+		exit(EXIT_FAILURE);
+
+	while(!atomic_load(&quit)) {
+		while(SDL_SemTryWait(wakeup) == 0);
+
+		Command command;
+		while(commandPop(&commands, &command)) {
+			if(command.type == COMMAND_SCREENSHOT)
+				mandelLog(WARN, "Screenshots are not supported in Buddhabrot mode\n");
+		}
+
+		if(viewLatest(&views, &state) || !have_view) {
+			BuddhaSettings settings;
+			settings.mode = buddha_mode;
+			settings.exponent = state.exponent;
+			for(int k = 0; k < 3; k++)
+				settings.limits[k] = nebula ? nebula_limits[k] : state.iterations;
+			if(buddhaReset(buddha, &settings, state.rect, state.w, state.h))
+				exit(EXIT_FAILURE);
+			have_view = 1;
+		}
+
+		long max_samples = (long)state.w * state.h * BUDDHA_SAMPLES_PER_PIXEL;
+		if(buddhaSamples(buddha) >= max_samples) {
+			// The drain above may have swallowed the post that came with quit
+			if(atomic_load(&quit))
+				break;
+			SDL_SemWait(wakeup);
+			continue;
+		}
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		buddhaAccumulate(buddha, pass_samples);
+		double ms = elapsed_ms(start);
+		mandelLog(DEBUG, "Buddhabrot pass of %ld samples took %.2f ms\n", pass_samples, ms);
+		if(ms > 0.0)
+			pass_samples = (long)(pass_samples * (BUDDHA_PASS_MS / ms));
+		if(pass_samples < BUDDHA_FIRST_PASS)
+			pass_samples = BUDDHA_FIRST_PASS;
+
+		if(pipelineResizeBack(&pipeline, state.w, state.h)) {
+			mandelLog(ERROR, "Could not allocate memory for Framebuffer!\n");
+			exit(EXIT_FAILURE);
+		}
+		Frame *back = pipelineBackFrame(&pipeline);
+		buddhaToArgb(buddha, back->buf.rgb_data);
+		back->rect = state.rect;
+		back->view_seq = state.seq;
+		back->final = buddhaSamples(buddha) >= max_samples;
+		pipelinePublish(&pipeline);
+	}
+
+	buddhaDestroy(buddha);
+	return 0;
+}
+
+// Present stage: owns the SDL renderer, uploads and shows published frames
+int renderLoop() {
+	init_engine();
+	if(pipelineInit(&pipeline)) {
+		exit(EXIT_FAILURE);
+	}
+
+	if(export_name != NULL && frameExportOpen(&frame_export, export_name,
+			FRAME_EXPORT_SLOTS, FRAME_EXPORT_MAX_PIXELS)) {
+		exit(EXIT_FAILURE);
+	}
+
+	atomic_store(&engine_initialized, 1);
+
+	SDL_Thread *computeThread = SDL_CreateThread(buddhabrot ? buddhaLoop : computeLoop,
+			"ComputeThread", NULL);
+	if(computeThread == NULL) {
+		mandelLog(ERROR, "Could not create Compute Thread!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Frame the texture holds, 0 if it holds something else
+	unsigned int texture_seq = 0;
+	while(!atomic_load(&quit)) {
+		pipelineWait(&pipeline);
+
+		// Repaint the newest frame to screen with SDL (either after rendering or when forced)
+		// When only a refresh is forced (e.g. window exposed) the texture is still current
+		Frame *frame = pipelineAcquire(&pipeline);
+		int refresh = atomic_exchange(&force_refresh, 0);
+		if(frame != NULL) {
+			renderer.width = frame->buf.w;
+			renderer.height = frame->buf.h;
+			if(frame->base_seq != 0 && frame->base_seq == texture_seq) {
+				SDL_Rect dirty = {frame->dirty.x, frame->dirty.y, frame->dirty.w, frame->dirty.h};
+				renderImageRects(&renderer, frame->buf.w, frame->buf.h, frame->buf.rgb_data,
+						&dirty, 1);
+			} else {
+				renderImage(&renderer, frame->buf.w, frame->buf.h, frame->buf.rgb_data);
+			}
+			texture_seq = frame->seq;
+			shown = frame;
+			latencyPresented(frame->view_seq, frame->final);
+			if(export_name != NULL)
+				frameExportWrite(&frame_export, frame->buf.rgb_data, frame->buf.w, frame->buf.h,
+						frame->rect, frame->view_seq, frame->final);
+		} else if(refresh) {
+			presentImage(&renderer);
 		}
 	}
 
+	SDL_WaitThread(computeThread, NULL);
+	if(export_name != NULL)
+		frameExportClose(&frame_export);
 	return 0;
 }
 
-void make_screenshot() {
-	// dirname + path seperator + filename + null terminator
-	int pathlen = strlen(screenshot_dir) + 1 + strlen("output.bmp") + 1;
-	char *path;
-	path = (char *)malloc(pathlen * sizeof(char));
-	snprintf(path, pathlen, "%s/%s", screenshot_dir, "output.bmp");
+ViewState initial_view() {
+	return (ViewState) {rect, w, h, start_iterations, start_exponent, start_auto_iters, 0};
+}
+
+// Starts where the last session ended, as far as the options leave it open
+void resume_last_view() {
+	ViewCache cache;
+	if(viewCacheLoad(&cache))
+		return;
+	ViewState *last = &cache.view;
+
+	if(!w_given)
+		w = last->w;
+	if(!h_given)
+		h = last->h;
+	if(!custom_view) {
+		// Keeps the center and width when the window size changed
+		rect = last->rect;
+		if(w != last->w || h != last->h) {
+			double height = rect.w * h / w;
+			moveRect(&rect, 0.0, (rect.h - height) / 2.0);
+			rect.h = height;
+		}
+		start_exponent = clamp(last->exponent, 1, MAX_EXPONENT);
+		if(!iterations_given) {
+			start_iterations = clamp(last->iterations, 1, MAX_ITERATIONS);
+			start_auto_iters = last->auto_iters != 0;
+		}
+	}
+	mandelLog(VERBOSE, "Resuming the view of the last session\n");
+
+	// Escape times are only shown for the same view and size
+	int same_view = !custom_view && w == last->w && h == last->h;
+	if(same_view && !buddhabrot)
+		cached_image = cache.image;
+	else
+		viewCacheFree(&cache);
+}
+
+// Starts from the view the replayed session was recorded with, whatever the
+// options say, so the inputs act on the same region
+void replay_recorded_view() {
+	ViewState recorded;
+	int status = sessionReplayView(replay_path, &recorded);
+	if(status < 0)
+		exit(EXIT_FAILURE);
+	if(status > 0) {
+		mandelLog(WARN, "Session %s has no start view, using the one of the options\n",
+				replay_path);
+		return;
+	}
+	if(recorded.w < 1 || recorded.h < 1 || !(recorded.rect.w > 0.0 && recorded.rect.h > 0.0)) {
+		mandelLog(ERROR, "Invalid start view in session %s\n", replay_path);
+		exit(EXIT_FAILURE);
+	}
+	rect = recorded.rect;
+	w = recorded.w;
+	h = recorded.h;
+	start_iterations = clamp(recorded.iterations, 1, MAX_ITERATIONS);
+	start_exponent = clamp(recorded.exponent, 1, MAX_EXPONENT);
+	start_auto_iters = recorded.auto_iters != 0;
+}
 
-	SDL_LockMutex(mutex);
-	int my_w = w;
-	int my_h = h;
-	Rectangle my_rect = rect;
-	SDL_UnlockMutex(mutex);
+// Remembers the newest view and, if it was shown, its image for the next session
+void store_last_view() {
+	ViewState view;
+	viewLatest(&views, &view);
+	int have_image = shown != NULL && !buddhabrot && shown->view_seq == view.seq &&
+			shown->buf.w == view.w && shown->buf.h == view.h;
+	viewCacheStore(&view, have_image ? shown->buf.rgb_data : NULL);
+}
 
-	int *data = (int *) malloc(my_w * my_h * sizeof(int));
-	engine.genImageWH(my_w, my_h, my_rect, data);
-	writeToBmp(path, my_w, my_h, data);
-	free(data);
+// Leaves automatic iterations, continuing from the budget they picked last
+void manual_iterations(ViewState *view) {
+	int budget = atomic_load(&auto_budget);
+	if(view->auto_iters && budget > 0)
+		view->iterations = budget;
+	view->auto_iters = 0;
 }
 
+// Never waits on the other threads: changes go into a private copy of the
+// view, which is published as a whole once the event is handled
 void eventLoop() {
-	while(!engine_initialized && !quit) {
+	while(!atomic_load(&engine_initialized) && !atomic_load(&quit)) {
 		SDL_Delay(10);
 	}
 	mandelLog(DEBUG, "Starting Event Loop\n");
 
+	if(replay_path != NULL && sessionReplayStart(replay_path))
+		return;
+
+	ViewState view = initial_view();
+	Rectangle *r = &view.rect;
 	int mouse_state = SDL_RELEASED;
+	// Tracked from motion events, so that replayed wheel events zoom
+	// towards the recorded position instead of the real mouse
+	int mouse_x, mouse_y;
+	SDL_GetMouseState(&mouse_x, &mouse_y);
+	atomic_store(&focus_x, mouse_x);
+	atomic_store(&focus_y, mouse_y);
 	SDL_Event ev;
 	while(SDL_WaitEvent(&ev)) {
+		sessionRecord(&ev, mouse_x, mouse_y);
+		// Set when the event changed the view, with the kind of input
+		int changed = 0;
+		InputKind kind = INPUT_KEY;
+		Command command;
+		int iter_diff;
+		double wh_ratio;
+		double coord_height;
 
-		if(ev.type == SDL_MOUSEWHEEL) {
-			int mx, my;
-			SDL_GetMouseState(&mx, &my);
-			float x_skew = (float)mx / (float)w;
-			float y_skew = (float)my / (float)h;
-			SDL_LockMutex(mutex);
+		if(ev.type == SDL_QUIT) {
+			return;
+		} else if(ev.type == SDL_MOUSEWHEEL) {
+			float x_skew = (float)mouse_x / (float)view.w;
+			float y_skew = (float)mouse_y / (float)view.h;
 			if(ev.wheel.y > 0) { // scroll up
-				rect.x += 0.2 * x_skew * rect.w;
-				rect.y += 0.2 * y_skew * rect.h;
-				rect.w = 0.8 * rect.w;
-				rect.h = 0.8 * rect.h;
+				moveRect(r, 0.2 * x_skew * r->w, 0.2 * y_skew * r->h);
+				r->w = 0.8 * r->w;
+				r->h = 0.8 * r->h;
+				changed = 1;
 			} else if(ev.wheel.y < 0) { // scroll down
-				rect.x -= 0.25 * x_skew * rect.w;
-				rect.y -= 0.25 * y_skew * rect.h;
-				rect.w = 1.25 * rect.w;
-				rect.h = 1.25 * rect.h;
+				moveRect(r, -0.25 * x_skew * r->w, -0.25 * y_skew * r->h);
+				r->w = 1.25 * r->w;
+				r->h = 1.25 * r->h;
+				changed = 1;
 			}
-			SDL_UnlockMutex(mutex);
+			kind = INPUT_WHEEL;
 		} else if(ev.type == SDL_KEYDOWN) {
-			int iter_diff;
-			SDL_LockMutex(mutex);
+			changed = 1;
+			kind = INPUT_KEY;
 			switch(ev.key.keysym.sym) {
 				case SDLK_q:
 				case SDLK_ESCAPE:
 					return;
 				case SDLK_UP:
-					rect.y -= rect.h * 0.02;
+					moveRect(r, 0.0, -r->h * 0.02);
 					break;
 				case SDLK_DOWN:
-					rect.y += rect.h * 0.02;
+					moveRect(r, 0.0, r->h * 0.02);
 					break;
 				case SDLK_LEFT:
-					rect.x -= rect.w * 0.02;
+					moveRect(r, -r->w * 0.02, 0.0);
 					break;
 				case SDLK_RIGHT:
-					rect.x += rect.w * 0.02;
+					moveRect(r, r->w * 0.02, 0.0);
 					break;
 				case SDLK_PAGEUP:
 					// zoom in towards center
-					rect.x += 0.1 * rect.w;
-					rect.y += 0.1 * rect.h;
-					rect.w = 0.8 * rect.w;
-					rect.h = 0.8 * rect.h;
+					moveRect(r, 0.1 * r->w, 0.1 * r->h);
+					r->w = 0.8 * r->w;
+					r->h = 0.8 * r->h;
 					break;
 				case SDLK_PAGEDOWN:
 					// zoom out from center
-					rect.x -= 0.125 * rect.w;
-					rect.y -= 0.125 * rect.h;
-					rect.w = 1.25 * rect.w;
-					rect.h = 1.25 * rect.h;
+					moveRect(r, -0.125 * r->w, -0.125 * r->h);
+					r->w = 1.25 * r->w;
+					r->h = 1.25 * r->h;
 					break;
 				case SDLK_s: //screenshot
-					SDL_UnlockMutex(mutex);
-					make_screenshot();
-					continue;
+					command = (Command) {COMMAND_SCREENSHOT, view,
+							screenshot_w > 0 ? screenshot_w : view.w,
+							screenshot_h > 0 ? screenshot_h : view.h, supersample};
+					if(commandPush(&commands, &command))
+						mandelLog(WARN, "Too many queued commands, dropping Screenshot\n");
+					SDL_SemPost(wakeup);
+					changed = 0;
+					break;
 				case SDLK_i:
+					manual_iterations(&view);
 					iter_diff = ev.key.keysym.mod & KMOD_SHIFT ? 10 : 1;
 					iter_diff *= ev.key.keysym.mod & KMOD_CTRL ? 100 : 1;
-					engine.changeIters(iter_diff);
-					force_rerender = 1;
+					view.iterations = clamp(view.iterations + iter_diff, 1, MAX_ITERATIONS);
 					break;
 				case SDLK_k:
+					manual_iterations(&view);
 					iter_diff = ev.key.keysym.mod & KMOD_SHIFT ? 10 : 1;
 					iter_diff *= ev.key.keysym.mod & KMOD_CTRL ? 100 : 1;
-					engine.changeIters(-iter_diff);
-					force_rerender = 1;
+					view.iterations = clamp(view.iterations - iter_diff, 1, MAX_ITERATIONS);
+					break;
+				case SDLK_a:
+					if(view.auto_iters)
+						manual_iterations(&view);
+					else
+						view.auto_iters = 1;
+					mandelLog(INFO, "Automatic iterations %s\n", view.auto_iters ? "on" : "off");
 					break;
 				case SDLK_u:
-					engine.changeExponent(1);
-					force_rerender = 1;
+					view.exponent = clamp(view.exponent + 1, 1, MAX_EXPONENT);
 					break;
 				case SDLK_j:
-					engine.changeExponent(-1);
-					force_rerender = 1;
+					view.exponent = clamp(view.exponent - 1, 1, MAX_EXPONENT);
+					break;
+				default:
+					changed = 0;
 					break;
 			}
-			SDL_UnlockMutex(mutex);
 		} else if(ev.type == SDL_MOUSEMOTION) {
+			mouse_x = ev.motion.x;
+			mouse_y = ev.motion.y;
+			atomic_store(&focus_x, mouse_x);
+			atomic_store(&focus_y, mouse_y);
 			if(mouse_state == SDL_PRESSED) {
-				SDL_LockMutex(mutex);
-				rect.x -= ev.motion.xrel * rect.w / (float)w;
-				rect.y -= ev.motion.yrel * rect.h / (float)h;
-				SDL_UnlockMutex(mutex);
-			} else {
-				// We don't want any interaction when the mouse just moves over the window
-				continue;
+				moveRect(r, -ev.motion.xrel * r->w / (double)view.w,
+						-ev.motion.yrel * r->h / (double)view.h);
+				changed = 1;
+				kind = INPUT_DRAG;
 			}
+			// We don't want any interaction when the mouse just moves over the window
 		} else if(ev.type == SDL_MOUSEBUTTONDOWN ||
 				ev.type == SDL_MOUSEBUTTONUP) {
 			if(ev.button.button == SDL_BUTTON_LEFT)
 				mouse_state = ev.button.state;
 		} else if(ev.type == SDL_WINDOWEVENT) {
-			float wh_ratio;
-			float coord_height;
-			SDL_LockMutex(mutex);
 			switch (ev.window.event) {
 				case SDL_WINDOWEVENT_RESIZED:
 				case SDL_WINDOWEVENT_SIZE_CHANGED:
 					// new width and height are stored in the event data
-					w = ev.window.data1;
-					h = ev.window.data2;
-					mandelLog(DEBUG, "Window size changed to %dx%d\n", w, h);
-					renderer.width = w;
-					renderer.height = h;
+					view.w = ev.window.data1;
+					view.h = ev.window.data2;
+					mandelLog(DEBUG, "Window size changed to %dx%d\n", view.w, view.h);
 
 					// Recalculate rect coordinates.
 					// The width stays the same (thereby scaling the window in the horizontal axis scales the image).
 					// The height is scaled down so that the rendered image gets cropped (rather than distorted).
-					wh_ratio = (float)w / (float)h;
-					coord_height = rect.w / wh_ratio;
-					rect.y = rect.y + rect.h / 2.0 - coord_height / 2.0;
-					rect.h = coord_height;
+					wh_ratio = (double)view.w / (double)view.h;
+					coord_height = r->w / wh_ratio;
+					moveRect(r, 0.0, r->h / 2.0 - coord_height / 2.0);
+					r->h = coord_height;
 
-					force_rerender = 1;
+					changed = 1;
+					kind = INPUT_RESIZE;
 					break;
 				case SDL_WINDOWEVENT_MOVED:
 				case SDL_WINDOWEVENT_EXPOSED:
-					force_refresh = 1;
+					atomic_store(&force_refresh, 1);
+					pipelineNotify(&pipeline);
 					break;
 				case SDL_WINDOWEVENT_CLOSE:
-					SDL_UnlockMutex(mutex);
 					return;
 			}
-			SDL_UnlockMutex(mutex);
+		}
+
+		if(changed) {
+			view.seq++;
+			// Recorded before publishing, the frame may be presented right after
+			latencyInput(kind, view.seq);
+			viewPublish(&views, &view);
+			SDL_SemPost(wakeup);
 		}
 	}
 }
@@ -332,10 +958,83 @@ void print_help() {
 	       "  -vv           Increase verbosity level to DEBUG\n"
 	       "  --no-aa       Disable anti-aliasing in the preview\n"
 	       "  --no-simd     Disable the use of SIMD instructions in CPU rendering mode\n"
+	       "  --fixed-point Render in 64 bit fixed point on the CPU, which gives\n"
+	       "                the same pixels on every machine (down to a pixel\n"
+	       "                spacing of 1e-16). Use it on all --worker processes\n"
+	       "                of a distributed render, too\n"
+	       "  --threads N   Number of CPU rendering threads\n"
+	       "                (default: one per CPU or one per pinned CPU)\n"
+	       "  --pin-cpus LIST\n"
+	       "                Pin CPU rendering threads to the given CPUs,\n"
+	       "                e.g. 0-7,16-23\n"
+	       "  --huge-pages  Back frame buffers with transparent huge pages\n"
+	       "  --numa        Every CPU rendering thread owns and first-touches\n"
+	       "                the tiles it renders (pins threads to CPUs 0..N-1\n"
+	       "                unless --pin-cpus is given)\n"
+	       "  --no-tune     Don't tune CPU rendering for this machine on startup\n"
+	       "  --retune      Tune CPU rendering again instead of using the cached\n"
+	       "                tuning\n"
+	       "  --benchmark   Measure the speed of the CPU kernels and quit\n"
 	       "  --force-cpu   Force usage of CPU rendering,\n"
 	       "                even if GPU is available\n"
+	       "  --frame-time MS\n"
+	       "                Frame time budget while interacting, frames that\n"
+	       "                would take longer are rendered in lower resolution\n"
 	       "  --screenshot-dir\n"
 	       "                Change the directory where screenshots are stored\n"
+	       "  --screenshot-size W H\n"
+	       "                Size of screenshots (default: size of the window)\n"
+	       "  --supersample N\n"
+	       "                Render screenshots with N x N samples per pixel\n"
+	       "                (default: 2, at most 16)\n"
+	       "  --record FILE Record the input session into FILE\n"
+	       "  --replay FILE Replay a recorded input session from the view it was\n"
+	       "                recorded with and report the input latency, quits\n"
+	       "                once the session is over\n"
+	       "  --headless    Use SDL's dummy video driver instead of a window\n"
+	       "  --fresh       Start at the default view instead of where the last\n"
+	       "                session ended\n"
+	       "  --export-frames NAME\n"
+	       "                Copy every shown frame into a ring of frames in the\n"
+	       "                shared memory object /NAME for other processes to\n"
+	       "                read (layout in frame_export.h)\n"
+	       "  --latency     Report the input latency when quitting\n"
+	       "  --iterations N\n"
+	       "                Maximum iterations to start with\n"
+	       "  --auto-iterations\n"
+	       "                Start with the iterations picked automatically\n"
+	       "  --buddhabrot  Show how often the orbits of escaping points visit\n"
+	       "                each pixel instead of the escape times. The image\n"
+	       "                becomes less noisy the longer the view stays still\n"
+	       "  --anti-buddhabrot\n"
+	       "                Like --buddhabrot, with the orbits of the points\n"
+	       "                that don't escape\n"
+	       "  --nebula      Color the red, green and blue channel of the\n"
+	       "                Buddhabrot with iteration limits of 5000, 500 and\n"
+	       "                50 instead of the maximum iterations\n"
+	       "  --daemon ADDRESS\n"
+	       "                Don't open a window, serve render requests on the\n"
+	       "                given Unix socket path or host:port instead\n"
+	       "                (see mandelbrot-client)\n"
+	       "  --worker ADDRESS\n"
+	       "                Like --daemon, but always renders on the CPU\n"
+	       "  --output FILE\n"
+	       "                Don't open a window, render a single WIDTH x HEIGHT\n"
+	       "                image into the BMP file FILE\n"
+	       "  --view X Y W H\n"
+	       "                Region of the complex plane to show at startup\n"
+	       "  --workers LIST\n"
+	       "                Render the --output image in tiles on the workers\n"
+	       "                with the given comma separated addresses\n"
+	       "  --tile-size N Edge length of the tiles the --output image is\n"
+	       "                rendered and checkpointed in\n"
+	       "  --checkpoint FILE\n"
+	       "                Where complete tiles of the --output image are kept\n"
+	       "                (default: the output path followed by .checkpoint)\n"
+	       "  --no-checkpoint\n"
+	       "                Don't keep complete tiles of the --output image\n"
+	       "  --resume      Continue an interrupted --output render from its\n"
+	       "                checkpoint, only rendering the missing tiles\n"
 	       "\n"
 	       "Bindings:\n"
 	       " q, ESC    Quit the program\n"
@@ -346,13 +1045,16 @@ void print_help() {
 	       " Page Up/Down, Scroll wheel\n"
 	       "           Zoom in/out respectivly\n"
 	       "\n"
-	       " s         Make a screenshot and save as output.bmp\n"
-	       "           in current working directory\n"
+	       " s         Make a screenshot in the background and save it as\n"
+	       "           mandelbrot-DATE-TIME-N.bmp in the screenshot directory\n"
 	       "\n"
 	       " i, k      Increase / Decrease maximum iterations\n"
 	       "           Hold shift for a step size of 10\n"
 	       "           Hold ctrl for a step size of 100\n"
-	       "           Hold ctrl and shift for a step size of 1000\n");
+	       "           Hold ctrl and shift for a step size of 1000\n"
+	       "\n"
+	       " a         Toggle picking the maximum iterations automatically\n"
+	       "           from the zoom level and the rendered image\n");
 }
 
 void parse_arguments(int argc, char **argv) {
@@ -368,6 +1070,7 @@ void parse_arguments(int argc, char **argv) {
 				w = atoi(argv[i]);
 			if(w <= 0 || w > 16383)
 				w = DEFAULT_WIDTH;
+			w_given = 1;
 		} else if(strcmp("-h", argv[i]) == 0
 				|| strcmp("--height", argv[i]) == 0) { // Set window height
 			i++;
@@ -375,6 +1078,7 @@ void parse_arguments(int argc, char **argv) {
 				h = atoi(argv[i]);
 			if(h <= 0 || h > 16383)
 				h = DEFAULT_HEIGHT;
+			h_given = 1;
 		} else if(strcmp("-v", argv[i]) == 0) {
 			setLogLevel(VERBOSE);
 			mandelLog(INFO, "Loglevel is set to VERBOSE\n");
@@ -388,9 +1092,121 @@ void parse_arguments(int argc, char **argv) {
 			force_cpu = 1;
 		} else if(strcmp("--no-simd", argv[i]) == 0) {
 			no_simd = 1;
+		} else if(strcmp("--fixed-point", argv[i]) == 0) {
+			// The GPU kernels are not bit-exact
+			fixed_point = 1;
+			force_cpu = 1;
+		} else if(strcmp("--no-tune", argv[i]) == 0) {
+			no_tune = 1;
+		} else if(strcmp("--retune", argv[i]) == 0) {
+			retune = 1;
+		} else if(strcmp("--threads", argv[i]) == 0) {
+			i++;
+			if(i < argc)
+				cpu_threading.nthreads = atoi(argv[i]);
+			if(cpu_threading.nthreads < 0 || cpu_threading.nthreads > MAX_CPU_THREADS)
+				cpu_threading.nthreads = 0;
+		} else if(strcmp("--pin-cpus", argv[i]) == 0) {
+			i++;
+			int ncpus = i < argc ? parseCpuList(argv[i], pinned_cpus, MAX_CPU_THREADS) : -1;
+			if(ncpus > 0) {
+				cpu_threading.cpus = pinned_cpus;
+				cpu_threading.ncpus = ncpus;
+			} else {
+				mandelLog(WARN, "Ignoring malformed CPU list for --pin-cpus\n");
+			}
+		} else if(strcmp("--huge-pages", argv[i]) == 0) {
+			frameArenaUseHugePages(1);
+		} else if(strcmp("--numa", argv[i]) == 0) {
+			cpu_threading.numa = 1;
+		} else if(strcmp("--frame-time", argv[i]) == 0) {
+			i++;
+			if(i < argc)
+				target_frame_time = atof(argv[i]);
+			if(target_frame_time <= 0.0)
+				target_frame_time = TARGET_FRAME_TIME_MS;
 		} else if(strcmp("--screenshot-dir", argv[i]) == 0) {
 			i++;
 			screenshot_dir = argv[i];
+		} else if(strcmp("--screenshot-size", argv[i]) == 0) {
+			if(i + 2 < argc) {
+				screenshot_w = atoi(argv[i + 1]);
+				screenshot_h = atoi(argv[i + 2]);
+			}
+			i += 2;
+		} else if(strcmp("--supersample", argv[i]) == 0) {
+			i++;
+			if(i < argc)
+				supersample = clamp(atoi(argv[i]), 1, IMAGE_MAX_BOX_FACTOR);
+		} else if(strcmp("--benchmark", argv[i]) == 0) {
+			benchmark = 1;
+			force_cpu = 1;
+		} else if(strcmp("--daemon", argv[i]) == 0) {
+			i++;
+			daemon_socket = argv[i];
+		} else if(strcmp("--worker", argv[i]) == 0) {
+			i++;
+			daemon_socket = argv[i];
+			force_cpu = 1;
+		} else if(strcmp("--output", argv[i]) == 0) {
+			i++;
+			output_path = argv[i];
+		} else if(strcmp("--view", argv[i]) == 0) {
+			if(i + 4 < argc) {
+				custom_rect = (Rectangle) {atof(argv[i + 1]), atof(argv[i + 2]),
+						atof(argv[i + 3]), atof(argv[i + 4]), 0.0, 0.0};
+				custom_view = custom_rect.w > 0.0 && custom_rect.h > 0.0;
+			}
+			i += 4;
+		} else if(strcmp("--iterations", argv[i]) == 0) {
+			i++;
+			if(i < argc)
+				start_iterations = clamp(atoi(argv[i]), 1, MAX_ITERATIONS);
+			iterations_given = 1;
+		} else if(strcmp("--auto-iterations", argv[i]) == 0) {
+			start_auto_iters = 1;
+			iterations_given = 1;
+		} else if(strcmp("--buddhabrot", argv[i]) == 0) {
+			buddhabrot = 1;
+			buddha_mode = BUDDHA_NORMAL;
+		} else if(strcmp("--anti-buddhabrot", argv[i]) == 0) {
+			buddhabrot = 1;
+			buddha_mode = BUDDHA_ANTI;
+		} else if(strcmp("--fresh", argv[i]) == 0) {
+			fresh = 1;
+		} else if(strcmp("--nebula", argv[i]) == 0) {
+			nebula = 1;
+		} else if(strcmp("--export-frames", argv[i]) == 0) {
+			i++;
+			export_name = argv[i];
+		} else if(strcmp("--workers", argv[i]) == 0) {
+			i++;
+			char *address = i < argc ? strtok(argv[i], ",") : NULL;
+			for(; address != NULL && nworkers < MAX_WORKERS; address = strtok(NULL, ","))
+				workers[nworkers++] = address;
+		} else if(strcmp("--record", argv[i]) == 0) {
+			i++;
+			record_path = argv[i];
+		} else if(strcmp("--replay", argv[i]) == 0) {
+			i++;
+			replay_path = argv[i];
+		} else if(strcmp("--headless", argv[i]) == 0) {
+			headless = 1;
+		} else if(strcmp("--latency", argv[i]) == 0) {
+			measure_latency = 1;
+		} else if(strcmp("--checkpoint", argv[i]) == 0) {
+			i++;
+			checkpoint_path = argv[i];
+		} else if(strcmp("--no-checkpoint", argv[i]) == 0) {
+			no_checkpoint = 1;
+		} else if(strcmp("--resume", argv[i]) == 0) {
+			resume = 1;
+		} else if(strcmp("--tile-size", argv[i]) == 0) {
+			i++;
+			if(i < argc)
+				tile_size = atoi(argv[i]);
+			if(tile_size < 1 || tile_size > 16383)
+				tile_size = COORDINATOR_TILE_SIZE;
 		}
 		i++;
 	}
@@ -403,15 +1219,56 @@ int main(int argc, char **argv) {
 
 	parse_arguments(argc, argv);
 
+	if(benchmark) {
+		init_compute_engine();
+		benchmarkCpu(cpu_engine);
+		cleanup_compute_engine();
+		return EXIT_SUCCESS;
+	}
+
+	if(daemon_socket != NULL) {
+		// Serve other processes instead of opening a window
+		init_compute_engine();
+		int status = runDaemon(daemon_socket, &engine);
+		cleanup_compute_engine();
+		return status ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 	float wh_ratio = (float)w / (float)h;
 	float coord_height = 4.0 / wh_ratio;
-	rect = (Rectangle) {-2.5, -coord_height / 2, 4.0, coord_height};
+	rect = (Rectangle) {-2.5, -coord_height / 2, 4.0, coord_height, 0.0, 0.0};
+	if(custom_view)
+		rect = custom_rect;
+
+	if(output_path != NULL) {
+		if(buddhabrot)
+			mandelLog(WARN, "--output always renders escape times, ignoring --buddhabrot\n");
+		return render_to_file() ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	// Recordings start from the command line view like the replays made of them
+	if(!fresh && replay_path == NULL && record_path == NULL)
+		resume_last_view();
+	if(replay_path != NULL)
+		replay_recorded_view();
 
-	mutex = SDL_CreateMutex();
-	if(!mutex) {
-		mandelLog(ERROR, "Could not create Mutex!\n");
+	wakeup = SDL_CreateSemaphore(0);
+	if(!wakeup) {
+		mandelLog(ERROR, "Could not create Semaphore: %s\n", SDL_GetError());
 		exit(EXIT_FAILURE);
 	}
+	ViewState initial = initial_view();
+	viewExchangeInit(&views, &initial);
+	commandQueueInit(&commands);
+	schedulerInit(&scheduler, target_frame_time);
+	autoItersInit(&auto_iters);
+
+	if(headless) // Has to be set before SDL gets initialized
+		setenv("SDL_VIDEODRIVER", "dummy", 1);
+	if(record_path != NULL && sessionRecordStart(record_path, &initial))
+		exit(EXIT_FAILURE);
+	if(record_path != NULL || measure_latency)
+		latencyEnable();
 
 	SDL_Thread *renderThread = SDL_CreateThread(renderLoop,
 			"RenderThread", NULL);
@@ -421,19 +1278,23 @@ int main(int argc, char **argv) {
 	}
 	eventLoop();
 
-	quit = 1;
+	atomic_store(&quit, 1);
+	SDL_SemPost(wakeup);
+	if(atomic_load(&engine_initialized))
+		pipelineNotify(&pipeline);
 	SDL_WaitThread(renderThread, NULL);
+	if(replay_path == NULL)
+		store_last_view();
 
-#if ENABLE_CUDA
-	if(engine.type == ENGINE_TYPE_CUDA)
-		mandelbrotCudaCleanup();
-	else
-#endif
-		mandelbrotCpuCleanup();
+	sessionReplayStop();
+	sessionRecordStop();
+	latencyReport();
+
+	cleanup_compute_engine();
 
 	mandelLog(DEBUG, "Destroying Renderer\n");
-	free(framebuffer);
-	destroyRenderer(renderer);
-	SDL_DestroyMutex(mutex);
+	pipelineDestroy(&pipeline);
+	destroyRenderer(&renderer);
+	SDL_DestroySemaphore(wakeup);
 	return 0;
 }
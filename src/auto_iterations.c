@@ -0,0 +1,70 @@
+#include "auto_iterations.h"
+#include "config.h"
+#include "logger.h"
+
+#include <stddef.h>
+#include <math.h>
+
+// Width of the view showing the whole set
+#define FULL_VIEW_WIDTH 4.0
+// Escaped pixels in the top eighth of the budget, in pixels per million,
+// above which the budget is raised
+#define NEAR_LIMIT_PPM 500
+// Escaped pixels allowed above half of a lowered budget, in pixels per million
+#define TAIL_PPM 100
+
+void autoItersInit(AutoIterations *auto_iters) {
+	auto_iters->iterations = 0;
+}
+
+int autoItersForZoom(Rectangle rect) {
+	double octaves = log2(FULL_VIEW_WIDTH / rect.w);
+	if(octaves < 0.0)
+		octaves = 0.0;
+	int iterations = AUTO_ITERS_MIN + (int)(AUTO_ITERS_PER_OCTAVE * octaves);
+	return iterations < MAX_ITERATIONS ? iterations : MAX_ITERATIONS;
+}
+
+static int clampBudget(int iterations) {
+	return iterations < AUTO_ITERS_MIN ? AUTO_ITERS_MIN :
+			iterations > MAX_ITERATIONS ? MAX_ITERATIONS : iterations;
+}
+
+int autoItersUpdate(AutoIterations *auto_iters, Rectangle rect, const IterStats *stats) {
+	int current = auto_iters->iterations;
+	int next = current;
+	if(current == 0 || stats == NULL || stats->pixels == 0 ||
+			stats->max_iters != current) {
+		// Nothing known about the current budget
+		next = current == 0 || stats == NULL ? autoItersForZoom(rect) : current;
+	} else {
+		long near_limit = 0;
+		for(int b = ITER_STATS_BUCKETS * 7 / 8; b < ITER_STATS_BUCKETS; b++)
+			near_limit += stats->hist[b];
+
+		if(near_limit * 1000000 > (long)stats->pixels * NEAR_LIMIT_PPM) {
+			next = clampBudget(current + current / 2);
+		} else {
+			// Highest bucket below which all but TAIL_PPM of the pixels escape
+			long tail = 0;
+			int b = ITER_STATS_BUCKETS - 1;
+			while(b > 0 && (tail + stats->hist[b]) * 1000000 <= (long)stats->pixels * TAIL_PPM)
+				tail += stats->hist[b--];
+			int escape_iters = (int)((long)(b + 1) * current / ITER_STATS_BUCKETS);
+
+			// Twice the iterations the pixels need keeps them clear of the limit.
+			// Staying near the zoom guess lets the budget catch up quickly when
+			// detail comes into view. Small changes are not worth it.
+			int target = clampBudget(2 * escape_iters);
+			if(target < autoItersForZoom(rect) / 2)
+				target = clampBudget(autoItersForZoom(rect) / 2);
+			if(target < current * 3 / 4)
+				next = target;
+		}
+	}
+
+	if(next != current)
+		mandelLog(VERBOSE, "Auto iterations: %d -> %d\n", current, next);
+	auto_iters->iterations = next;
+	return next;
+}
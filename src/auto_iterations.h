@@ -0,0 +1,27 @@
+#ifndef _AUTO_ITERATIONS_H_
+#define _AUTO_ITERATIONS_H_
+
+#include "mandelbrot_common.h"
+
+/*
+ * Picks the iteration budget of every frame. The zoom level gives a first
+ * guess, the iteration counts of the previous frame refine it: pixels that
+ * escape just below the limit mean more would escape with a higher one,
+ * and when no pixel gets close to the limit it can be lowered without
+ * changing the image. The result is the smallest budget that still gives
+ * a converged image.
+ */
+typedef struct AutoIterations {
+	int iterations; // Budget of the next frame, 0 before the first one
+} AutoIterations;
+
+void autoItersInit(AutoIterations *auto_iters);
+
+// Guess for a view of the given size without any statistics
+int autoItersForZoom(Rectangle rect);
+
+// Returns the budget of the next frame showing rect. stats are those of the
+// last frame and may be NULL when the engine doesn't collect them.
+int autoItersUpdate(AutoIterations *auto_iters, Rectangle rect, const IterStats *stats);
+
+#endif
@@ -0,0 +1,285 @@
+#include "autotune.h"
+#include "mandelbrot_cpu.h"
+#include "frame_arena.h"
+#include "logger.h"
+#include "config.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TUNE_REPETITIONS 2
+#define CPU_KEY_LENGTH 256
+#define CACHE_PATH_LENGTH 4096
+
+static const char *precision_keys[3] = {"float", "double", "dd"};
+
+// Scenes are off the real axis so mirroring doesn't skew the timings
+static const Rectangle float_scene = {-1.0, 0.05, 0.5, 0.28125, 0.0, 0.0};
+static const Rectangle double_scene = {-0.743643887037151, 0.131825904205330,
+		1e-9, 5.625e-10, 0.0, 0.0};
+static const Rectangle dd_scene = {-0.743643887037151, 0.131825904205330,
+		1e-17, 5.625e-18, 0.0, 0.0};
+
+// Identifies the machine a tuning was measured on
+static void cpuKey(char *key, int len) {
+	char model[CPU_KEY_LENGTH] = "unknown";
+	FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+	if(cpuinfo != NULL) {
+		char line[CPU_KEY_LENGTH];
+		while(fgets(line, sizeof(line), cpuinfo) != NULL) {
+			char *value = strchr(line, ':');
+			if(strncmp(line, "model name", 10) != 0 || value == NULL)
+				continue;
+			value++;
+			while(*value == ' ')
+				value++;
+			value[strcspn(value, "\n")] = '\0';
+			snprintf(model, sizeof(model), "%s", value);
+			break;
+		}
+		fclose(cpuinfo);
+	}
+	// Tunings from before kernels were added don't know about them
+	int nkernels;
+	kernelRegistry(&nkernels);
+	snprintf(key, len, "%s x%ld k%d", model, sysconf(_SC_NPROCESSORS_ONLN), nkernels);
+}
+
+static int loadTuning(const char *key, CpuTuning *tuning) {
+	char path[CACHE_PATH_LENGTH];
+	if(cachePath(path, sizeof(path), "tuning", 0))
+		return -1;
+	FILE *file = fopen(path, "r");
+	if(file == NULL)
+		return -1;
+
+	char line[CPU_KEY_LENGTH + 8];
+	int found_key = 0;
+	while(fgets(line, sizeof(line), file) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		char *value = strchr(line, '=');
+		if(value == NULL)
+			continue;
+		*value++ = '\0';
+
+		if(strcmp(line, "cpu") == 0) {
+			// A tuning of a different machine is useless here
+			found_key = strcmp(value, key) == 0;
+			if(!found_key)
+				break;
+		} else if(strcmp(line, "threads") == 0) {
+			tuning->nthreads = atoi(value);
+		} else if(strcmp(line, "tile") == 0) {
+			tuning->tile_size = atoi(value);
+		} else if(strcmp(line, "unroll") == 0) {
+			tuning->unroll = atoi(value);
+		} else {
+			for(int p = 0; p < 3; p++) {
+				if(strcmp(line, precision_keys[p]) == 0)
+					snprintf(tuning->kernels[p], KERNEL_NAME_LENGTH, "%s", value);
+			}
+		}
+	}
+	fclose(file);
+	return found_key ? 0 : -1;
+}
+
+static void storeTuning(const char *key, const CpuTuning *tuning) {
+	char path[CACHE_PATH_LENGTH];
+	if(cachePath(path, sizeof(path), "tuning", 1)) {
+		mandelLog(WARN, "Could not create cache directory for the CPU tuning\n");
+		return;
+	}
+	FILE *file = fopen(path, "w");
+	if(file == NULL) {
+		mandelLog(WARN, "Could not write CPU tuning to %s\n", path);
+		return;
+	}
+	fprintf(file, "cpu=%s\n", key);
+	for(int p = 0; p < 3; p++) {
+		if(tuning->kernels[p][0] != '\0')
+			fprintf(file, "%s=%s\n", precision_keys[p], tuning->kernels[p]);
+	}
+	fprintf(file, "threads=%d\ntile=%d\nunroll=%d\n",
+			tuning->nthreads, tuning->tile_size, tuning->unroll);
+	fclose(file);
+	mandelLog(VERBOSE, "Stored CPU tuning in %s\n", path);
+}
+
+static double nowMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Returns the fastest of TUNE_REPETITIONS renders of scene in milliseconds
+static double timeScene(CpuEngine *cpu, const CpuTuning *tuning, Rectangle scene,
+		int w, int h, int *out) {
+	if(mandelbrotCpuApplyTuning(cpu, tuning))
+		return -1.0;
+
+	double best = -1.0;
+	for(int rep = 0; rep < TUNE_REPETITIONS; rep++) {
+		double start = nowMs();
+		generateImageCpuWH(cpu, w, h, scene, out);
+		double ms = nowMs() - start;
+		if(best < 0.0 || ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+// Times every supported kernel of a precision on scene and keeps the fastest in best
+static void tuneKernel(CpuEngine *cpu, CpuTuning *best, KernelPrecision precision,
+		Rectangle scene, int w, int h, int *out) {
+	int nkernels;
+	const KernelInfo *kernels = kernelRegistry(&nkernels);
+	double best_ms = -1.0;
+	CpuTuning candidate = *best;
+
+	for(int k = 0; k < nkernels; k++) {
+		if(kernels[k].precision != precision || !kernelSupported(&kernels[k], 0))
+			continue;
+		snprintf(candidate.kernels[precision], KERNEL_NAME_LENGTH, "%s", kernels[k].name);
+		double ms = timeScene(cpu, &candidate, scene, w, h, out);
+		mandelLog(DEBUG, "Tuning %s: %.3f ms\n", kernels[k].name, ms);
+		if(ms >= 0.0 && (best_ms < 0.0 || ms < best_ms)) {
+			best_ms = ms;
+			*best = candidate;
+		}
+	}
+}
+
+static void measureTuning(CpuEngine *cpu, CpuTuning *best) {
+	int w = 256, h = 144;
+	int *out = frameAlloc(w * h);
+	if(out == NULL)
+		return;
+
+	int nkernels;
+	const KernelInfo *kernels = kernelRegistry(&nkernels);
+	int base_threads = best->nthreads;
+	int thread_counts[3] = {base_threads, base_threads / 2, base_threads * 2};
+	// 0 would only repeat TILE_SIZE, every size is ordered by cost
+	int tile_sizes[3] = {32, 64, 128};
+	double best_ms = -1.0;
+	CpuTuning candidate = *best;
+
+	for(int k = 0; k < nkernels; k++) {
+		if(kernels[k].precision != PRECISION_FLOAT || !kernelSupported(&kernels[k], 0))
+			continue;
+		snprintf(candidate.kernels[PRECISION_FLOAT], KERNEL_NAME_LENGTH, "%s", kernels[k].name);
+		for(int t = 0; t < 3; t++) {
+			if(thread_counts[t] < 1 || thread_counts[t] > MAX_CPU_THREADS ||
+					(t > 0 && thread_counts[t] == thread_counts[0]))
+				continue;
+			candidate.nthreads = thread_counts[t];
+			for(int s = 0; s < 3; s++) {
+				candidate.tile_size = tile_sizes[s];
+				for(int u = 1; u <= kernels[k].max_unroll; u++) {
+					candidate.unroll = u;
+					double ms = timeScene(cpu, &candidate, float_scene, w, h, out);
+					mandelLog(DEBUG, "Tuning %s threads=%d tile=%d unroll=%d: %.3f ms\n",
+							kernels[k].name, candidate.nthreads,
+							candidate.tile_size, u, ms);
+					if(ms >= 0.0 && (best_ms < 0.0 || ms < best_ms)) {
+						best_ms = ms;
+						*best = candidate;
+					}
+				}
+			}
+		}
+	}
+
+	// Deep views are rare enough that only the kernel itself is worth tuning
+	w = 128;
+	h = 72;
+	tuneKernel(cpu, best, PRECISION_DOUBLE, double_scene, w, h, out);
+	tuneKernel(cpu, best, PRECISION_DOUBLE_DOUBLE, dd_scene, w, h, out);
+	frameFree(out);
+}
+
+// Iterations the scalar reference kernel needs for scene, the same work
+// for every kernel
+static double sceneIterations(Rectangle scene, int w, int h) {
+	double total = 0.0;
+	for(int py = 0; py < h; py++) {
+		for(int px = 0; px < w; px++) {
+			float cx = (float)px / (float)w * scene.w + scene.x;
+			float cy = (float)py / (float)h * scene.h + scene.y;
+			total += getIterationsCpu(cx, cy, ESCAPE_RADIUS, DEFAULT_ITERATIONS,
+					DEFAULT_EXPONENT);
+		}
+	}
+	return total;
+}
+
+void benchmarkCpu(CpuEngine *cpu) {
+	// The seahorse valley has far more iterations per pixel than the tuning scene
+	const Rectangle scenes[2] = {float_scene, {-0.8, 0.05, 0.1, 0.05625, 0.0, 0.0}};
+	const char *scene_names[2] = {"tuning", "seahorse"};
+	int w = 512, h = 288;
+	int *out = frameAlloc(w * h);
+	if(out == NULL)
+		return;
+
+	CpuTuning initial;
+	mandelbrotCpuGetTuning(cpu, &initial);
+	int nkernels;
+	const KernelInfo *kernels = kernelRegistry(&nkernels);
+	// Filled tiles would count iterations no kernel did
+	mandelbrotCpuSetUniformFill(cpu, 0);
+
+	mandelLog(INFO, "%-10s %-10s %6s %10s %12s\n", "scene", "kernel", "unroll", "ms", "Giter/s");
+	for(int s = 0; s < 2; s++) {
+		double iterations = sceneIterations(scenes[s], w, h);
+		for(int k = 0; k < nkernels; k++) {
+			if(kernels[k].precision != PRECISION_FLOAT || !kernelSupported(&kernels[k], 0))
+				continue;
+			CpuTuning candidate = initial;
+			snprintf(candidate.kernels[PRECISION_FLOAT], KERNEL_NAME_LENGTH, "%s", kernels[k].name);
+			for(int u = 1; u <= kernels[k].max_unroll; u++) {
+				candidate.unroll = u;
+				double ms = timeScene(cpu, &candidate, scenes[s], w, h, out);
+				if(ms <= 0.0)
+					continue;
+				mandelLog(INFO, "%-10s %-10s %6d %10.2f %12.3f\n", scene_names[s],
+						kernels[k].name, u, ms, iterations / ms / 1e6);
+			}
+		}
+	}
+
+	mandelbrotCpuSetUniformFill(cpu, 1);
+	mandelbrotCpuApplyTuning(cpu, &initial);
+	frameFree(out);
+}
+
+int autotuneCpu(CpuEngine *cpu, int force) {
+	char key[CPU_KEY_LENGTH];
+	cpuKey(key, sizeof(key));
+
+	CpuTuning tuning;
+	mandelbrotCpuGetTuning(cpu, &tuning);
+	if(!force && loadTuning(key, &tuning) == 0) {
+		mandelLog(VERBOSE, "Using cached CPU tuning for %s\n", key);
+		return mandelbrotCpuApplyTuning(cpu, &tuning);
+	}
+
+	mandelLog(INFO, "Tuning CPU rendering for %s\n", key);
+	CpuTuning initial = tuning;
+	measureTuning(cpu, &tuning);
+	if(mandelbrotCpuApplyTuning(cpu, &tuning)) {
+		mandelbrotCpuApplyTuning(cpu, &initial);
+		return -1;
+	}
+	mandelLog(VERBOSE, "CPU tuning: float=%s double=%s dd=%s threads=%d tile=%d unroll=%d\n",
+			tuning.kernels[PRECISION_FLOAT], tuning.kernels[PRECISION_DOUBLE],
+			tuning.kernels[PRECISION_DOUBLE_DOUBLE], tuning.nthreads,
+			tuning.tile_size, tuning.unroll);
+	storeTuning(key, &tuning);
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef _AUTOTUNE_H_
+#define _AUTOTUNE_H_
+
+#include "mandelbrot_cpu.h"
+
+// Tunes the CPU engine context for this machine.
+// A tuning cached for the same CPU is reused unless force is set.
+// Returns nonzero if no tuning could be applied.
+int autotuneCpu(CpuEngine *cpu, int force);
+
+// Logs the speed of every float kernel on the scenes used for tuning
+void benchmarkCpu(CpuEngine *cpu);
+
+#endif
@@ -0,0 +1,430 @@
+#include "buddhabrot.h"
+#include "mandelbrot_cpu.h"
+#include "logger.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+
+/*
+ * Points c are sampled from [-2, 2] x [0, 2]. The orbit of the conjugate of
+ * c is the mirror image of the orbit of c, so every orbit is also counted
+ * mirrored to the real axis instead of sampling the lower half.
+ */
+#define SAMPLE_X -2.0f
+#define SAMPLE_W 4.0f
+// Cells of the importance map along the real axis, half as many along the imaginary one
+#define GRID 128
+#define GRID_CELLS (GRID * GRID / 2)
+// Probes per cell along each axis
+#define PROBES 2
+// Cells whose orbits matter are sampled this many times more often. Samples
+// of the other cells count this many times more, so the density stays right.
+#define IMPORTANCE 16
+// Escaping orbits at least this long make a cell matter
+#define LONG_ORBIT 32
+// Points a worker samples and iterates together
+#define BATCH 256
+
+typedef struct BuddhaWorker {
+	BuddhaEngine *buddha;
+	uint32_t *hist; // Channels of w x h counts, merged after every pass
+	uint64_t rng;
+	long nsamples;
+} BuddhaWorker;
+
+struct BuddhaEngine {
+	ThreadPool *pool;
+	int owns_pool;
+	int nthreads;
+	int simd;
+
+	BuddhaSettings settings;
+	int have_importance;
+	int max_limit;
+	Rectangle rect;
+	int w;
+	int h;
+	long samples;
+
+	uint64_t *density; // Channels of w x h counts
+	BuddhaWorker *workers;
+
+	// Cumulative weights of the cells of the importance map
+	uint32_t cdf[GRID_CELLS];
+	uint8_t weight[GRID_CELLS];
+
+	// Rows handed out when merging the worker histograms
+	int next_row;
+};
+
+static uint64_t nextRandom(uint64_t *state) {
+	// splitmix64
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static float randomUnit(uint64_t *state) {
+	return (float)(nextRandom(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+static void escapeIterations(BuddhaEngine *buddha, const float *cx, const float *cy,
+		int *counts, int n, int max_iters) {
+#if ENABLE_AVX
+	if(buddha->simd) {
+		escapeIterationsFma(cx, cy, counts, n, ESCAPE_RADIUS, max_iters,
+				buddha->settings.exponent);
+		return;
+	}
+#endif
+	for(int i = 0; i < n; i++)
+		counts[i] = getIterationsCpu(cx[i], cy[i], ESCAPE_RADIUS, max_iters,
+				buddha->settings.exponent);
+}
+
+// Points in the main cardioid and the period 2 bulb never escape
+static int inMainBulbs(float x, float y) {
+	float q = (x - 0.25f) * (x - 0.25f) + y * y;
+	if(q * (q + (x - 0.25f)) <= 0.25f * y * y)
+		return 1;
+	return (x + 1.0f) * (x + 1.0f) + y * y <= 0.0625f;
+}
+
+static void buildImportance(BuddhaEngine *buddha) {
+	const int nprobes = GRID_CELLS * PROBES * PROBES;
+	float *cx = (float *)malloc(nprobes * sizeof(float));
+	float *cy = (float *)malloc(nprobes * sizeof(float));
+	int *counts = (int *)malloc(nprobes * sizeof(int));
+	float cell = SAMPLE_W / GRID;
+	const BuddhaSettings *s = &buddha->settings;
+
+	int min_limit = s->limits[0];
+	for(int k = 1; k < 3; k++)
+		min_limit = s->limits[k] < min_limit ? s->limits[k] : min_limit;
+
+	if(cx == NULL || cy == NULL || counts == NULL) {
+		// Uniform sampling is still correct, just slower to converge
+		mandelLog(WARN, "Could not allocate memory for the importance map\n");
+		for(int c = 0; c < GRID_CELLS; c++)
+			buddha->weight[c] = 1;
+	} else {
+		for(int c = 0; c < GRID_CELLS; c++) {
+			for(int p = 0; p < PROBES * PROBES; p++) {
+				cx[c * PROBES * PROBES + p] = SAMPLE_X +
+						((c % GRID) + (p % PROBES + 0.5f) / PROBES) * cell;
+				cy[c * PROBES * PROBES + p] =
+						((c / GRID) + (p / PROBES + 0.5f) / PROBES) * cell;
+			}
+		}
+		escapeIterations(buddha, cx, cy, counts, nprobes, buddha->max_limit);
+
+		int important = 0;
+		for(int c = 0; c < GRID_CELLS; c++) {
+			int inside = 0, long_orbits = 0;
+			for(int p = 0; p < PROBES * PROBES; p++) {
+				int e = counts[c * PROBES * PROBES + p];
+				inside += e >= buddha->max_limit;
+				long_orbits += e >= LONG_ORBIT && e < buddha->max_limit;
+			}
+			int matters;
+			if(s->mode == BUDDHA_NORMAL) {
+				// Long orbits start close to the boundary
+				matters = long_orbits > 0 || (inside > 0 && inside < PROBES * PROBES);
+			} else {
+				matters = 0;
+				for(int p = 0; p < PROBES * PROBES; p++)
+					matters |= counts[c * PROBES * PROBES + p] >= min_limit;
+			}
+			buddha->weight[c] = matters ? IMPORTANCE : 1;
+			important += matters;
+		}
+		mandelLog(VERBOSE, "Buddhabrot: %d of %d cells are sampled more often\n",
+				important, GRID_CELLS);
+	}
+
+	uint32_t sum = 0;
+	for(int c = 0; c < GRID_CELLS; c++) {
+		sum += buddha->weight[c];
+		buddha->cdf[c] = sum;
+	}
+	free(cx);
+	free(cy);
+	free(counts);
+}
+
+// Picks a cell with a probability proportional to its weight
+static int sampleCell(BuddhaEngine *buddha, uint64_t *rng) {
+	uint32_t r = (uint32_t)(nextRandom(rng) % buddha->cdf[GRID_CELLS - 1]);
+	int lo = 0, hi = GRID_CELLS - 1;
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(buddha->cdf[mid] > r)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+static inline void countPoint(BuddhaEngine *buddha, uint32_t *hist, float x, float y,
+		int i, const int *len, uint32_t weight) {
+	double fx = (x - buddha->rect.x) * buddha->w / buddha->rect.w;
+	double fy = (y - buddha->rect.y) * buddha->h / buddha->rect.h;
+	// Also false for NaN
+	if(!(fx >= 0.0 && fx < buddha->w && fy >= 0.0 && fy < buddha->h))
+		return;
+	int idx = (int)fy * buddha->w + (int)fx;
+	int size = buddha->w * buddha->h;
+	for(int k = 0; k < 3; k++) {
+		if(i < len[k])
+			hist[k * size + idx] += weight;
+	}
+}
+
+// Iterates c again and counts the points of its orbit, and of the mirrored orbit,
+// into the channels. e is the number of iterations until c escaped.
+static void countOrbit(BuddhaEngine *buddha, uint32_t *hist, float cx, float cy,
+		int e, uint32_t weight) {
+	const BuddhaSettings *s = &buddha->settings;
+	int len[3];
+	int longest = 0;
+	for(int k = 0; k < 3; k++) {
+		if(s->mode == BUDDHA_NORMAL)
+			len[k] = e < s->limits[k] ? e : 0;
+		else
+			len[k] = e >= s->limits[k] ? s->limits[k] : 0;
+		longest = len[k] > longest ? len[k] : longest;
+	}
+
+	float x = 0.0f, y = 0.0f;
+	for(int i = 0; i < longest; i++) {
+		if(s->exponent == 2) {
+			float tmpx = x * x - y * y + cx;
+			y = 2.0f * x * y + cy;
+			x = tmpx;
+		} else {
+			float retx = x, rety = y;
+			for(int p = 0; p < s->exponent - 1; p++) {
+				float tmpx = retx * x - rety * y;
+				rety = retx * y + rety * x;
+				retx = tmpx;
+			}
+			x = retx + cx;
+			y = rety + cy;
+		}
+		countPoint(buddha, hist, x, y, i, len, weight);
+		countPoint(buddha, hist, x, -y, i, len, weight);
+		// Rounding differs from the vector code, so the replay may escape first
+		if(x * x + y * y > ESCAPE_RADIUS * ESCAPE_RADIUS)
+			break;
+	}
+}
+
+static int buddhaWorker(void *voidworker) {
+	BuddhaWorker *worker = (BuddhaWorker *)voidworker;
+	BuddhaEngine *buddha = worker->buddha;
+	float cell = SAMPLE_W / GRID;
+	int skip_bulbs = buddha->settings.mode == BUDDHA_NORMAL && buddha->settings.exponent == 2;
+
+	float cx[BATCH], cy[BATCH];
+	int counts[BATCH];
+	uint32_t weights[BATCH];
+	for(long done = 0; done < worker->nsamples; done += BATCH) {
+		long left = worker->nsamples - done;
+		int n = 0;
+		for(int i = 0; i < BATCH && i < left; i++) {
+			int c = sampleCell(buddha, &worker->rng);
+			float x = SAMPLE_X + ((c % GRID) + randomUnit(&worker->rng)) * cell;
+			float y = ((c / GRID) + randomUnit(&worker->rng)) * cell;
+			if(skip_bulbs && inMainBulbs(x, y))
+				continue;
+			cx[n] = x;
+			cy[n] = y;
+			weights[n] = IMPORTANCE / buddha->weight[c];
+			n++;
+		}
+
+		escapeIterations(buddha, cx, cy, counts, n, buddha->max_limit);
+		for(int i = 0; i < n; i++)
+			countOrbit(buddha, worker->hist, cx[i], cy[i], counts[i], weights[i]);
+	}
+	return 0;
+}
+
+// Adds the histograms of all workers to the density, a chunk of rows at a time
+static int mergeWorker(void *voidbuddha) {
+	BuddhaEngine *buddha = (BuddhaEngine *)voidbuddha;
+	const int chunk = 16;
+	int size = buddha->w * buddha->h;
+	int row;
+	while((row = __atomic_fetch_add(&buddha->next_row, chunk, __ATOMIC_RELAXED)) < buddha->h) {
+		int last = row + chunk < buddha->h ? row + chunk : buddha->h;
+		for(int k = 0; k < 3; k++) {
+			for(int t = 0; t < buddha->nthreads; t++) {
+				uint32_t *hist = buddha->workers[t].hist + k * size;
+				uint64_t *density = buddha->density + k * size;
+				for(int i = row * buddha->w; i < last * buddha->w; i++) {
+					density[i] += hist[i];
+					hist[i] = 0;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+BuddhaEngine *buddhaCreate(ThreadPool *pool, int no_simd) {
+	BuddhaEngine *buddha = (BuddhaEngine *)calloc(1, sizeof(BuddhaEngine));
+	if(buddha == NULL) {
+		mandelLog(ERROR, "Could not allocate Buddhabrot engine!\n");
+		return NULL;
+	}
+
+	buddha->pool = pool;
+	if(pool == NULL) {
+		int nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if(nthreads < 1 || nthreads > MAX_CPU_THREADS)
+			nthreads = 8;
+		buddha->pool = threadPoolCreate(nthreads, NULL, 0);
+		buddha->owns_pool = 1;
+		if(buddha->pool == NULL) {
+			mandelLog(ERROR, "Could not create worker threads!\n");
+			goto error;
+		}
+	}
+	buddha->nthreads = threadPoolSize(buddha->pool);
+
+	buddha->workers = (BuddhaWorker *)calloc(buddha->nthreads, sizeof(BuddhaWorker));
+	if(buddha->workers == NULL) {
+		mandelLog(ERROR, "Could not allocate thread data!\n");
+		goto error;
+	}
+	for(int i = 0; i < buddha->nthreads; i++) {
+		buddha->workers[i].buddha = buddha;
+		buddha->workers[i].rng = 0x853c49e6748fea9bull * (i + 1);
+	}
+
+#if ENABLE_AVX
+	buddha->simd = !no_simd && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	(void)no_simd;
+#endif
+	return buddha;
+error:
+	if(buddha->owns_pool)
+		threadPoolDestroy(buddha->pool);
+	free(buddha);
+	return NULL;
+}
+
+static void freeImage(BuddhaEngine *buddha) {
+	free(buddha->density);
+	buddha->density = NULL;
+	for(int i = 0; i < buddha->nthreads; i++) {
+		free(buddha->workers[i].hist);
+		buddha->workers[i].hist = NULL;
+	}
+	buddha->w = buddha->h = 0;
+}
+
+void buddhaDestroy(BuddhaEngine *buddha) {
+	if(buddha == NULL)
+		return;
+	freeImage(buddha);
+	free(buddha->workers);
+	if(buddha->owns_pool)
+		threadPoolDestroy(buddha->pool);
+	free(buddha);
+}
+
+int buddhaReset(BuddhaEngine *buddha, const BuddhaSettings *settings,
+		Rectangle rect, int w, int h) {
+	if(w < 1 || h < 1)
+		return -1;
+	size_t size = (size_t)w * h * 3;
+
+	if(w != buddha->w || h != buddha->h) {
+		freeImage(buddha);
+		buddha->density = (uint64_t *)malloc(size * sizeof(uint64_t));
+		int failed = buddha->density == NULL;
+		for(int i = 0; i < buddha->nthreads; i++) {
+			buddha->workers[i].hist = (uint32_t *)malloc(size * sizeof(uint32_t));
+			failed |= buddha->workers[i].hist == NULL;
+		}
+		if(failed) {
+			mandelLog(ERROR, "Could not allocate memory for the Buddhabrot histograms!\n");
+			freeImage(buddha);
+			return -1;
+		}
+		buddha->w = w;
+		buddha->h = h;
+	}
+	memset(buddha->density, 0, size * sizeof(uint64_t));
+	for(int i = 0; i < buddha->nthreads; i++)
+		memset(buddha->workers[i].hist, 0, size * sizeof(uint32_t));
+
+	if(!buddha->have_importance || memcmp(settings, &buddha->settings, sizeof(BuddhaSettings))) {
+		buddha->settings = *settings;
+		buddha->max_limit = 1;
+		for(int k = 0; k < 3; k++) {
+			buddha->settings.limits[k] = settings->limits[k] < 1 ? 1 : settings->limits[k];
+			if(buddha->settings.limits[k] > buddha->max_limit)
+				buddha->max_limit = buddha->settings.limits[k];
+		}
+		buildImportance(buddha);
+		buddha->have_importance = 1;
+	}
+	buddha->rect = rect;
+	buddha->samples = 0;
+	return 0;
+}
+
+void buddhaAccumulate(BuddhaEngine *buddha, long nsamples) {
+	if(buddha->density == NULL || nsamples < 1)
+		return;
+	for(int i = 0; i < buddha->nthreads; i++)
+		buddha->workers[i].nsamples = nsamples / buddha->nthreads +
+				(i < nsamples % buddha->nthreads);
+	threadPoolRun(buddha->pool, buddhaWorker, buddha->workers, sizeof(BuddhaWorker));
+
+	buddha->next_row = 0;
+	threadPoolRun(buddha->pool, mergeWorker, buddha, 0);
+	buddha->samples += nsamples;
+}
+
+long buddhaSamples(BuddhaEngine *buddha) {
+	return buddha->samples;
+}
+
+void buddhaToArgb(BuddhaEngine *buddha, int *out_argb) {
+	if(buddha->density == NULL)
+		return;
+	int size = buddha->w * buddha->h;
+
+	double scale[3];
+	for(int k = 0; k < 3; k++) {
+		uint64_t brightest = 0;
+		for(int i = 0; i < size; i++) {
+			if(buddha->density[k * size + i] > brightest)
+				brightest = buddha->density[k * size + i];
+		}
+		scale[k] = brightest > 0 ? 1.0 / (double)brightest : 0.0;
+	}
+
+	for(int i = 0; i < size; i++) {
+		int color = 0xff000000;
+		for(int k = 0; k < 3; k++) {
+			double v = (double)buddha->density[k * size + i] * scale[k];
+			// The square root brings out the faint orbits
+			int c = v >= 1.0 ? 255 : (int)(sqrt(v) * 255.0);
+			color |= c << (k * 8);
+		}
+		out_argb[i] = color;
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef _BUDDHABROT_H_
+#define _BUDDHABROT_H_
+
+#include "mandelbrot_common.h"
+#include "threadpool.h"
+
+typedef enum BuddhaMode {
+	BUDDHA_NORMAL, // Orbits of points that escape
+	BUDDHA_ANTI    // Orbits of points that don't escape
+} BuddhaMode;
+
+typedef struct BuddhaSettings {
+	BuddhaMode mode;
+	// Iteration limit of the red, green and blue channel. Different limits
+	// give the "nebula" coloring, equal ones a gray image.
+	int limits[3];
+	int exponent;
+} BuddhaSettings;
+
+/*
+ * Renders the density of orbits instead of escape times. Random points c
+ * are iterated and every point their orbit visits inside the view is
+ * counted. The image converges with the number of samples, so it is built
+ * up in passes that can be displayed in between.
+ *
+ * Like the CpuEngine, a context must only be used by one thread at a time.
+ */
+typedef struct BuddhaEngine BuddhaEngine;
+
+// Renders on the workers of pool, or on a pool of its own when pool is NULL
+BuddhaEngine *buddhaCreate(ThreadPool *pool, int no_simd);
+void buddhaDestroy(BuddhaEngine *buddha);
+
+// Starts a new w x h image of rect, dropping all samples.
+// Returns nonzero on errors.
+int buddhaReset(BuddhaEngine *buddha, const BuddhaSettings *settings,
+		Rectangle rect, int w, int h);
+
+// Iterates about nsamples more random points into the image
+void buddhaAccumulate(BuddhaEngine *buddha, long nsamples);
+
+// Number of points iterated since the last reset
+long buddhaSamples(BuddhaEngine *buddha);
+
+// Maps the densities of the channels to colors
+void buddhaToArgb(BuddhaEngine *buddha, int *out_argb);
+
+#endif
@@ -0,0 +1,194 @@
+#include "checkpoint.h"
+#include "logger.h"
+#include "config.h"
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CHECKPOINT_MAGIC "MANDCKP1"
+
+// File layout: header, one TileEntry per tile, then the pixels of the whole
+// image (aligned to 64 bytes) in the same layout as the output image
+typedef struct CheckpointHeader {
+	char magic[8];
+	double rect[6];
+	int32_t width;
+	int32_t height;
+	int32_t iterations;
+	int32_t exponent;
+	int32_t tile_size;
+	int32_t ntiles;
+} CheckpointHeader;
+
+typedef struct TileEntry {
+	uint32_t done;
+	uint32_t checksum; // Of the tile's pixels, catches tiles torn by a crash
+} TileEntry;
+
+static void fillHeader(CheckpointHeader *header, const RenderJob *job, int ntiles) {
+	memset(header, 0, sizeof(CheckpointHeader));
+	memcpy(header->magic, CHECKPOINT_MAGIC, 8);
+	header->rect[0] = job->rect.x;
+	header->rect[1] = job->rect.y;
+	header->rect[2] = job->rect.w;
+	header->rect[3] = job->rect.h;
+	header->rect[4] = job->rect.x_lo;
+	header->rect[5] = job->rect.y_lo;
+	header->width = job->width;
+	header->height = job->height;
+	header->iterations = job->iterations;
+	header->exponent = job->exponent;
+	header->tile_size = job->tile_size;
+	header->ntiles = ntiles;
+}
+
+// FNV-1a over the rows of the tile
+static uint32_t tileChecksum(const RenderJob *job, Tile tile, const int *argb) {
+	uint32_t hash = 2166136261u;
+	for(int row = 0; row < tile.h; row++) {
+		const unsigned char *p = (const unsigned char *)(argb + (tile.y + row) * job->width + tile.x);
+		for(int i = 0; i < tile.w * (int)sizeof(int); i++)
+			hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// Reads or writes the rows of the tile between the file and the image
+static int tileIO(Checkpoint *cp, Tile tile, int *argb, int write) {
+	size_t row_bytes = tile.w * sizeof(int);
+	for(int row = 0; row < tile.h; row++) {
+		long long pixel = (long long)(tile.y + row) * cp->job.width + tile.x;
+		off_t offset = cp->pixel_offset + pixel * sizeof(int);
+		ssize_t n = write ? pwrite(cp->fd, argb + pixel, row_bytes, offset) :
+				pread(cp->fd, argb + pixel, row_bytes, offset);
+		if(n != (ssize_t)row_bytes)
+			return -1;
+	}
+	return 0;
+}
+
+static int loadTiles(Checkpoint *cp, int *out_argb) {
+	CheckpointHeader header, expected;
+	fillHeader(&expected, &cp->job, cp->ntiles);
+	if(pread(cp->fd, &header, sizeof(header), 0) != sizeof(header) ||
+			memcmp(&header, &expected, sizeof(header)) != 0)
+		return -1;
+
+	for(int t = 0; t < cp->ntiles; t++) {
+		TileEntry entry;
+		if(pread(cp->fd, &entry, sizeof(entry), sizeof(header) + t * sizeof(entry)) != sizeof(entry))
+			return -1;
+		if(!entry.done)
+			continue;
+		Tile tile = tileAt(t, cp->job.width, cp->job.height, cp->job.tile_size);
+		if(tileIO(cp, tile, out_argb, 0) == 0 &&
+				tileChecksum(&cp->job, tile, out_argb) == entry.checksum) {
+			cp->done[t] = 1;
+			cp->ndone++;
+		} else {
+			mandelLog(VERBOSE, "Tile %d of the checkpoint is damaged, rendering it again\n", t);
+		}
+	}
+	return 0;
+}
+
+int checkpointOpen(Checkpoint *cp, const char *path, const RenderJob *job,
+		int resume, int *out_argb) {
+	memset(cp, 0, sizeof(Checkpoint));
+	cp->fd = -1;
+	cp->job = *job;
+	cp->ntiles = tileCount(job->width, job->height, job->tile_size);
+	cp->done = (char *)calloc(cp->ntiles, sizeof(char));
+	if(cp->done == NULL) {
+		mandelLog(ERROR, "Could not allocate memory for the render progress!\n");
+		return -1;
+	}
+	if(path == NULL)
+		return 0;
+
+	long long table_end = sizeof(CheckpointHeader) + (long long)cp->ntiles * sizeof(TileEntry);
+	cp->pixel_offset = (table_end + 63) / 64 * 64;
+	cp->last_sync = SDL_GetTicks();
+
+	if(resume) {
+		cp->fd = open(path, O_RDWR);
+		if(cp->fd >= 0) {
+			if(loadTiles(cp, out_argb)) {
+				mandelLog(ERROR, "Checkpoint %s belongs to a different render\n", path);
+				goto cleanup;
+			}
+			mandelLog(INFO, "Resuming from %s, %d of %d tiles are complete\n",
+					path, cp->ndone, cp->ntiles);
+			return 0;
+		}
+		mandelLog(WARN, "No checkpoint to resume at %s, starting over\n", path);
+	}
+
+	cp->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(cp->fd < 0)
+		goto error;
+	CheckpointHeader header;
+	fillHeader(&header, job, cp->ntiles);
+	// The file is sparse, the table starts out all zero (no tile done)
+	off_t size = cp->pixel_offset + (off_t)job->width * job->height * sizeof(int);
+	if(pwrite(cp->fd, &header, sizeof(header), 0) != sizeof(header) ||
+			ftruncate(cp->fd, size) != 0)
+		goto error;
+	return 0;
+
+error:
+	mandelLog(ERROR, "Could not use checkpoint %s: %s\n", path, strerror(errno));
+cleanup:
+	if(cp->fd >= 0)
+		close(cp->fd);
+	cp->fd = -1;
+	free(cp->done);
+	cp->done = NULL;
+	return -1;
+}
+
+void checkpointTile(Checkpoint *cp, int tile_idx, const int *out_argb) {
+	if(cp->done[tile_idx])
+		return;
+	cp->done[tile_idx] = 1;
+	cp->ndone++;
+	if(cp->fd < 0)
+		return;
+
+	// Pixels first, so a crash in between leaves the tile marked as missing.
+	// The checksum covers reordering by the page cache before a sync.
+	Tile tile = tileAt(tile_idx, cp->job.width, cp->job.height, cp->job.tile_size);
+	TileEntry entry = {1, tileChecksum(&cp->job, tile, out_argb)};
+	if(tileIO(cp, tile, (int *)out_argb, 1) ||
+			pwrite(cp->fd, &entry, sizeof(entry),
+					sizeof(CheckpointHeader) + tile_idx * sizeof(entry)) != sizeof(entry)) {
+		mandelLog(WARN, "Could not write checkpoint, continuing without it: %s\n", strerror(errno));
+		close(cp->fd);
+		cp->fd = -1;
+		return;
+	}
+
+	unsigned int now = SDL_GetTicks();
+	if(now - cp->last_sync >= CHECKPOINT_SYNC_MS) {
+		fdatasync(cp->fd);
+		cp->last_sync = now;
+		mandelLog(DEBUG, "Checkpoint synced, %d of %d tiles complete\n", cp->ndone, cp->ntiles);
+	}
+}
+
+void checkpointClose(Checkpoint *cp, const char *path) {
+	if(cp->fd >= 0) {
+		close(cp->fd);
+		if(cp->ndone == cp->ntiles)
+			unlink(path);
+	}
+	cp->fd = -1;
+	free(cp->done);
+	cp->done = NULL;
+}
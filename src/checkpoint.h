@@ -0,0 +1,35 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "mandelbrot_common.h"
+
+/*
+ * Tracks which tiles of a batch render are complete. When backed by a file,
+ * every complete tile is also written there together with a checksum, so a
+ * render that crashed or got preempted can be resumed with only the missing
+ * tiles left to render. The file is synced to disk every CHECKPOINT_SYNC_MS.
+ */
+typedef struct Checkpoint {
+	int fd; // -1 when progress is only tracked in memory
+	RenderJob job;
+	int ntiles;
+	int ndone;
+	char *done; // Per tile
+	unsigned int last_sync;
+	long long pixel_offset;
+} Checkpoint;
+
+// Starts tracking the job. A NULL path tracks progress only in memory.
+// With resume set, the tiles stored in an existing checkpoint file of the
+// same job are loaded into out_argb and count as complete.
+// Returns nonzero on errors, or if the file belongs to a different job.
+int checkpointOpen(Checkpoint *cp, const char *path, const RenderJob *job,
+		int resume, int *out_argb);
+
+// Records that the tile is complete, its pixels are taken from out_argb
+void checkpointTile(Checkpoint *cp, int tile_idx, const int *out_argb);
+
+// Stops tracking, the file is removed once every tile is complete
+void checkpointClose(Checkpoint *cp, const char *path);
+
+#endif
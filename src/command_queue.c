@@ -0,0 +1,30 @@
+#include "command_queue.h"
+
+void commandQueueInit(CommandQueue *queue) {
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->tail, 0);
+}
+
+int commandPush(CommandQueue *queue, const Command *command) {
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+	if(tail - head == COMMAND_QUEUE_SIZE)
+		return -1;
+
+	queue->commands[tail & (COMMAND_QUEUE_SIZE - 1)] = *command;
+	// Makes the command visible to the consumer together with the new tail
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	return 0;
+}
+
+int commandPop(CommandQueue *queue, Command *command) {
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+	if(head == tail)
+		return 0;
+
+	*command = queue->commands[head & (COMMAND_QUEUE_SIZE - 1)];
+	// The producer may only reuse the slot after it was read
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+	return 1;
+}
@@ -0,0 +1,44 @@
+#ifndef _COMMAND_QUEUE_H_
+#define _COMMAND_QUEUE_H_
+
+#include <stdatomic.h>
+
+#include "view_state.h"
+
+// Must be a power of two
+#define COMMAND_QUEUE_SIZE 64
+
+typedef enum {
+	COMMAND_SCREENSHOT
+} CommandType;
+
+typedef struct Command {
+	CommandType type;
+	ViewState view; // View at the time of the input
+	// Screenshots only: size of the image and samples per pixel along each axis
+	int width;
+	int height;
+	int supersample;
+} Command;
+
+/*
+ * Lock-free ring buffer for actions of the event loop (single producer)
+ * that have to run on the compute stage (single consumer), because only
+ * the compute stage may use the engine.
+ * head and tail count up forever, the slot is their value modulo the size.
+ */
+typedef struct CommandQueue {
+	Command commands[COMMAND_QUEUE_SIZE];
+	atomic_uint head; // Written by the consumer only
+	atomic_uint tail; // Written by the producer only
+} CommandQueue;
+
+void commandQueueInit(CommandQueue *queue);
+
+// Returns nonzero if the queue is full
+int commandPush(CommandQueue *queue, const Command *command);
+
+// Returns nonzero if a command was taken from the queue
+int commandPop(CommandQueue *queue, Command *command);
+
+#endif
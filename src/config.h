@@ -3,6 +3,8 @@
 
 #define ENABLE_CUDA 1
 #define ENABLE_AVX 1
+// Bypass the cache when vector kernels write full, aligned spans of pixels
+#define ENABLE_STREAMING_STORES 0
 
 #define DEFAULT_WIDTH 1600
 #define DEFAULT_HEIGHT 900
@@ -10,12 +12,105 @@
 #define ESCAPE_RADIUS 3.0
 #define DEFAULT_ITERATIONS 800
 #define DEFAULT_EXPONENT 2
+#define MAX_ITERATIONS 5000
+#define MAX_EXPONENT 200
+
+// Budget of automatic iterations when showing the whole set, and how much
+// it grows every time the view width halves
+#define AUTO_ITERS_MIN 64
+#define AUTO_ITERS_PER_OCTAVE 48
+
+// Edge length in pixels of the tiles CPU workers own in NUMA mode
+#define TILE_SIZE 64
+
+// Tiled CPU rendering predicts the cost of tiles from the iterations of the
+// last frame, measured in cells of this many pixels along each edge.
+// Tiles predicted to take longer than a share of the image meant for this
+// many tiles per worker are halved, down to the minimum size.
+#define COST_CELL_SIZE 16
+#define COST_CHUNKS_PER_THREAD 8
+#define COST_MIN_TILE_SIZE 16
+
+// Upper limit for the number of CPU rendering threads
+#define MAX_CPU_THREADS 256
 
 #define RENDER_THREAD_BLOCKS 32
 #define RENDER_THREADS 256
 
 #define MAX_AA_COUNTER 8
 
+// Samples per pixel along each axis of screenshots
+#define DEFAULT_SUPERSAMPLE 2
+// Screenshot progress is reported in steps of this many percent
+#define SCREENSHOT_PROGRESS_STEP 10
+// Samples in a band of a screenshot while the frame time is unknown
+#define SCREENSHOT_BAND_SAMPLES 262144
+
+// Images smaller than this many pixels are scaled and blended on one thread
+#define IMAGE_MIN_PARALLEL_PIXELS 65536
+// Pixels per chunk workers take when blending images
+#define IMAGE_BLEND_SPAN 4096
+
+// Frame time budget for frames rendered during interaction
+#define TARGET_FRAME_TIME_MS 16
+// Time without input after which full resolution and anti-alias are rendered
+#define INTERACTION_IDLE_MS 150
+// Lowest linear resolution scale used for interactive frames
+#define MIN_PREVIEW_SCALE 0.125
+
+// Pixel spacing (relative to the magnitude of the coordinates) below which
+// the CPU engine switches from float to double and to double-double kernels
+#define FLOAT_SPACING_LIMIT 1e-6
+#define DOUBLE_SPACING_LIMIT 1e-14
+// Below this spacing even bit-exact fixed point rendering switches to double-double
+#define FIXED_SPACING_LIMIT 1e-16
+
+// Independent vectors CPU kernels keep in flight unless a tuning says otherwise,
+// limited by the highest number each kernel supports
+#define DEFAULT_UNROLL 4
+
+// Minimum number of rows that have to mirror each other across the real axis
+// before the CPU engine renders only one half of them
+#define MIN_MIRRORED_ROWS 8
+
+// Pixels the render daemon takes from its queue at once. Identical requests
+// arriving while a batch renders share its result instead of rendering again.
+#define DAEMON_BATCH_PIXELS 1048576
+// Bytes of responses a daemon client may leave unread before it is dropped.
+// A response is always queued when nothing else is waiting.
+#define DAEMON_MAX_QUEUED_BYTES (256 << 20)
+
+// Upper limit for the number of workers of a coordinator
+#define MAX_WORKERS 256
+// Edge length in pixels of the tiles a coordinator hands to its workers
+#define COORDINATOR_TILE_SIZE 256
+// Tiles every worker has queued at once, hides the round trip per tile
+#define COORDINATOR_PIPELINE 2
+// Once no tiles are left, tiles taking longer than this many times the
+// expected time (and at least the minimum) are also given to idle workers
+#define COORDINATOR_STRAGGLER_FACTOR 4
+#define COORDINATOR_MIN_REISSUE_MS 1000
+// Workers not sending anything for this long while they have tiles are dropped
+#define COORDINATOR_TIMEOUT_MS 60000
+
+// Interval in which checkpoints of batch renders are synced to disk
+#define CHECKPOINT_SYNC_MS 5000
+
+// Slots of the shared memory ring of --export-frames, consumers have the
+// time of this many frames minus one to read a frame
+#define FRAME_EXPORT_SLOTS 4
+// Largest exported frame, the memory of a slot is only used up to the frame size
+#define FRAME_EXPORT_MAX_PIXELS (3840 * 2160)
+
+// Buddhabrot mode: iteration limits of the red, green and blue channel with --nebula
+#define BUDDHA_NEBULA_LIMITS {5000, 500, 50}
+// Duration of a pass, the image is displayed after each of them
+#define BUDDHA_PASS_MS 100
+// Samples of the first pass, later passes are sized from its duration
+#define BUDDHA_FIRST_PASS 16384
+// The image is final after this many samples per pixel
+#define BUDDHA_SAMPLES_PER_PIXEL 256
+
 // Overallocation of the framebuffer in pixels
 // Overallocation is limited to 4 MB (each pixel is 4 bytes)
 #define OVERALLOC_LIMIT 1048576
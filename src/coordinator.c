@@ -0,0 +1,323 @@
+#include "coordinator.h"
+#include "daemon_protocol.h"
+#include "net.h"
+#include "logger.h"
+#include "config.h"
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+typedef struct Worker {
+	const char *address;
+	int fd; // -1 once the worker is dropped
+	int inflight[COORDINATOR_PIPELINE]; // Tiles sent to the worker, -1 if unused
+	Uint32 sent[COORDINATOR_PIPELINE];
+	int ninflight;
+	Uint32 last_activity;
+
+	// Response being received
+	char line[DAEMON_MAX_LINE];
+	int line_len;
+	int body_tile;  // Tile the body belongs to, -1 while reading a response line
+	char *body;
+	int body_alloc;
+	int body_size;
+	int body_done;
+} Worker;
+
+typedef struct Coordinator {
+	const RenderJob *job;
+	int *out_argb;
+	Worker *workers;
+	int nworkers;
+	int ntiles;
+	Checkpoint *cp; // Knows which tiles are complete
+	int *copies;    // Per tile, number of workers rendering it
+	double ms_per_pixel; // Measured on finished tiles, 0 while unknown
+} Coordinator;
+
+static void dropTile(Coordinator *c, Worker *worker, int slot) {
+	c->copies[worker->inflight[slot]]--;
+	worker->inflight[slot] = -1;
+	worker->ninflight--;
+}
+
+static void dropWorker(Coordinator *c, Worker *worker, const char *reason) {
+	mandelLog(WARN, "Dropping worker %s: %s\n", worker->address, reason);
+	close(worker->fd);
+	worker->fd = -1;
+	// Its tiles become pending again unless another worker renders them too
+	for(int slot = 0; slot < COORDINATOR_PIPELINE; slot++) {
+		if(worker->inflight[slot] >= 0)
+			dropTile(c, worker, slot);
+	}
+}
+
+static int sendTile(Coordinator *c, Worker *worker, int tile_idx) {
+	const RenderJob *job = c->job;
+	Tile tile = tileAt(tile_idx, job->width, job->height, job->tile_size);
+	const Rectangle *r = &job->rect;
+
+	// Asks for a part of the whole image, so the tile meets its neighbors exactly
+	char line[DAEMON_MAX_LINE];
+	int len = snprintf(line, sizeof(line),
+			"RENDER %d 0 %.17g %.17g %.17g %.17g %.17g %.17g %d %d %d %d raw %d %d %d %d\n",
+			tile_idx, r->x, r->y, r->w, r->h, r->x_lo, r->y_lo,
+			job->width, job->height, job->iterations, job->exponent,
+			tile.x, tile.y, tile.w, tile.h);
+	if(send(worker->fd, line, len, MSG_NOSIGNAL) != len) {
+		dropWorker(c, worker, "could not send request");
+		return -1;
+	}
+
+	int slot = 0;
+	while(worker->inflight[slot] >= 0)
+		slot++;
+	worker->inflight[slot] = tile_idx;
+	worker->sent[slot] = SDL_GetTicks();
+	if(worker->ninflight++ == 0)
+		worker->last_activity = worker->sent[slot];
+	c->copies[tile_idx]++;
+	return 0;
+}
+
+// Picks the tile an idle worker should render next, -1 if there is none
+static int pickTile(Coordinator *c, Worker *worker) {
+	for(int t = 0; t < c->ntiles; t++) {
+		if(!c->cp->done[t] && c->copies[t] == 0)
+			return t;
+	}
+
+	// Nothing left, help with the tile that is overdue the most
+	if(c->ms_per_pixel <= 0.0)
+		return -1;
+	Uint32 now = SDL_GetTicks();
+	int best = -1;
+	double best_overdue = 0.0;
+	for(int i = 0; i < c->nworkers; i++) {
+		Worker *other = &c->workers[i];
+		if(other == worker || other->fd < 0)
+			continue;
+		for(int slot = 0; slot < COORDINATOR_PIPELINE; slot++) {
+			int t = other->inflight[slot];
+			if(t < 0 || c->cp->done[t] || c->copies[t] > 1)
+				continue;
+			Tile tile = tileAt(t, c->job->width, c->job->height, c->job->tile_size);
+			double expected = c->ms_per_pixel * tile.w * tile.h * COORDINATOR_STRAGGLER_FACTOR;
+			if(expected < COORDINATOR_MIN_REISSUE_MS)
+				expected = COORDINATOR_MIN_REISSUE_MS;
+			double overdue = (double)(now - other->sent[slot]) - expected;
+			if(overdue > best_overdue) {
+				best_overdue = overdue;
+				best = t;
+			}
+		}
+	}
+	if(best >= 0)
+		mandelLog(VERBOSE, "Re-issuing tile %d to %s\n", best, worker->address);
+	return best;
+}
+
+static void finishTile(Coordinator *c, Worker *worker, int slot) {
+	int t = worker->inflight[slot];
+	Uint32 took = SDL_GetTicks() - worker->sent[slot];
+	dropTile(c, worker, slot);
+	if(c->cp->done[t])
+		return; // Another worker was faster
+
+	const RenderJob *job = c->job;
+	Tile tile = tileAt(t, job->width, job->height, job->tile_size);
+	for(int row = 0; row < tile.h; row++) {
+		memcpy(c->out_argb + (tile.y + row) * job->width + tile.x,
+				worker->body + row * tile.w * sizeof(int), tile.w * sizeof(int));
+	}
+	checkpointTile(c->cp, t, c->out_argb);
+
+	// Includes the time the tile waited in the worker's queue, which is what
+	// an idle worker would save by rendering it
+	double ms_per_pixel = (double)took / (tile.w * tile.h);
+	c->ms_per_pixel = c->ms_per_pixel <= 0.0 ? ms_per_pixel :
+			0.9 * c->ms_per_pixel + 0.1 * ms_per_pixel;
+	mandelLog(DEBUG, "Tile %d from %s took %u ms (%d/%d)\n",
+			t, worker->address, took, c->cp->ndone, c->ntiles);
+}
+
+// Handles a response line, returns nonzero on protocol errors
+static int handleResponse(Coordinator *c, Worker *worker, char *line) {
+	int id, w, h, size;
+	char format[8];
+	int slot = -1;
+
+	if(sscanf(line, "OK %d %7s %d %d %d", &id, format, &w, &h, &size) == 5) {
+		for(int s = 0; s < COORDINATOR_PIPELINE; s++) {
+			if(worker->inflight[s] == id)
+				slot = s;
+		}
+		if(slot < 0 || strcmp(format, "raw") != 0)
+			return -1;
+		Tile tile = tileAt(id, c->job->width, c->job->height, c->job->tile_size);
+		if(w != tile.w || h != tile.h || size != w * h * (int)sizeof(int))
+			return -1;
+
+		if(size > worker->body_alloc) {
+			char *body = (char *)realloc(worker->body, size);
+			if(body == NULL)
+				return -1;
+			worker->body = body;
+			worker->body_alloc = size;
+		}
+		worker->body_tile = slot;
+		worker->body_size = size;
+		worker->body_done = 0;
+		return 0;
+	}
+
+	mandelLog(WARN, "Worker %s: %s\n", worker->address, line);
+	return -1;
+}
+
+// Feeds received bytes into the response parser of the worker
+static int receive(Coordinator *c, Worker *worker, const char *data, int len) {
+	while(len > 0) {
+		if(worker->body_tile >= 0) {
+			int n = worker->body_size - worker->body_done;
+			n = n < len ? n : len;
+			memcpy(worker->body + worker->body_done, data, n);
+			worker->body_done += n;
+			data += n;
+			len -= n;
+			if(worker->body_done == worker->body_size) {
+				finishTile(c, worker, worker->body_tile);
+				worker->body_tile = -1;
+			}
+			continue;
+		}
+
+		if(worker->line_len == DAEMON_MAX_LINE - 1)
+			return -1;
+		char ch = *data++;
+		len--;
+		if(ch != '\n') {
+			worker->line[worker->line_len++] = ch;
+			continue;
+		}
+		worker->line[worker->line_len] = '\0';
+		worker->line_len = 0;
+		if(handleResponse(c, worker, worker->line))
+			return -1;
+	}
+	return 0;
+}
+
+int coordinateRender(const RenderJob *job, char **workers, int nworkers,
+		Checkpoint *checkpoint, int *out_argb) {
+	if(job->tile_size < 1 || job->tile_size > DAEMON_MAX_SIDE) {
+		mandelLog(ERROR, "Invalid tile size %d\n", job->tile_size);
+		return -1;
+	}
+
+	Coordinator c;
+	memset(&c, 0, sizeof(c));
+	c.job = job;
+	c.out_argb = out_argb;
+	c.nworkers = nworkers;
+	c.ntiles = tileCount(job->width, job->height, job->tile_size);
+	c.cp = checkpoint;
+	c.workers = (Worker *)calloc(nworkers, sizeof(Worker));
+	c.copies = (int *)calloc(c.ntiles, sizeof(int));
+	struct pollfd *fds = (struct pollfd *)calloc(nworkers, sizeof(struct pollfd));
+	char *chunk = (char *)malloc(65536);
+	int status = -1;
+	if(c.workers == NULL || c.copies == NULL ||
+			fds == NULL || chunk == NULL) {
+		mandelLog(ERROR, "Could not allocate memory for the coordinator!\n");
+		goto cleanup;
+	}
+
+	for(int i = 0; i < nworkers; i++) {
+		Worker *worker = &c.workers[i];
+		worker->address = workers[i];
+		worker->body_tile = -1;
+		for(int slot = 0; slot < COORDINATOR_PIPELINE; slot++)
+			worker->inflight[slot] = -1;
+		worker->fd = netConnect(workers[i]);
+		if(worker->fd < 0)
+			mandelLog(WARN, "Could not connect to worker %s: %s\n", workers[i], strerror(errno));
+	}
+	mandelLog(INFO, "Rendering %d tiles on %d workers\n", c.ntiles - checkpoint->ndone, nworkers);
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	while(checkpoint->ndone < c.ntiles) {
+		int nalive = 0;
+		for(int i = 0; i < nworkers; i++) {
+			Worker *worker = &c.workers[i];
+			while(worker->fd >= 0 && worker->ninflight < COORDINATOR_PIPELINE) {
+				int t = pickTile(&c, worker);
+				if(t < 0 || sendTile(&c, worker, t))
+					break;
+			}
+			fds[i].fd = worker->fd; // Negative descriptors are ignored by poll
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+			nalive += worker->fd >= 0;
+		}
+		if(nalive == 0) {
+			mandelLog(ERROR, "No workers left, %d of %d tiles are missing\n",
+					c.ntiles - checkpoint->ndone, c.ntiles);
+			goto cleanup;
+		}
+
+		// Wakes up regularly to re-issue overdue tiles
+		if(poll(fds, nworkers, 100) < 0 && errno != EINTR) {
+			mandelLog(ERROR, "poll failed: %s\n", strerror(errno));
+			goto cleanup;
+		}
+
+		Uint32 now = SDL_GetTicks();
+		for(int i = 0; i < nworkers; i++) {
+			Worker *worker = &c.workers[i];
+			if(worker->fd < 0)
+				continue;
+			if(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				ssize_t got = recv(worker->fd, chunk, 65536, 0);
+				if(got < 0 && errno == EINTR)
+					continue;
+				if(got <= 0) {
+					dropWorker(&c, worker, "connection closed");
+				} else if(receive(&c, worker, chunk, got)) {
+					dropWorker(&c, worker, "unexpected response");
+				} else {
+					worker->last_activity = now;
+				}
+			} else if(worker->ninflight > 0 &&
+					now - worker->last_activity > COORDINATOR_TIMEOUT_MS) {
+				dropWorker(&c, worker, "not responding");
+			}
+		}
+	}
+
+	mandelLog(INFO, "Rendered %dx%d on %d workers in %.2f s\n", job->width, job->height,
+			nworkers, (double)(SDL_GetPerformanceCounter() - start) /
+			(double)SDL_GetPerformanceFrequency());
+	status = 0;
+
+cleanup:
+	if(c.workers != NULL) {
+		for(int i = 0; i < nworkers; i++) {
+			if(c.workers[i].fd >= 0)
+				close(c.workers[i].fd);
+			free(c.workers[i].body);
+		}
+	}
+	free(c.workers);
+	free(c.copies);
+	free(fds);
+	free(chunk);
+	return status;
+}
@@ -0,0 +1,14 @@
+#ifndef _COORDINATOR_H_
+#define _COORDINATOR_H_
+
+#include "mandelbrot_common.h"
+#include "checkpoint.h"
+
+// Renders the tiles of the job the checkpoint is missing on render daemons
+// (mandelbrot --worker ADDRESS). Tiles of workers that die are handed to the
+// remaining ones and tiles of slow workers are re-issued to idle ones.
+// Returns nonzero if the image could not be completed.
+int coordinateRender(const RenderJob *job, char **workers, int nworkers,
+		Checkpoint *checkpoint, int *out_argb);
+
+#endif
@@ -0,0 +1,639 @@
+#include "daemon.h"
+#include "daemon_protocol.h"
+#include "net.h"
+#include "frame_arena.h"
+#include "render.h"
+#include "logger.h"
+#include "config.h"
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+typedef enum {
+	FORMAT_RAW,
+	FORMAT_BMP
+} ImageFormat;
+
+static const char *format_names[] = {"raw", "bmp"};
+
+// Everything that determines the pixels of a render
+typedef struct RenderParams {
+	Rectangle rect;
+	int width;
+	int height;
+	int iterations;
+	int exponent;
+	Tile part; // Sent pixels of the width x height image
+} RenderParams;
+
+// A response waiting to be written to a client
+typedef struct Output {
+	size_t len;
+	size_t sent;
+	struct Output *next;
+	char data[];
+} Output;
+
+typedef struct Client {
+	int fd;
+	int refs;   // The connection itself plus every request waiting for a result
+	int closed; // Set once reading or writing failed or the client fell behind
+	// Responses are only queued here, the poll loop writes them once the
+	// socket takes them, so a client that doesn't read never blocks rendering
+	SDL_mutex *out_lock;
+	Output *out_head;
+	Output *out_tail;
+	size_t out_bytes;
+	char line[DAEMON_MAX_LINE];
+	int line_len;
+	struct Client *next;
+} Client;
+
+// A client waiting for the result of a job
+typedef struct Waiter {
+	Client *client;
+	unsigned long id;
+	ImageFormat format;
+	struct Waiter *next;
+} Waiter;
+
+typedef struct Job {
+	RenderParams params;
+	int priority;
+	unsigned long seq;
+	Waiter *waiters;
+	struct Job *next;
+} Job;
+
+static Engine *daemon_engine;
+static SDL_mutex *daemon_mutex;
+static SDL_cond *job_cond;
+static Job *queue = NULL;     // Jobs waiting to be rendered
+static Job *in_flight = NULL; // The batch being rendered, in render order
+static unsigned long next_seq = 0;
+static volatile sig_atomic_t stop = 0;
+static int wake_pipe[2] = {-1, -1}; // Wakes up the poll loop when output is queued
+
+static void handleSignal(int sig) {
+	(void)sig;
+	stop = 1;
+}
+
+static int paramsEqual(const RenderParams *a, const RenderParams *b) {
+	return a->rect.x == b->rect.x && a->rect.y == b->rect.y &&
+			a->rect.w == b->rect.w && a->rect.h == b->rect.h &&
+			a->rect.x_lo == b->rect.x_lo && a->rect.y_lo == b->rect.y_lo &&
+			a->width == b->width && a->height == b->height &&
+			a->iterations == b->iterations && a->exponent == b->exponent &&
+			a->part.x == b->part.x && a->part.y == b->part.y &&
+			a->part.w == b->part.w && a->part.h == b->part.h;
+}
+
+// Drops a reference to the client, the last one closes the connection
+// Has to be called with daemon_mutex held
+static void releaseClient(Client *client) {
+	if(--client->refs > 0)
+		return;
+	close(client->fd);
+	while(client->out_head != NULL) {
+		Output *out = client->out_head;
+		client->out_head = out->next;
+		free(out);
+	}
+	SDL_DestroyMutex(client->out_lock);
+	free(client);
+}
+
+static void releaseWaiters(Waiter *waiter) {
+	while(waiter != NULL) {
+		Waiter *next = waiter->next;
+		releaseClient(waiter->client);
+		free(waiter);
+		waiter = next;
+	}
+}
+
+// Queues a response line followed by size bytes of data for the poll loop.
+// A client that leaves too much unread is closed instead.
+static void queueOutput(Client *client, const char *line, int len, const void *data, int size) {
+	SDL_LockMutex(client->out_lock);
+	if(client->closed) {
+		SDL_UnlockMutex(client->out_lock);
+		return;
+	}
+	if(client->out_head != NULL && client->out_bytes + len + size > DAEMON_MAX_QUEUED_BYTES) {
+		mandelLog(WARN, "Client %d doesn't read its responses, dropping it\n", client->fd);
+		client->closed = 1;
+	} else {
+		Output *out = (Output *)malloc(sizeof(Output) + len + size);
+		if(out == NULL) {
+			mandelLog(WARN, "Could not queue a response for client %d\n", client->fd);
+			client->closed = 1;
+		} else {
+			out->len = len + size;
+			out->sent = 0;
+			out->next = NULL;
+			memcpy(out->data, line, len);
+			if(size > 0)
+				memcpy(out->data + len, data, size);
+			if(client->out_tail != NULL)
+				client->out_tail->next = out;
+			else
+				client->out_head = out;
+			client->out_tail = out;
+			client->out_bytes += out->len;
+		}
+	}
+	SDL_UnlockMutex(client->out_lock);
+
+	// Full means the poll loop is going to wake up anyway
+	char wake = 0;
+	if(write(wake_pipe[1], &wake, 1) < 0 && errno != EAGAIN)
+		mandelLog(DEBUG, "Could not wake up the poll loop: %s\n", strerror(errno));
+}
+
+// Writes as much of the queued output as the socket takes without blocking
+// Returns nonzero when the connection has to be dropped
+static int flushClient(Client *client) {
+	SDL_LockMutex(client->out_lock);
+	while(client->out_head != NULL && !client->closed) {
+		Output *out = client->out_head;
+		ssize_t written = send(client->fd, out->data + out->sent, out->len - out->sent,
+				MSG_NOSIGNAL);
+		if(written < 0 && errno == EINTR)
+			continue;
+		if(written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if(written <= 0) {
+			client->closed = 1;
+			break;
+		}
+		out->sent += written;
+		if(out->sent < out->len)
+			continue;
+		client->out_head = out->next;
+		if(client->out_head == NULL)
+			client->out_tail = NULL;
+		client->out_bytes -= out->len;
+		free(out);
+	}
+	int closed = client->closed;
+	SDL_UnlockMutex(client->out_lock);
+	return closed;
+}
+
+static int hasOutput(Client *client) {
+	SDL_LockMutex(client->out_lock);
+	int pending = client->out_head != NULL;
+	SDL_UnlockMutex(client->out_lock);
+	return pending;
+}
+
+static void sendError(Client *client, unsigned long id, const char *message) {
+	char line[DAEMON_MAX_LINE];
+	int len = snprintf(line, sizeof(line), "ERR %lu %s\n", id, message);
+	queueOutput(client, line, len, NULL, 0);
+}
+
+static void sendImage(Client *client, unsigned long id, ImageFormat format,
+		int width, int height, const void *data, int size) {
+	char line[DAEMON_MAX_LINE];
+	int len = snprintf(line, sizeof(line), "OK %lu %s %d %d %d\n",
+			id, format_names[format], width, height, size);
+	queueOutput(client, line, len, data, size);
+}
+
+// Adds a request to the queue, sharing the job of an identical request
+// that is still queued or being rendered
+static void enqueueRequest(const RenderParams *params, int priority, Waiter *waiter) {
+	SDL_LockMutex(daemon_mutex);
+	waiter->client->refs++;
+
+	Job *job = NULL;
+	for(Job *j = in_flight; j != NULL && job == NULL; j = j->next) {
+		if(paramsEqual(&j->params, params))
+			job = j;
+	}
+	for(Job *j = queue; j != NULL && job == NULL; j = j->next) {
+		if(paramsEqual(&j->params, params))
+			job = j;
+	}
+
+	if(job != NULL) {
+		mandelLog(DEBUG, "Coalescing request %lu with an identical request\n", waiter->id);
+		if(priority > job->priority)
+			job->priority = priority;
+	} else {
+		job = (Job *)calloc(1, sizeof(Job));
+		if(job == NULL) {
+			releaseClient(waiter->client);
+			SDL_UnlockMutex(daemon_mutex);
+			sendError(waiter->client, waiter->id, "out of memory");
+			free(waiter);
+			return;
+		}
+		job->params = *params;
+		job->priority = priority;
+		job->seq = next_seq++;
+		job->next = queue;
+		queue = job;
+		SDL_CondSignal(job_cond);
+	}
+	// Answered in the order the requests arrived
+	Waiter **tail = &job->waiters;
+	while(*tail != NULL)
+		tail = &(*tail)->next;
+	waiter->next = NULL;
+	*tail = waiter;
+	SDL_UnlockMutex(daemon_mutex);
+}
+
+static void handleLine(Client *client, char *line) {
+	RenderParams params;
+	unsigned long id = 0;
+	int priority;
+	char format[8];
+
+	if(strncmp(line, "RENDER ", 7) != 0) {
+		sendError(client, 0, "unknown command");
+		return;
+	}
+	int fields = sscanf(line, "RENDER %lu %d %lf %lf %lf %lf %lf %lf %d %d %d %d %7s %d %d %d %d",
+			&id, &priority, &params.rect.x, &params.rect.y, &params.rect.w,
+			&params.rect.h, &params.rect.x_lo, &params.rect.y_lo,
+			&params.width, &params.height, &params.iterations,
+			&params.exponent, format, &params.part.x, &params.part.y,
+			&params.part.w, &params.part.h);
+	if(fields == 13)
+		params.part = (Tile){0, 0, params.width, params.height};
+	if(fields != 13 && fields != 17) {
+		sendError(client, id, "malformed request");
+		return;
+	}
+	Tile part = params.part;
+	if(params.width < 1 || params.width > DAEMON_MAX_IMAGE_SIDE ||
+			params.height < 1 || params.height > DAEMON_MAX_IMAGE_SIDE ||
+			part.w < 1 || part.w > DAEMON_MAX_SIDE || part.h < 1 || part.h > DAEMON_MAX_SIDE ||
+			part.x < 0 || part.y < 0 || part.x > params.width - part.w ||
+			part.y > params.height - part.h) {
+		sendError(client, id, "invalid image size");
+		return;
+	}
+	if(params.iterations < 1 || params.iterations > DAEMON_MAX_ITERATIONS ||
+			params.exponent < 1 || params.exponent > DAEMON_MAX_EXPONENT) {
+		sendError(client, id, "invalid iterations or exponent");
+		return;
+	}
+
+	Waiter *waiter = (Waiter *)malloc(sizeof(Waiter));
+	if(waiter == NULL) {
+		sendError(client, id, "out of memory");
+		return;
+	}
+	waiter->client = client;
+	waiter->id = id;
+	if(strcmp(format, "raw") == 0) {
+		waiter->format = FORMAT_RAW;
+	} else if(strcmp(format, "bmp") == 0) {
+		waiter->format = FORMAT_BMP;
+	} else {
+		free(waiter);
+		sendError(client, id, "unknown format");
+		return;
+	}
+	enqueueRequest(&params, priority, waiter);
+}
+
+// Reads what the client sent and handles every complete line
+// Returns nonzero when the connection has to be dropped
+static int readClient(Client *client) {
+	ssize_t received = recv(client->fd, client->line + client->line_len,
+			sizeof(client->line) - client->line_len, 0);
+	if(received < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+	if(received <= 0)
+		return -1;
+	client->line_len += received;
+
+	char *start = client->line;
+	char *end;
+	while((end = memchr(start, '\n', client->line_len - (start - client->line))) != NULL) {
+		*end = '\0';
+		handleLine(client, start);
+		start = end + 1;
+	}
+	client->line_len -= start - client->line;
+	memmove(client->line, start, client->line_len);
+
+	if(client->line_len == (int)sizeof(client->line)) {
+		sendError(client, 0, "line too long");
+		return -1;
+	}
+	return 0;
+}
+
+// Takes the highest priority job from the queue, the oldest among equals
+// Has to be called with daemon_mutex held
+static Job *takeBestJob() {
+	Job **best = NULL;
+	for(Job **j = &queue; *j != NULL; j = &(*j)->next) {
+		if(best == NULL || (*j)->priority > (*best)->priority ||
+				((*j)->priority == (*best)->priority && (*j)->seq < (*best)->seq))
+			best = j;
+	}
+	if(best == NULL)
+		return NULL;
+	Job *job = *best;
+	*best = job->next;
+	job->next = NULL;
+	return job;
+}
+
+static void respond(Job *job, Waiter *waiters, int *argb) {
+	int w = job->params.part.w;
+	int h = job->params.part.h;
+	unsigned char *bmp = NULL;
+	int bmp_size = 0;
+
+	for(Waiter *waiter = waiters; waiter != NULL; waiter = waiter->next) {
+		if(waiter->format == FORMAT_RAW) {
+			sendImage(waiter->client, waiter->id, FORMAT_RAW, w, h,
+					argb, w * h * sizeof(int));
+			continue;
+		}
+		// Encoded once no matter how many clients asked for it
+		if(bmp == NULL)
+			bmp = encodeBmp(w, h, argb, &bmp_size);
+		if(bmp == NULL)
+			sendError(waiter->client, waiter->id, "out of memory");
+		else
+			sendImage(waiter->client, waiter->id, FORMAT_BMP, w, h, bmp, bmp_size);
+	}
+	free(bmp);
+}
+
+// Renders batches of queued jobs until the daemon stops
+static int renderJobs(void *data) {
+	(void)data;
+	// Per job of the batch
+	MandelBuffer *images = NULL;
+	RenderJob *batch = NULL;
+	int **outs = NULL;
+	int batch_alloc = 0;
+
+	SDL_LockMutex(daemon_mutex);
+	while(!stop) {
+		if(queue == NULL) {
+			SDL_CondWaitTimeout(job_cond, daemon_mutex, 200);
+			continue;
+		}
+
+		// Small requests like map tiles are taken in batches, so that
+		// identical requests arriving while the batch renders join it
+		Job *tail = NULL;
+		int pixels = 0;
+		int njobs = 0;
+		while(pixels < DAEMON_BATCH_PIXELS) {
+			Job *job = takeBestJob();
+			if(job == NULL)
+				break;
+			if(tail == NULL)
+				in_flight = job;
+			else
+				tail->next = job;
+			tail = job;
+			pixels += job->params.part.w * job->params.part.h;
+			njobs++;
+		}
+
+		int failed = 0;
+		if(njobs > batch_alloc) {
+			MandelBuffer *new_images = (MandelBuffer *)realloc(images, njobs * sizeof(MandelBuffer));
+			if(new_images != NULL) {
+				memset(new_images + batch_alloc, 0, (njobs - batch_alloc) * sizeof(MandelBuffer));
+				images = new_images;
+			}
+			RenderJob *new_batch = (RenderJob *)realloc(batch, njobs * sizeof(RenderJob));
+			if(new_batch != NULL)
+				batch = new_batch;
+			int **new_outs = (int **)realloc(outs, njobs * sizeof(int *));
+			if(new_outs != NULL)
+				outs = new_outs;
+			if(new_images != NULL && new_batch != NULL && new_outs != NULL)
+				batch_alloc = njobs;
+			else
+				failed = 1;
+		}
+		if(!failed) {
+			int i = 0;
+			for(Job *job = in_flight; job != NULL; job = job->next, i++) {
+				RenderParams *params = &job->params;
+				batch[i] = (RenderJob) {params->rect, params->width, params->height,
+						params->iterations, params->exponent, 0, params->part};
+			}
+		}
+		SDL_UnlockMutex(daemon_mutex);
+
+		// All jobs render at once, their tiles are spread over all workers
+		for(int i = 0; i < njobs && !failed; i++) {
+			failed = mandelBufferResize(&images[i], batch[i].part.w, batch[i].part.h);
+			outs[i] = images[i].rgb_data;
+		}
+		if(!failed) {
+			Uint64 start = SDL_GetPerformanceCounter();
+			failed = daemon_engine->renderBatch(batch, outs, njobs);
+			mandelLog(DEBUG, "Rendered %d images with %d pixels in %.2f ms\n", njobs, pixels,
+					(double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+					(double)SDL_GetPerformanceFrequency());
+		}
+
+		SDL_LockMutex(daemon_mutex);
+		for(int i = 0; in_flight != NULL; i++) {
+			// No request can join the job anymore once it left in_flight
+			Job *job = in_flight;
+			in_flight = job->next;
+			Waiter *waiters = job->waiters;
+			SDL_UnlockMutex(daemon_mutex);
+
+			if(failed) {
+				for(Waiter *waiter = waiters; waiter != NULL; waiter = waiter->next)
+					sendError(waiter->client, waiter->id, "out of memory");
+			} else {
+				respond(job, waiters, images[i].rgb_data);
+			}
+
+			SDL_LockMutex(daemon_mutex);
+			releaseWaiters(waiters);
+			free(job);
+		}
+	}
+	SDL_UnlockMutex(daemon_mutex);
+
+	for(int i = 0; i < batch_alloc; i++)
+		mandelBufferFree(&images[i]);
+	free(images);
+	free(batch);
+	free(outs);
+	return 0;
+}
+
+static void closeListener(int fd, const char *address) {
+	close(fd);
+	if(netIsUnixAddress(address))
+		unlink(address);
+}
+
+int runDaemon(const char *address, Engine *engine) {
+	daemon_engine = engine;
+	int listen_fd = netListen(address);
+	if(listen_fd < 0) {
+		mandelLog(ERROR, "Could not listen on %s: %s\n", address, strerror(errno));
+		return -1;
+	}
+
+	daemon_mutex = SDL_CreateMutex();
+	job_cond = SDL_CreateCond();
+	if(daemon_mutex == NULL || job_cond == NULL) {
+		mandelLog(ERROR, "Could not create daemon synchronization primitives!\n");
+		closeListener(listen_fd, address);
+		return -1;
+	}
+
+	if(pipe(wake_pipe) < 0 || fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK) < 0 ||
+			fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK) < 0) {
+		mandelLog(ERROR, "Could not create the daemon wake up pipe: %s\n", strerror(errno));
+		closeListener(listen_fd, address);
+		return -1;
+	}
+
+	signal(SIGINT, handleSignal);
+	signal(SIGTERM, handleSignal);
+	signal(SIGPIPE, SIG_IGN);
+
+	SDL_Thread *render_thread = SDL_CreateThread(renderJobs, "DaemonRender", NULL);
+	if(render_thread == NULL) {
+		mandelLog(ERROR, "Could not create Render Thread!\n");
+		closeListener(listen_fd, address);
+		return -1;
+	}
+	mandelLog(INFO, "Serving render requests on %s\n", address);
+
+	Client *clients = NULL;
+	int nclients = 0;
+	struct pollfd *fds = NULL;
+	int fds_size = 0;
+
+	while(!stop) {
+		if(nclients + 2 > fds_size) {
+			struct pollfd *new_fds = (struct pollfd *)realloc(fds,
+					(nclients + 2) * 2 * sizeof(struct pollfd));
+			if(new_fds == NULL) {
+				mandelLog(ERROR, "Could not allocate memory for daemon connections!\n");
+				break;
+			}
+			fds = new_fds;
+			fds_size = (nclients + 2) * 2;
+		}
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = wake_pipe[0];
+		fds[1].events = POLLIN;
+		int n = 2;
+		for(Client *c = clients; c != NULL; c = c->next, n++) {
+			fds[n].fd = c->fd;
+			fds[n].events = hasOutput(c) ? POLLIN | POLLOUT : POLLIN;
+		}
+
+		// Wakes up regularly to notice signals that hit another thread
+		if(poll(fds, n, 200) < 0) {
+			if(errno == EINTR)
+				continue;
+			mandelLog(ERROR, "poll failed: %s\n", strerror(errno));
+			break;
+		}
+
+		char wake[64];
+		while(read(wake_pipe[0], wake, sizeof(wake)) > 0)
+			;
+
+		n = 2;
+		for(Client **c = &clients; *c != NULL; n++) {
+			Client *client = *c;
+			int drop = 0;
+			if(fds[n].revents & (POLLIN | POLLHUP | POLLERR))
+				drop = readClient(client);
+			// Also sends what was queued since poll, and the last error of a
+			// client that is dropped
+			drop = flushClient(client) || drop;
+			if(drop) {
+				mandelLog(DEBUG, "Client %d disconnected\n", client->fd);
+				*c = client->next;
+				nclients--;
+				SDL_LockMutex(client->out_lock);
+				client->closed = 1;
+				SDL_UnlockMutex(client->out_lock);
+				SDL_LockMutex(daemon_mutex);
+				releaseClient(client);
+				SDL_UnlockMutex(daemon_mutex);
+			} else {
+				c = &client->next;
+			}
+		}
+
+		if(fds[0].revents & POLLIN) {
+			int fd = accept(listen_fd, NULL, NULL);
+			Client *client = fd >= 0 ? (Client *)calloc(1, sizeof(Client)) : NULL;
+			if(client != NULL)
+				client->out_lock = SDL_CreateMutex();
+			if(client != NULL && client->out_lock != NULL &&
+					fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0) {
+				client->fd = fd;
+				client->refs = 1;
+				client->next = clients;
+				clients = client;
+				nclients++;
+				mandelLog(DEBUG, "Client %d connected\n", fd);
+			} else if(fd >= 0) {
+				mandelLog(WARN, "Could not accept connection\n");
+				if(client != NULL && client->out_lock != NULL)
+					SDL_DestroyMutex(client->out_lock);
+				free(client);
+				close(fd);
+			}
+		}
+	}
+
+	mandelLog(INFO, "Stopping daemon\n");
+	stop = 1;
+	SDL_LockMutex(daemon_mutex);
+	SDL_CondSignal(job_cond);
+	SDL_UnlockMutex(daemon_mutex);
+	SDL_WaitThread(render_thread, NULL);
+
+	while(queue != NULL) {
+		Job *job = queue;
+		queue = job->next;
+		releaseWaiters(job->waiters);
+		free(job);
+	}
+	while(clients != NULL) {
+		Client *client = clients;
+		clients = client->next;
+		releaseClient(client);
+	}
+	free(fds);
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	closeListener(listen_fd, address);
+	SDL_DestroyCond(job_cond);
+	SDL_DestroyMutex(daemon_mutex);
+	return 0;
+}
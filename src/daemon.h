@@ -0,0 +1,11 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include "engine.h"
+
+// Serves render requests on a Unix domain socket or a TCP address (see net.h)
+// until SIGINT or SIGTERM is received. The engine has to be initialized already.
+// Returns nonzero if the socket could not be set up.
+int runDaemon(const char *address, Engine *engine);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _DAEMON_PROTOCOL_H_
+#define _DAEMON_PROTOCOL_H_
+
+/*
+ * Line protocol spoken between the render daemon and its clients over a
+ * Unix domain or TCP stream socket. Clients send one request per line:
+ *
+ *   RENDER <id> <priority> <x> <y> <w> <h> <x_lo> <y_lo> <width> <height>
+ *          <iterations> <exponent> <raw|bmp> [<part_x> <part_y> <part_w> <part_h>]
+ *
+ * The rectangle fields are those of Rectangle, printed with %.17g so that no
+ * precision is lost. With the optional part only the part_w x part_h pixels
+ * starting at pixel (part_x, part_y) of the width x height image are
+ * rendered and sent. They are the same pixels a render of the whole image
+ * has there, so parts rendered by different daemons fit together without
+ * seams. Requests with a higher priority are rendered first, so
+ * responses can arrive in a different order than the requests. Every request
+ * is answered with either
+ *
+ *   OK <id> <raw|bmp> <width> <height> <bytes>
+ *
+ * followed by <bytes> bytes of image data, or with
+ *
+ *   ERR <id> <message>
+ *
+ * where width and height are those of the sent pixels.
+ * raw images are width * height pixels of native endian 32 bit ARGB, row by
+ * row starting at the row of rect.y. bmp images are complete BMP files.
+ */
+
+#define DAEMON_MAX_LINE 512
+#define DAEMON_MAX_SIDE 16383
+// Images only rendered in parts may be larger
+#define DAEMON_MAX_IMAGE_SIDE 1048575
+#define DAEMON_MAX_ITERATIONS 5000
+#define DAEMON_MAX_EXPONENT 200
+
+#endif
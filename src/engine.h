@@ -0,0 +1,31 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include "mandelbrot_common.h"
+
+typedef enum {
+	ENGINE_TYPE_CPU,
+	ENGINE_TYPE_CUDA
+} EngineType;
+
+typedef struct Engine {
+	EngineType type;
+	void (*genImage)(Rectangle coord_rect, int *out_argb);
+	void (*genImageWH)(int w, int h, Rectangle coord_rect, int *out_argb);
+	// Renders the image in parts, nearest to the focus first, NULL if not supported.
+	// Returns the part to continue with, 0 once the image is complete.
+	// *changed is set to a box around the pixels the part wrote.
+	int (*genImageFocus)(int w, int h, Rectangle coord_rect, int *out_argb,
+			int focus_x, int focus_y, int part, int max_pixels, Tile *changed);
+	void (*doAA)(Rectangle coord_rect, int *out_argb, int aa_counter);
+	void (*changeIters)(int diff);
+	void (*changeExponent)(int newExp);
+	int (*resizeFramebuffer)(int new_w, int new_h);
+	// Renders the parts of jobs with their own iterations and exponent,
+	// nonzero on errors
+	int (*renderBatch)(const RenderJob *jobs, int *const *outs, int njobs);
+	// Iteration counts of the last genImage(WH) image, NULL if not supported
+	int (*getStats)(IterStats *stats);
+} Engine;
+
+#endif
@@ -0,0 +1,67 @@
+#define _GNU_SOURCE
+#include "frame_arena.h"
+#include "config.h"
+#include "logger.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static int use_huge_pages = 0;
+
+void frameArenaUseHugePages(int enable) {
+	use_huge_pages = enable;
+}
+
+int *frameAlloc(int pixels) {
+	size_t size = (size_t)pixels * sizeof(int);
+	size_t alignment = FRAME_ALIGNMENT;
+
+	// Transparent huge pages need the allocation to be aligned to a huge page
+	if(use_huge_pages && size >= HUGE_PAGE_SIZE) {
+		alignment = HUGE_PAGE_SIZE;
+		size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+	}
+
+	void *data = NULL;
+	if(posix_memalign(&data, alignment, size) != 0)
+		return NULL;
+
+#ifdef MADV_HUGEPAGE
+	if(alignment == HUGE_PAGE_SIZE && madvise(data, size, MADV_HUGEPAGE) != 0)
+		mandelLog(DEBUG, "Transparent huge pages are not available\n");
+#endif
+	return (int *)data;
+}
+
+void frameFree(int *data) {
+	free(data);
+}
+
+int mandelBufferResize(MandelBuffer *buf, int w, int h) {
+	int alloc_diff = buf->alloc_size - w * h;
+	if(buf->rgb_data != NULL && alloc_diff >= 0 && alloc_diff < OVERALLOC_LIMIT) {
+		// When the necessary size is already overallocated and below the
+		// overallocation-limit we don't reallocate
+		buf->w = w;
+		buf->h = h;
+		return 0;
+	}
+
+	// Reallocation is needed
+	// We overallocate half of the overallocation limit for good flexibility
+	int alloc_size = w * h + (OVERALLOC_LIMIT / 2);
+	int *data = frameAlloc(alloc_size);
+	if(data == NULL)
+		return -1;
+
+	frameFree(buf->rgb_data);
+	*buf = (MandelBuffer){w, h, alloc_size, data};
+	return 0;
+}
+
+void mandelBufferFree(MandelBuffer *buf) {
+	frameFree(buf->rgb_data);
+	*buf = (MandelBuffer){0, 0, 0, NULL};
+}
@@ -0,0 +1,20 @@
+#ifndef _FRAME_ARENA_H_
+#define _FRAME_ARENA_H_
+
+#include "mandelbrot_common.h"
+
+// Aligned to a cache line, which also covers 32 byte AVX stores
+#define FRAME_ALIGNMENT 64
+
+void frameArenaUseHugePages(int enable);
+
+int *frameAlloc(int pixels);
+void frameFree(int *data);
+
+// Resizes buf to w x h pixels, reusing the allocation when it is large
+// enough and not more than OVERALLOC_LIMIT pixels too large.
+// The content is not preserved when a new allocation is needed.
+int mandelBufferResize(MandelBuffer *buf, int w, int h);
+void mandelBufferFree(MandelBuffer *buf);
+
+#endif
@@ -0,0 +1,117 @@
+#include "frame_export.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static size_t slotSize(int max_pixels) {
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = EXPORT_PIXEL_OFFSET + (size_t)max_pixels * sizeof(int);
+	return (size + page - 1) / page * page;
+}
+
+static ExportHeader *header(FrameExport *exp) {
+	return (ExportHeader *)exp->map;
+}
+
+int frameExportOpen(FrameExport *exp, const char *name, int nslots, int max_pixels) {
+	memset(exp, 0, sizeof(FrameExport));
+	exp->fd = -1;
+	if(nslots < 2 || max_pixels < 1) {
+		mandelLog(ERROR, "Invalid frame export size\n");
+		return -1;
+	}
+	snprintf(exp->name, sizeof(exp->name), "/%s", name);
+
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t slot_size = slotSize(max_pixels);
+	exp->map_size = page + nslots * slot_size;
+
+	// Consumers of an older instance keep their mapping of the old object
+	shm_unlink(exp->name);
+	exp->fd = shm_open(exp->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if(exp->fd < 0)
+		goto error;
+	// The pages are only allocated once frames are written into them
+	if(ftruncate(exp->fd, (off_t)exp->map_size))
+		goto error;
+	exp->map = (uint8_t *)mmap(NULL, exp->map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, exp->fd, 0);
+	if(exp->map == MAP_FAILED) {
+		exp->map = NULL;
+		goto error;
+	}
+
+	ExportHeader *head = header(exp);
+	head->nslots = nslots;
+	head->slot_size = (uint32_t)slot_size;
+	head->max_pixels = max_pixels;
+	atomic_store(&head->frames_written, 0);
+	head->version = FRAME_EXPORT_VERSION;
+	// Written last, consumers check it before trusting the rest
+	atomic_thread_fence(memory_order_release);
+	head->magic = FRAME_EXPORT_MAGIC;
+
+	mandelLog(INFO, "Exporting frames to shared memory %s (%d slots of %zu bytes)\n",
+			exp->name, nslots, slot_size);
+	return 0;
+error:
+	mandelLog(ERROR, "Could not create shared memory %s: %s\n", exp->name, strerror(errno));
+	frameExportClose(exp);
+	return -1;
+}
+
+void frameExportWrite(FrameExport *exp, const int *pixels, int w, int h,
+		Rectangle rect, unsigned int view_seq, int final) {
+	if(exp->map == NULL)
+		return;
+	ExportHeader *head = header(exp);
+	if((long)w * h > (long)head->max_pixels) {
+		if(!exp->warned)
+			mandelLog(WARN, "Frames of %dx%d are too large to be exported\n", w, h);
+		exp->warned = 1;
+		return;
+	}
+
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	uint32_t frame = exp->frames++;
+	ExportFrame *slot = (ExportFrame *)(exp->map + page +
+			(size_t)(frame % head->nslots) * head->slot_size);
+
+	// Seqlock, consumers that see an odd or changed seq drop the frame
+	atomic_store_explicit(&slot->seq, 2 * (uint64_t)frame + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->w = w;
+	slot->h = h;
+	slot->view_seq = view_seq;
+	slot->final = final;
+	slot->x = rect.x;
+	slot->y = rect.y;
+	slot->width = rect.w;
+	slot->height = rect.h;
+	memcpy((uint8_t *)slot + EXPORT_PIXEL_OFFSET, pixels, (size_t)w * h * sizeof(int));
+	atomic_store_explicit(&slot->seq, 2 * (uint64_t)frame + 2, memory_order_release);
+
+	atomic_store_explicit(&head->frames_written, frame + 1, memory_order_release);
+	// Not a private futex, the waiters are in other processes
+	syscall(SYS_futex, &head->frames_written, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void frameExportClose(FrameExport *exp) {
+	if(exp->map != NULL)
+		munmap(exp->map, exp->map_size);
+	if(exp->fd >= 0) {
+		close(exp->fd);
+		shm_unlink(exp->name);
+	}
+	exp->map = NULL;
+	exp->fd = -1;
+}
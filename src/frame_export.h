@@ -0,0 +1,70 @@
+#ifndef _FRAME_EXPORT_H_
+#define _FRAME_EXPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "mandelbrot_common.h"
+
+#define FRAME_EXPORT_MAGIC 0x4d414e44 // "MAND"
+#define FRAME_EXPORT_VERSION 1
+
+/*
+ * Layout of the shared memory object /NAME created by --export-frames NAME.
+ * It starts with an ExportHeader, followed by nslots slots of slot_size
+ * bytes. Every slot is an ExportFrame followed by w * h pixels in the
+ * format of the framebuffer (one int per pixel, red in the low byte).
+ *
+ * Frames are written into the slots round robin and never wait for
+ * consumers. A consumer reads a frame in place:
+ *  - wait for frames_written to change, e.g. with FUTEX_WAIT on it
+ *  - take slot (frames_written - 1) % nslots and read its seq
+ *  - use the pixels, then read seq again. If it changed, or is odd, the
+ *    slot was overwritten meanwhile and the frame has to be dropped.
+ * Consumers that take longer than nslots - 1 frames drop frames.
+ */
+typedef struct ExportHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t slot_size;  // In bytes, a multiple of the page size
+	uint32_t max_pixels; // Larger frames are not exported
+	// Number of frames written, also the futex word consumers wait on
+	_Atomic uint32_t frames_written;
+} ExportHeader;
+
+typedef struct ExportFrame {
+	// Odd while the slot is written, 2 * frame number + 2 afterwards
+	_Atomic uint64_t seq;
+	uint32_t w;
+	uint32_t h;
+	uint32_t view_seq; // Number of the view the frame shows
+	uint32_t final;    // Nothing more is rendered for the view after this frame
+	double x, y, width, height; // Region of the complex plane
+} ExportFrame;
+
+// Offset of the pixels in a slot
+#define EXPORT_PIXEL_OFFSET 64
+
+typedef struct FrameExport {
+	int fd;
+	char name[256];
+	uint8_t *map;
+	size_t map_size;
+	uint32_t frames;
+	int warned;
+} FrameExport;
+
+// Creates the shared memory object /name with nslots slots of up to
+// max_pixels pixels, replacing an older one. Returns nonzero on errors.
+int frameExportOpen(FrameExport *exp, const char *name, int nslots, int max_pixels);
+
+// Copies the frame into the next slot and wakes up waiting consumers
+void frameExportWrite(FrameExport *exp, const int *pixels, int w, int h,
+		Rectangle rect, unsigned int view_seq, int final);
+
+// Unmaps and removes the shared memory object
+void frameExportClose(FrameExport *exp);
+
+#endif
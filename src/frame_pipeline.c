@@ -0,0 +1,75 @@
+#include "frame_pipeline.h"
+#include "logger.h"
+#include "frame_arena.h"
+
+#include <stdlib.h>
+
+#define FRESH_BIT 0x100
+#define INDEX_MASK 0xff
+
+int pipelineInit(FramePipeline *pipeline) {
+	for(int i = 0; i < PIPELINE_FRAMES; i++) {
+		pipeline->frames[i] = (Frame){{0, 0, 0, NULL}, {0, 0, 0, 0, 0, 0}, 0, 0, 0, 0,
+				{0, 0, 0, 0}};
+	}
+	pipeline->back = 0;
+	atomic_init(&pipeline->middle, 1);
+	pipeline->front = 2;
+	pipeline->seq = 0;
+
+	pipeline->ready = SDL_CreateSemaphore(0);
+	if(pipeline->ready == NULL) {
+		mandelLog(ERROR, "Could not create Semaphore: %s\n", SDL_GetError());
+		return -1;
+	}
+	return 0;
+}
+
+void pipelineDestroy(FramePipeline *pipeline) {
+	for(int i = 0; i < PIPELINE_FRAMES; i++) {
+		mandelBufferFree(&pipeline->frames[i].buf);
+	}
+	if(pipeline->ready != NULL)
+		SDL_DestroySemaphore(pipeline->ready);
+}
+
+Frame *pipelineBackFrame(FramePipeline *pipeline) {
+	return &pipeline->frames[pipeline->back];
+}
+
+// Only the producer may call this, as it touches the back frame
+int pipelineResizeBack(FramePipeline *pipeline, int w, int h) {
+	return mandelBufferResize(&pipeline->frames[pipeline->back].buf, w, h);
+}
+
+// Hands the back frame over to the consumer and takes the middle frame in exchange
+// Returns the published frame, which stays untouched until the next publish
+Frame *pipelinePublish(FramePipeline *pipeline) {
+	int published = pipeline->back;
+	pipeline->frames[published].seq = ++pipeline->seq;
+
+	int old = atomic_exchange(&pipeline->middle, published | FRESH_BIT);
+	pipeline->back = old & INDEX_MASK;
+	pipeline->frames[pipeline->back].base_seq = 0;
+
+	SDL_SemPost(pipeline->ready);
+	return &pipeline->frames[published];
+}
+
+// Returns the newest published frame or NULL if nothing new was published
+Frame *pipelineAcquire(FramePipeline *pipeline) {
+	if(!(atomic_load(&pipeline->middle) & FRESH_BIT))
+		return NULL;
+
+	int old = atomic_exchange(&pipeline->middle, pipeline->front);
+	pipeline->front = old & INDEX_MASK;
+	return &pipeline->frames[pipeline->front];
+}
+
+void pipelineWait(FramePipeline *pipeline) {
+	SDL_SemWait(pipeline->ready);
+}
+
+void pipelineNotify(FramePipeline *pipeline) {
+	SDL_SemPost(pipeline->ready);
+}
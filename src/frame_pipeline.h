@@ -0,0 +1,54 @@
+#ifndef _FRAME_PIPELINE_H_
+#define _FRAME_PIPELINE_H_
+
+#include <SDL.h>
+#include <stdatomic.h>
+
+#include "mandelbrot_common.h"
+
+#define PIPELINE_FRAMES 3
+
+typedef struct Frame {
+	MandelBuffer buf;
+	Rectangle rect;
+	unsigned int seq;
+	unsigned int view_seq; // Number of the view the frame shows
+	int final; // Nothing more is rendered for the view after this frame
+	// When nonzero, the frame only differs from frame base_seq inside dirty.
+	// Reset to 0 when the producer gets the frame back.
+	unsigned int base_seq;
+	Tile dirty;
+} Frame;
+
+/*
+ * Triple buffer between the compute stage (producer) and the
+ * present stage (consumer).
+ * The producer always owns the back frame and the consumer always owns
+ * the front frame. The middle frame is handed over with a single atomic
+ * exchange, so neither side ever waits on the other.
+ */
+typedef struct FramePipeline {
+	Frame frames[PIPELINE_FRAMES];
+	int back;
+	int front;
+	atomic_int middle; // index of the middle frame, ORed with a fresh bit
+	unsigned int seq;
+	SDL_sem *ready; // posted whenever the consumer has something to do
+} FramePipeline;
+
+int pipelineInit(FramePipeline *pipeline);
+void pipelineDestroy(FramePipeline *pipeline);
+
+// Producer side
+Frame *pipelineBackFrame(FramePipeline *pipeline);
+int pipelineResizeBack(FramePipeline *pipeline, int w, int h);
+Frame *pipelinePublish(FramePipeline *pipeline);
+
+// Consumer side
+Frame *pipelineAcquire(FramePipeline *pipeline);
+void pipelineWait(FramePipeline *pipeline);
+
+// Wakes up the consumer without publishing a frame
+void pipelineNotify(FramePipeline *pipeline);
+
+#endif
@@ -0,0 +1,45 @@
+#include "frame_scheduler.h"
+#include "config.h"
+#include "logger.h"
+
+#include <math.h>
+
+// Weight of the newest measurement in the moving average
+#define THROUGHPUT_SMOOTHING 0.5
+
+void schedulerInit(FrameScheduler *scheduler, float target_ms) {
+	scheduler->target_ms = target_ms;
+	scheduler->pixels_per_ms = 0.0;
+}
+
+float schedulerPickScale(FrameScheduler *scheduler, int w, int h) {
+	// Without any measurement yet we have to assume the frame fits
+	if(scheduler->pixels_per_ms <= 0.0 || w * h <= 0)
+		return 1.0;
+
+	double predicted_ms = (double)w * (double)h / scheduler->pixels_per_ms;
+	if(predicted_ms <= scheduler->target_ms)
+		return 1.0;
+
+	// The cost scales with the pixel count, so with the square of the scale
+	float scale = sqrt(scheduler->target_ms / predicted_ms);
+	if(scale < MIN_PREVIEW_SCALE)
+		scale = MIN_PREVIEW_SCALE;
+	mandelLog(DEBUG, "Predicted %.1f ms for full resolution, rendering at scale %.3f\n",
+			predicted_ms, scale);
+	return scale;
+}
+
+void schedulerRecord(FrameScheduler *scheduler, int pixels, double ms) {
+	if(pixels <= 0)
+		return;
+	if(ms < 0.01)
+		ms = 0.01;
+	double throughput = (double)pixels / ms;
+
+	if(scheduler->pixels_per_ms <= 0.0)
+		scheduler->pixels_per_ms = throughput;
+	else
+		scheduler->pixels_per_ms = THROUGHPUT_SMOOTHING * throughput +
+				(1.0 - THROUGHPUT_SMOOTHING) * scheduler->pixels_per_ms;
+}
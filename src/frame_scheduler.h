@@ -0,0 +1,23 @@
+#ifndef _FRAME_SCHEDULER_H_
+#define _FRAME_SCHEDULER_H_
+
+/*
+ * Picks the render resolution of interactive frames so that they fit into
+ * a frame time budget. The cost of a frame is predicted from the throughput
+ * (pixels per millisecond) measured on the most recent frames, since
+ * consecutive frames during interaction show very similar views.
+ */
+typedef struct FrameScheduler {
+	float target_ms;
+	double pixels_per_ms; // Exponential moving average, 0 when unknown
+} FrameScheduler;
+
+void schedulerInit(FrameScheduler *scheduler, float target_ms);
+
+// Returns the linear scale (0, 1] at which a w x h frame fits the budget
+float schedulerPickScale(FrameScheduler *scheduler, int w, int h);
+
+// Feeds the measured render time of a frame back into the prediction
+void schedulerRecord(FrameScheduler *scheduler, int pixels, double ms);
+
+#endif
@@ -0,0 +1,269 @@
+#include "image_ops.h"
+#include "image_ops_avx2.h"
+#include "mandelbrot_common.h"
+#include "logger.h"
+#include "util.h"
+#include "config.h"
+
+#include <stdlib.h>
+
+typedef enum ImageOp {
+	IMAGE_NN,
+	IMAGE_LINEAR,
+	IMAGE_BOX,
+	IMAGE_BLEND
+} ImageOp;
+
+// Shared by all workers, which take chunks of rows from next_row
+typedef struct ImageJob {
+	ImageOp op;
+	const int *in;
+	int w_in;
+	int h_in;
+	int *out;
+	int w_out;
+	int h_out;
+	// Per output column: source columns and weight of the right one (0-255)
+	const int *cols0;
+	const int *cols1;
+	const int *fx;
+	float scale_y;
+	int factor;
+	int weight; // Of the blended image, 0-256
+	int nrows;
+	int chunk;
+	int next_row;
+} ImageJob;
+
+static int useAvx2() {
+#if ENABLE_AVX
+	static int supported = -1;
+	if(supported < 0)
+		supported = __builtin_cpu_supports("avx2");
+	return supported;
+#else
+	return 0;
+#endif
+}
+
+// (a * (256 - w) + b * w) / 256 on each channel
+static int lerpColor(int a, int b, int w) {
+	int color = 0;
+	for(int shift = 0; shift < 32; shift += 8) {
+		unsigned int ca = ((unsigned int)a >> shift) & 0xff;
+		unsigned int cb = ((unsigned int)b >> shift) & 0xff;
+		color |= (int)(((ca * (256 - w) + cb * w + 128) >> 8) << shift);
+	}
+	return color;
+}
+
+static void nnRow(const ImageJob *job, int y) {
+	int in_y = clamp(round_simple(job->scale_y * (float)y), 0, job->h_in - 1);
+	const int *in_row = job->in + in_y * job->w_in;
+	int *out = job->out + y * job->w_out;
+	int x = 0;
+#if ENABLE_AVX
+	if(useAvx2())
+		x = imageNNRowAvx2(in_row, job->cols0, out, job->w_out);
+#endif
+	for(; x < job->w_out; x++)
+		out[x] = in_row[job->cols0[x]];
+}
+
+static void linearRow(const ImageJob *job, int y) {
+	float in_y = job->scale_y * (float)y;
+	int y0 = clamp((int)in_y, 0, job->h_in - 1);
+	int y1 = clamp((int)in_y + 1, 0, job->h_in - 1);
+	int fy = clamp((int)((in_y - (int)in_y) * 256.0f), 0, 255);
+	const int *row0 = job->in + y0 * job->w_in;
+	const int *row1 = job->in + y1 * job->w_in;
+	int *out = job->out + y * job->w_out;
+	int x = 0;
+#if ENABLE_AVX
+	if(useAvx2())
+		x = imageLinearRowAvx2(row0, row1, job->cols0, job->cols1, job->fx, fy, out, job->w_out);
+#endif
+	for(; x < job->w_out; x++) {
+		int top = lerpColor(row0[job->cols0[x]], row0[job->cols1[x]], job->fx[x]);
+		int bottom = lerpColor(row1[job->cols0[x]], row1[job->cols1[x]], job->fx[x]);
+		out[x] = lerpColor(top, bottom, fy);
+	}
+}
+
+// Spreads the channels of a pixel into 16 bits each
+static uint64_t widenColor(int color) {
+	uint64_t c = (unsigned int)color;
+	return (c & 0xff) | (c & 0xff00) << 8 | (c & 0xff0000) << 16 | (c & 0xff000000) << 24;
+}
+
+static void boxRow(const ImageJob *job, int y, uint64_t *sums) {
+	int factor = job->factor;
+	int w = job->w_out * factor;
+	const int *in = job->in + y * factor * job->w_in;
+	int x = 0;
+#if ENABLE_AVX
+	if(useAvx2())
+		x = imageBoxSumAvx2(in, job->w_in, w, factor, sums);
+#endif
+	for(; x < w; x++) {
+		uint64_t sum = 0;
+		for(int row = 0; row < factor; row++)
+			sum += widenColor(in[row * job->w_in + x]);
+		sums[x] = sum;
+	}
+
+	// The sums of a block stay below 2^16 per channel, so all channels of a
+	// pixel can be added in one 64 bit integer. Multiplying with the rounded
+	// up reciprocal divides them exactly.
+	int n = factor * factor;
+	uint64_t reciprocal = (1ull << 32) / n + 1;
+	int *out = job->out + y * job->w_out;
+	for(int out_x = 0; out_x < job->w_out; out_x++) {
+		uint64_t sum = 0;
+		for(int i = 0; i < factor; i++)
+			sum += sums[out_x * factor + i];
+		int color = 0;
+		for(int c = 0; c < 4; c++) {
+			uint64_t channel = ((sum >> (c * 16)) & 0xffff) + n / 2;
+			color |= (int)(((channel * reciprocal) >> 32) << (c * 8));
+		}
+		out[out_x] = color;
+	}
+}
+
+// In blend jobs a row is a chunk of IMAGE_BLEND_SPAN pixels
+static void blendRow(const ImageJob *job, int row) {
+	int first = row * IMAGE_BLEND_SPAN;
+	int n = job->w_out - first < IMAGE_BLEND_SPAN ? job->w_out - first : IMAGE_BLEND_SPAN;
+	int *dst = job->out + first;
+	const int *src = job->in + first;
+	int i = 0;
+#if ENABLE_AVX
+	if(useAvx2())
+		i = imageBlendAvx2(dst, src, n, job->weight);
+#endif
+	for(; i < n; i++)
+		dst[i] = 0xff000000 | lerpColor(dst[i], src[i], job->weight);
+}
+
+static int imageWorker(void *voidargs) {
+	ImageJob *job = (ImageJob *)voidargs;
+	uint64_t *sums = NULL;
+	if(job->op == IMAGE_BOX) {
+		sums = (uint64_t *)malloc(job->w_out * job->factor * sizeof(uint64_t));
+		if(sums == NULL) {
+			mandelLog(ERROR, "Could not allocate memory for downscaling!\n");
+			return -1;
+		}
+	}
+
+	int first;
+	while((first = __atomic_fetch_add(&job->next_row, job->chunk, __ATOMIC_RELAXED)) < job->nrows) {
+		int last = first + job->chunk < job->nrows ? first + job->chunk : job->nrows;
+		for(int row = first; row < last; row++) {
+			switch(job->op) {
+				case IMAGE_NN:
+					nnRow(job, row);
+					break;
+				case IMAGE_LINEAR:
+					linearRow(job, row);
+					break;
+				case IMAGE_BOX:
+					boxRow(job, row, sums);
+					break;
+				case IMAGE_BLEND:
+					blendRow(job, row);
+					break;
+			}
+		}
+	}
+	free(sums);
+	return 0;
+}
+
+// npixels is the amount of work, small images are not worth waking up the pool
+static int runImageJob(ThreadPool *pool, ImageJob *job, int npixels) {
+	job->next_row = 0;
+	int nthreads = pool != NULL && npixels >= IMAGE_MIN_PARALLEL_PIXELS ?
+			threadPoolSize(pool) : 1;
+	job->chunk = job->nrows / (nthreads * 4);
+	if(job->chunk < 1)
+		job->chunk = 1;
+
+	if(nthreads == 1)
+		return imageWorker(job);
+	// Rows are left to the other workers when one of them fails
+	threadPoolRun(pool, imageWorker, job, 0);
+	return job->next_row < job->nrows ? -1 : 0;
+}
+
+void imageScale(ThreadPool *pool, const int *in, int w_in, int h_in,
+		int *out, int w_out, int h_out, int interp_method) {
+	int linear = interp_method == INTERP_LINEAR;
+	int *cols = (int *)malloc(w_out * 3 * sizeof(int));
+	if(cols == NULL) {
+		mandelLog(ERROR, "Could not allocate memory for scaling!\n");
+		return;
+	}
+
+	ImageJob job;
+	job.op = linear ? IMAGE_LINEAR : IMAGE_NN;
+	job.in = in;
+	job.w_in = w_in;
+	job.h_in = h_in;
+	job.out = out;
+	job.w_out = w_out;
+	job.h_out = h_out;
+	job.cols0 = cols;
+	job.cols1 = cols + w_out;
+	job.fx = cols + 2 * w_out;
+	job.scale_y = (float)h_in / (float)h_out;
+	job.nrows = h_out;
+
+	// Source columns are the same for every row
+	float scale_x = (float)w_in / (float)w_out;
+	for(int x = 0; x < w_out; x++) {
+		float in_x = scale_x * (float)x;
+		if(linear) {
+			cols[x] = clamp((int)in_x, 0, w_in - 1);
+			cols[w_out + x] = clamp((int)in_x + 1, 0, w_in - 1);
+			cols[2 * w_out + x] = clamp((int)((in_x - (int)in_x) * 256.0f), 0, 255);
+		} else {
+			cols[x] = clamp(round_simple(in_x), 0, w_in - 1);
+		}
+	}
+
+	runImageJob(pool, &job, w_out * h_out);
+	free(cols);
+}
+
+int imageDownscaleBox(ThreadPool *pool, const int *in, int w_in, int h_in,
+		int factor, int *out) {
+	if(factor < 1 || factor > IMAGE_MAX_BOX_FACTOR) {
+		mandelLog(ERROR, "Invalid downscale factor %d\n", factor);
+		return -1;
+	}
+
+	ImageJob job;
+	job.op = IMAGE_BOX;
+	job.in = in;
+	job.w_in = w_in;
+	job.h_in = h_in;
+	job.out = out;
+	job.w_out = w_in / factor;
+	job.h_out = h_in / factor;
+	job.factor = factor;
+	job.nrows = job.h_out;
+	return runImageJob(pool, &job, w_in * h_in);
+}
+
+void imageBlend(ThreadPool *pool, int *dst, const int *src, int npixels, float ratio) {
+	ImageJob job;
+	job.op = IMAGE_BLEND;
+	job.in = src;
+	job.out = dst;
+	job.w_out = npixels;
+	job.weight = clamp(round_simple(ratio * 256.0f), 0, 256);
+	job.nrows = (npixels + IMAGE_BLEND_SPAN - 1) / IMAGE_BLEND_SPAN;
+	runImageJob(pool, &job, npixels);
+}
@@ -0,0 +1,28 @@
+#ifndef _IMAGE_OPS_H_
+#define _IMAGE_OPS_H_
+
+#include "threadpool.h"
+
+/*
+ * Operations on ARGB images with 8 bits per channel. All of them use
+ * fixed-point arithmetic, so the AVX2 and scalar versions give the same
+ * results. Rows are split across the workers of pool, or processed by the
+ * calling thread when pool is NULL.
+ */
+
+// Largest factor of imageDownscaleBox, keeps the sums of a block in 16 bits
+#define IMAGE_MAX_BOX_FACTOR 16
+
+// Scales in to w_out x h_out with INTERP_NN or INTERP_LINEAR
+void imageScale(ThreadPool *pool, const int *in, int w_in, int h_in,
+		int *out, int w_out, int h_out, int interp_method);
+
+// Averages blocks of factor x factor pixels into out, which is
+// w_in / factor x h_in / factor pixels large. Returns nonzero on errors.
+int imageDownscaleBox(ThreadPool *pool, const int *in, int w_in, int h_in,
+		int factor, int *out);
+
+// dst = dst * (1 - ratio) + src * ratio, with full alpha
+void imageBlend(ThreadPool *pool, int *dst, const int *src, int npixels, float ratio);
+
+#endif
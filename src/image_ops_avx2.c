@@ -0,0 +1,75 @@
+#include "image_ops_avx2.h"
+
+#include <immintrin.h>
+
+// (a * (256 - w) + b * w) / 256 on 16 bit channels
+static inline __m256i lerp16(__m256i a, __m256i b, __m256i w) {
+	__m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(256), w);
+	__m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(a, inv), _mm256_mullo_epi16(b, w));
+	return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(128)), 8);
+}
+
+// Blends 8 pixels. Unpacking to 16 bits puts pixels 0, 1, 4, 5 into the low
+// and 2, 3, 6, 7 into the high half, which packing undoes.
+static inline __m256i lerpPixels(__m256i a, __m256i b, __m256i w_lo, __m256i w_hi) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lo = lerp16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero), w_lo);
+	__m256i hi = lerp16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero), w_hi);
+	return _mm256_packus_epi16(lo, hi);
+}
+
+int imageNNRowAvx2(const int *in_row, const int *cols, int *out, int w_out) {
+	int x = 0;
+	for(; x + 8 <= w_out; x += 8) {
+		__m256i idx = _mm256_loadu_si256((const __m256i *)(cols + x));
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_i32gather_epi32(in_row, idx, 4));
+	}
+	return x;
+}
+
+int imageLinearRowAvx2(const int *row0, const int *row1, const int *cols0,
+		const int *cols1, const int *fx, int fy, int *out, int w_out) {
+	__m256i wy = _mm256_set1_epi16(fy);
+	int x = 0;
+	for(; x + 8 <= w_out; x += 8) {
+		__m256i c0 = _mm256_loadu_si256((const __m256i *)(cols0 + x));
+		__m256i c1 = _mm256_loadu_si256((const __m256i *)(cols1 + x));
+		// Weight of each pixel in both 16 bit halves, then once per channel
+		__m256i wx = _mm256_loadu_si256((const __m256i *)(fx + x));
+		wx = _mm256_or_si256(wx, _mm256_slli_epi32(wx, 16));
+		__m256i wx_lo = _mm256_unpacklo_epi32(wx, wx);
+		__m256i wx_hi = _mm256_unpackhi_epi32(wx, wx);
+
+		__m256i top = lerpPixels(_mm256_i32gather_epi32(row0, c0, 4),
+				_mm256_i32gather_epi32(row0, c1, 4), wx_lo, wx_hi);
+		__m256i bottom = lerpPixels(_mm256_i32gather_epi32(row1, c0, 4),
+				_mm256_i32gather_epi32(row1, c1, 4), wx_lo, wx_hi);
+		_mm256_storeu_si256((__m256i *)(out + x), lerpPixels(top, bottom, wy, wy));
+	}
+	return x;
+}
+
+int imageBoxSumAvx2(const int *in, int stride, int w, int factor, uint64_t *sums) {
+	int x = 0;
+	for(; x + 4 <= w; x += 4) {
+		__m256i sum = _mm256_setzero_si256();
+		for(int row = 0; row < factor; row++) {
+			__m128i pixels = _mm_loadu_si128((const __m128i *)(in + row * stride + x));
+			sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(pixels));
+		}
+		_mm256_storeu_si256((__m256i *)(sums + x), sum);
+	}
+	return x;
+}
+
+int imageBlendAvx2(int *dst, const int *src, int n, int weight) {
+	__m256i w = _mm256_set1_epi16(weight);
+	__m256i alpha = _mm256_set1_epi32(0xff000000);
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(lerpPixels(a, b, w, w), alpha));
+	}
+	return i;
+}
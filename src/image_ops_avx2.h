@@ -0,0 +1,18 @@
+#ifndef _IMAGE_OPS_AVX2_H_
+#define _IMAGE_OPS_AVX2_H_
+
+#include <stdint.h>
+
+/*
+ * AVX2 versions of the inner loops of image_ops.c. They return the number
+ * of pixels they handled, the rest is left to the scalar versions.
+ */
+
+int imageNNRowAvx2(const int *in_row, const int *cols, int *out, int w_out);
+int imageLinearRowAvx2(const int *row0, const int *row1, const int *cols0,
+		const int *cols1, const int *fx, int fy, int *out, int w_out);
+// Adds factor rows of w pixels to sums, one channel per 16 bits
+int imageBoxSumAvx2(const int *in, int stride, int w, int factor, uint64_t *sums);
+int imageBlendAvx2(int *dst, const int *src, int n, int weight);
+
+#endif
@@ -0,0 +1,56 @@
+#include "kernel_registry.h"
+#include "mandelbrot_cpu.h"
+#include "config.h"
+
+#include <string.h>
+
+// Ordered from most to least preferred within each precision
+static const KernelInfo kernels[] = {
+#if ENABLE_AVX
+	{"avx2-fma", mandelbrotIntrinFma, PRECISION_FLOAT, 8, 4, {"avx2", "fma"}},
+	{"avx2", mandelbrotIntrin, PRECISION_FLOAT, 8, 1, {"avx2", NULL}},
+#endif
+	{"scalar", mandelbrot, PRECISION_FLOAT, 1, 1, {NULL, NULL}},
+#if ENABLE_AVX
+	{"avx2-fma-double", mandelbrotDoubleFma, PRECISION_DOUBLE, 4, 1, {"avx2", "fma"}},
+	{"avx2-double", mandelbrotDouble, PRECISION_DOUBLE, 4, 1, {"avx2", NULL}},
+	{"avx2-fma-dd", mandelbrotDDFma, PRECISION_DOUBLE_DOUBLE, 4, 1, {"avx2", "fma"}},
+	{"avx2-dd", mandelbrotDD, PRECISION_DOUBLE_DOUBLE, 4, 1, {"avx2", NULL}},
+	{"avx2-fixed", mandelbrotFixedAvx2, PRECISION_FIXED, 4, 1, {"avx2", NULL}},
+#endif
+	{"fixed", mandelbrotFixed, PRECISION_FIXED, 1, 1, {NULL, NULL}},
+};
+
+const KernelInfo *kernelRegistry(int *count) {
+	*count = sizeof(kernels) / sizeof(kernels[0]);
+	return kernels;
+}
+
+const KernelInfo *findKernel(const char *name) {
+	for(unsigned int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		if(strcmp(kernels[i].name, name) == 0)
+			return &kernels[i];
+	}
+	return NULL;
+}
+
+int kernelSupported(const KernelInfo *kernel, int no_simd) {
+	for(int i = 0; i < 2 && kernel->features[i] != NULL; i++) {
+		if(no_simd)
+			return 0;
+		// __builtin_cpu_supports only accepts string literals
+		if(strcmp(kernel->features[i], "avx2") == 0 && !__builtin_cpu_supports("avx2"))
+			return 0;
+		if(strcmp(kernel->features[i], "fma") == 0 && !__builtin_cpu_supports("fma"))
+			return 0;
+	}
+	return 1;
+}
+
+const KernelInfo *defaultKernel(KernelPrecision precision, int no_simd) {
+	for(unsigned int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		if(kernels[i].precision == precision && kernelSupported(&kernels[i], no_simd))
+			return &kernels[i];
+	}
+	return NULL;
+}
@@ -0,0 +1,37 @@
+#ifndef _KERNEL_REGISTRY_H_
+#define _KERNEL_REGISTRY_H_
+
+typedef enum {
+	PRECISION_FLOAT,
+	PRECISION_DOUBLE,
+	PRECISION_DOUBLE_DOUBLE,
+	PRECISION_FIXED // Bit-exact on every CPU, only used when asked for
+} KernelPrecision;
+
+typedef struct KernelInfo {
+	const char *name;
+	int (*fn)(void *args);
+	KernelPrecision precision;
+	int vector_width;        // Pixels per vector
+	int max_unroll;          // Highest number of vectors kept in flight
+	const char *features[2]; // CPU features the kernel needs, NULL terminated
+} KernelInfo;
+
+#define KERNEL_NAME_LENGTH 32
+
+// Everything that can be tuned about CPU rendering
+typedef struct CpuTuning {
+	char kernels[3][KERNEL_NAME_LENGTH]; // Indexed by KernelPrecision, except fixed
+	int nthreads;
+	int tile_size; // 0 uses TILE_SIZE
+	int unroll;
+} CpuTuning;
+
+const KernelInfo *kernelRegistry(int *count);
+const KernelInfo *findKernel(const char *name);
+int kernelSupported(const KernelInfo *kernel, int no_simd);
+
+// The fastest supported kernel of the given precision by static preference
+const KernelInfo *defaultKernel(KernelPrecision precision, int no_simd);
+
+#endif
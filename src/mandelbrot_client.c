@@ -0,0 +1,175 @@
+/*
+ * Small client of the render daemon (mandelbrot --daemon ADDRESS), mainly
+ * meant for testing it. Sends one or more render requests and stores the
+ * returned images.
+ */
+#include "daemon_protocol.h"
+#include "net.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void print_help() {
+	printf("Usage: mandelbrot-client ADDRESS [options]\n"
+	       "\n"
+	       "ADDRESS is the Unix socket path or host:port of the daemon\n"
+	       "\n"
+	       "Options:\n"
+	       "  --help        Show this help page\n"
+	       "  --rect X Y W H\n"
+	       "                Region of the complex plane to render\n"
+	       "  --size W H    Size of the image in pixels\n"
+	       "  --iters N     Maximum iterations\n"
+	       "  --exponent N  Exponent of the iterated function\n"
+	       "  --format raw|bmp\n"
+	       "                Format the daemon returns the image in\n"
+	       "  --priority P  Requests with higher priorities are rendered first\n"
+	       "  --count N     Send the same request N times at once\n"
+	       "  -o FILE       Store the first returned image in FILE\n");
+}
+
+static int read_line(int fd, char *line, int max) {
+	int len = 0;
+	while(len < max - 1) {
+		ssize_t got = recv(fd, line + len, 1, 0);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got <= 0)
+			return -1;
+		if(line[len] == '\n')
+			break;
+		len++;
+	}
+	line[len] = '\0';
+	return len;
+}
+
+static int read_all(int fd, char *data, int size) {
+	int done = 0;
+	while(done < size) {
+		ssize_t got = recv(fd, data + done, size - done, 0);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got <= 0)
+			return -1;
+		done += got;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	double x = -2.5, y = -1.125, w = 4.0, h = 2.25;
+	int width = 800, height = 450;
+	int iters = DEFAULT_ITERATIONS, exponent = DEFAULT_EXPONENT;
+	int priority = 0, count = 1;
+	const char *format = "bmp";
+	const char *out_path = NULL;
+
+	if(argc < 2 || strcmp(argv[1], "--help") == 0) {
+		print_help();
+		return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	const char *address = argv[1];
+
+	for(int i = 2; i < argc; i++) {
+		if(strcmp("--help", argv[i]) == 0) {
+			print_help();
+			return EXIT_SUCCESS;
+		} else if(strcmp("--rect", argv[i]) == 0 && i + 4 < argc) {
+			x = atof(argv[++i]);
+			y = atof(argv[++i]);
+			w = atof(argv[++i]);
+			h = atof(argv[++i]);
+		} else if(strcmp("--size", argv[i]) == 0 && i + 2 < argc) {
+			width = atoi(argv[++i]);
+			height = atoi(argv[++i]);
+		} else if(strcmp("--iters", argv[i]) == 0 && i + 1 < argc) {
+			iters = atoi(argv[++i]);
+		} else if(strcmp("--exponent", argv[i]) == 0 && i + 1 < argc) {
+			exponent = atoi(argv[++i]);
+		} else if(strcmp("--format", argv[i]) == 0 && i + 1 < argc) {
+			format = argv[++i];
+		} else if(strcmp("--priority", argv[i]) == 0 && i + 1 < argc) {
+			priority = atoi(argv[++i]);
+		} else if(strcmp("--count", argv[i]) == 0 && i + 1 < argc) {
+			count = atoi(argv[++i]);
+			if(count < 1)
+				count = 1;
+		} else if(strcmp("-o", argv[i]) == 0 && i + 1 < argc) {
+			out_path = argv[++i];
+		} else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	int fd = netConnect(address);
+	if(fd < 0) {
+		fprintf(stderr, "Could not connect to %s: %s\n", address, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	double start = now_ms();
+	char line[DAEMON_MAX_LINE];
+	for(int i = 0; i < count; i++) {
+		int len = snprintf(line, sizeof(line),
+				"RENDER %d %d %.17g %.17g %.17g %.17g 0 0 %d %d %d %d %s\n",
+				i, priority, x, y, w, h, width, height, iters, exponent, format);
+		if(send(fd, line, len, 0) != len) {
+			fprintf(stderr, "Could not send request: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	int status = EXIT_SUCCESS;
+	for(int i = 0; i < count; i++) {
+		if(read_line(fd, line, sizeof(line)) < 0) {
+			fprintf(stderr, "Connection closed by daemon\n");
+			return EXIT_FAILURE;
+		}
+
+		unsigned long id;
+		char got_format[8];
+		int got_w, got_h, size;
+		if(sscanf(line, "OK %lu %7s %d %d %d", &id, got_format, &got_w, &got_h, &size) != 5) {
+			fprintf(stderr, "%s\n", line);
+			status = EXIT_FAILURE;
+			continue;
+		}
+
+		char *data = (char *)malloc(size);
+		if(data == NULL || read_all(fd, data, size)) {
+			fprintf(stderr, "Could not receive image data\n");
+			return EXIT_FAILURE;
+		}
+		printf("Request %lu: %dx%d %s, %d bytes after %.2f ms\n",
+				id, got_w, got_h, got_format, size, now_ms() - start);
+
+		if(out_path != NULL) {
+			FILE *out = fopen(out_path, "wb");
+			if(out == NULL || fwrite(data, 1, size, out) != (size_t)size) {
+				fprintf(stderr, "Could not write %s\n", out_path);
+				status = EXIT_FAILURE;
+			}
+			if(out != NULL)
+				fclose(out);
+			out_path = NULL;
+		}
+		free(data);
+	}
+
+	close(fd);
+	return status;
+}
@@ -1,67 +1,86 @@
 #include "mandelbrot_common.h"
-#include "util.h"
 
-void scaleLIN(int w_in, int h_in, int w_out, int h_out, int *in_rgb,
-		int *out_rgb) {
-	float scale_x = (float)w_in / (float)w_out;
-	float scale_y = (float)h_in / (float)h_out;
+#include <math.h>
 
-	for(int out_y = 0; out_y < h_out; out_y++) {
-		float in_y = scale_y * (float)out_y;
-		for(int out_x = 0; out_x < w_out; out_x++) {
-			float in_x = scale_x * (float)out_x;
+void recordIterations(IterStats *stats, int iterations, int max_iters) {
+	stats->pixels++;
+	stats->iterations += iterations;
+	if(iterations >= max_iters)
+		stats->interior++;
+	else
+		stats->hist[(long)iterations * ITER_STATS_BUCKETS / max_iters]++;
+}
 
-			float px = in_x - (int)in_x;
-			float py = in_y - (int)in_y;
+void mergeIterStats(IterStats *into, const IterStats *stats) {
+	into->pixels += stats->pixels;
+	into->interior += stats->interior;
+	into->iterations += stats->iterations;
+	for(int i = 0; i < ITER_STATS_BUCKETS; i++)
+		into->hist[i] += stats->hist[i];
+}
 
-			int x = (int)in_x;
-			int y = (int)in_y;
+int tileCount(int pix_w, int pix_h, int tile_size) {
+	int tiles_x = (pix_w + tile_size - 1) / tile_size;
+	int tiles_y = (pix_h + tile_size - 1) / tile_size;
+	return tiles_x * tiles_y;
+}
 
-			float p00, p01, p10, p11;
-			p00 = px * py;
-			p01 = (1.0 - px) * py;
-			p10 = px * (1.0 - py);
-			p11 = (1.0 - px) * (1.0 - py);
+// Tiles are numbered row by row, tiles at the right and bottom edge may be smaller
+Tile tileAt(int index, int pix_w, int pix_h, int tile_size) {
+	int tiles_x = (pix_w + tile_size - 1) / tile_size;
+	Tile tile;
+	tile.x = (index % tiles_x) * tile_size;
+	tile.y = (index / tiles_x) * tile_size;
+	tile.w = pix_w - tile.x < tile_size ? pix_w - tile.x : tile_size;
+	tile.h = pix_h - tile.y < tile_size ? pix_h - tile.y : tile_size;
+	return tile;
+}
 
-			int color = 0;
-			color = blend(color, in_rgb[clamp(y, 0, h_in) * w_in +
-					clamp(x, 0, w_in)], p00);
-			color = blend(color, in_rgb[clamp(y, 0, h_in) * w_in +
-					clamp(x + 1, 0, w_in)], p01);
-			color = blend(color, in_rgb[clamp(y + 1, 0, h_in) * w_in +
-					clamp(x, 0, w_in)], p10);
-			color = blend(color, in_rgb[clamp(y + 1, 0, h_in) * w_in +
-					clamp(x + 1, 0, w_in)], p11);
+// Returns the part of rect that is covered by the given tile of a pix_w x pix_h image
+Rectangle tileRect(Rectangle rect, int pix_w, int pix_h, Tile tile) {
+	Rectangle r = rect;
+	moveRect(&r, (double)tile.x * rect.w / (double)pix_w,
+			(double)tile.y * rect.h / (double)pix_h);
+	r.w = (double)tile.w * rect.w / (double)pix_w;
+	r.h = (double)tile.h * rect.h / (double)pix_h;
+	return r;
+}
 
-			out_rgb[out_y * w_out + out_x] = 0xff000000 | color;
-		}
-	}
+Tile renderJobPart(const RenderJob *job) {
+	if(job->part.w > 0)
+		return job->part;
+	return (Tile){0, 0, job->width, job->height};
 }
 
-void scaleNN(int w_in, int h_in, int w_out, int h_out, int *in_rgb,
-		int *out_rgb) {
-	float scale_x = (float)w_in / (float)w_out;
-	float scale_y = (float)h_in / (float)h_out;
+// Adds d to the double-double number (*hi, *lo) without losing precision
+static void addDoubleDouble(double *hi, double *lo, double d) {
+	double s = *hi + d;
+	double bb = s - *hi;
+	double err = (*hi - (s - bb)) + (d - bb);
+	err += *lo;
+	*hi = s + err;
+	*lo = err - (*hi - s);
+}
 
-	for(int y = 0; y < h_out; y++) {
-		int in_y = round_simple(scale_y * (float)y);
-		for(int x = 0; x < w_out; x++) {
-			int in_x = round_simple(scale_x * (float)x);
-			out_rgb[y * w_out + x] = in_rgb[in_y * w_in + in_x];
-		}
-	}
+// Moves the rectangle, keeping its position exact even when the offset is
+// far below the precision of a double relative to the position
+void moveRect(Rectangle *rect, double dx, double dy) {
+	addDoubleDouble(&rect->x, &rect->x_lo, dx);
+	addDoubleDouble(&rect->y, &rect->y_lo, dy);
 }
 
-void scaleImage(int w_in, int h_in, int w_out, int h_out, int *in_rgb,
-		int *out_rgb, int interp_method) {
+// Returns the distance between pixels relative to the magnitude of the
+// coordinates, which is what limits the precision a kernel needs
+double pixelSpacing(Rectangle rect, int pix_w, int pix_h) {
+	double spacing_x = rect.w / (double)pix_w;
+	double spacing_y = rect.h / (double)pix_h;
+	double spacing = spacing_x < spacing_y ? spacing_x : spacing_y;
 
-	switch(interp_method) {
-		case INTERP_LINEAR:
-			scaleLIN(w_in, h_in, w_out, h_out, in_rgb, out_rgb);
-			break;
-		case INTERP_NN:
-			/* FALLTHRU */
-		default:
-			scaleNN(w_in, h_in, w_out, h_out, in_rgb, out_rgb);
-	}
+	double mag = fabs(rect.x) > fabs(rect.x + rect.w) ? fabs(rect.x) : fabs(rect.x + rect.w);
+	double mag_y = fabs(rect.y) > fabs(rect.y + rect.h) ? fabs(rect.y) : fabs(rect.y + rect.h);
+	if(mag_y > mag)
+		mag = mag_y;
+	if(mag < 1.0)
+		mag = 1.0;
+	return spacing / mag;
 }
@@ -1,6 +1,7 @@
 #ifndef _MANDELBROT_COMMON_H_
 #define _MANDELBROT_COMMON_H_
 
+// Interpolation methods of imageScale
 #define INTERP_NN 1
 #define INTERP_LINEAR 2
 
@@ -12,36 +13,104 @@ typedef struct {
 } MandelBuffer;
 
 typedef struct Rectangle {
-	float x;
-	float y;
-	float w;
-	float h;
+	double x;
+	double y;
+	double w;
+	double h;
+	// Low parts extending x and y to double-double precision for deep zooms.
+	// Always move rectangles with moveRect to keep them up to date.
+	double x_lo;
+	double y_lo;
 } Rectangle;
 
+// A rectangular region of pixels inside an image
+typedef struct Tile {
+	int x;
+	int y;
+	int w;
+	int h;
+} Tile;
+
+// A single image rendered outside of the interactive window
+typedef struct RenderJob {
+	Rectangle rect;
+	int width;
+	int height;
+	int iterations;
+	int exponent;
+	int tile_size;
+	// Only these pixels of the image are rendered when part.w is not zero.
+	// They are the same as in a render of the whole image, so an image can
+	// be put together from parts rendered anywhere.
+	Tile part;
+} RenderJob;
+
 typedef struct Vec2 {
-	float x;
-	float y;
+	double x;
+	double y;
 } Vec2;
 
+#define ITER_STATS_BUCKETS 64
+
+// Iteration counts of a rendered image. Escaped pixels are counted in
+// ITER_STATS_BUCKETS equally wide buckets from 0 to max_iters.
+typedef struct IterStats {
+	int max_iters;
+	int pixels;
+	int interior; // Pixels that didn't escape within max_iters
+	long iterations; // Sum over all pixels, interior ones count max_iters
+	int hist[ITER_STATS_BUCKETS];
+} IterStats;
+
+// A tile of the dynamic tile scheduler and the iterations it takes
+typedef struct ScheduledTile {
+	Tile tile;
+	long cost; // Predicted before rendering, measured afterwards if stats are collected
+} ScheduledTile;
+
 typedef struct MandelbrotArgs {
 	int pix_w;
 	int pix_h;
 	Rectangle rect;
 	float escape_rad;
 	int *out;
+	int stride; // Distance between two rows of out in pixels
 	int thread_idx;
 	int nthreads;
 	int max_iters;
 	int pow;
+	int unroll; // Number of independent vectors kernels may keep in flight
+	int (*kernel)(void *args); // Kernel that renders pixels, used by tiling wrappers
+	int tile_size;
+	int *next_tile; // Shared tile counter of the dynamic tile scheduler
+	int end_tile;   // Tiles are taken until the counter reaches end_tile
+	const int *tile_order; // Tile taken for each counter value, NULL for row by row
+	ScheduledTile *schedule; // Replaces the tile grid and tile_order when not NULL
+	// The pixels start at pixel (image_x, image_y) of an image_w x image_h
+	// image of image_rect. Tiling only moves that position, so kernels that
+	// compute coordinates from these see the same points however an image
+	// is split.
+	Rectangle image_rect;
+	int image_w;
+	int image_h;
+	int image_x;
+	int image_y;
+	int uniform_fill; // Tiles are tried with fillUniformTile before the kernel
+	IterStats *stats; // Of the worker, NULL when not collected
 } MandelbrotArgs;
 
 int iterationsToColor(int iterations);
 
-void scale_NN(int w_in, int h_in, int w_out, int h_out, int *in_rgb,
-		int *out_rgb);
-void scale_LIN(int w_in, int h_in, int w_out, int h_out, int *in_rgb,
-		int *out_rgb);
-void scaleImage(int w_in, int h_in, int w_out, int h_out, int *in_rgb,
-		int *out_rgb, int interp_method);
+void recordIterations(IterStats *stats, int iterations, int max_iters);
+void mergeIterStats(IterStats *into, const IterStats *stats);
+
+int tileCount(int pix_w, int pix_h, int tile_size);
+Tile tileAt(int index, int pix_w, int pix_h, int tile_size);
+Rectangle tileRect(Rectangle rect, int pix_w, int pix_h, Tile tile);
+// Pixels of its image the job renders
+Tile renderJobPart(const RenderJob *job);
+
+void moveRect(Rectangle *rect, double dx, double dy);
+double pixelSpacing(Rectangle rect, int pix_w, int pix_h);
 
 #endif
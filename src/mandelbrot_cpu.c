@@ -3,19 +3,61 @@
 #include "logger.h"
 
 #include "util.h"
-#include <SDL.h>
+#include "threadpool.h"
+#include "image_ops.h"
+#include "frame_arena.h"
+#include "kernel_registry.h"
+#include "tile_cost.h"
+#include "tile_interval.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-
-MandelBuffer mandelbuffer_cpu;
-int max_iterations_cpu = DEFAULT_ITERATIONS;
-int exponent_cpu = DEFAULT_EXPONENT;
-
-static int nthreads = 0;
-static SDL_Thread **threads;
-static SDL_ThreadFunction mandelbrot_function;
+#include <unistd.h>
+
+// In NUMA mode every worker renders its tiles into a buffer of its own.
+// The buffer is first touched by that worker, so its pages end up on the
+// memory node of the CPU the worker is pinned to.
+typedef struct NumaWorker {
+	MandelbrotArgs args;
+	int *data;
+	int alloc_size;
+} NumaWorker;
+
+struct CpuEngine {
+	MandelBuffer buffer; // Renders of anti-alias passes
+	int max_iterations;
+	int exponent;
+
+	int nthreads;
+	ThreadPool *pool;
+	int pinned;
+	int simd_disabled;
+	int numa_mode;
+	NumaWorker *numa_workers;
+
+	// Kernel used for each precision, NULL when not available
+	const KernelInfo *kernels[3];
+	// Replaces the float and double kernels when set
+	const KernelInfo *fixed_kernel;
+	const KernelInfo *last_kernel;
+	int tile_size;
+	int unroll;
+	int uniform_fill;
+
+	// Costs of the tiles of the last image, they order the tiles of the next one
+	CostMap cost_map;
+	ScheduledTile *schedule;
+	int schedule_alloc;
+
+	// Per worker, of the last image rendered with generateImageCpu(WH)
+	IterStats stats[MAX_CPU_THREADS];
+	int have_stats;
+
+	// Tiles of the image generateImageCpuFocus renders, nearest to the focus first
+	int *focus_order;
+	int focus_alloc;
+};
 
 void iterate(float x0, float y0, int pow, float *x, float *y) {
 	float retx = *x;
@@ -72,57 +114,201 @@ int iterationsToColorCpu(int iterations, int max_iters) {
 int mandelbrot(void *voidargs) {
 	MandelbrotArgs *args = (MandelbrotArgs *)voidargs;
 
-	for (int i = args->thread_idx; i < args->pix_w * args->pix_h; i += nthreads) {
-		float cx = (float)(i % args->pix_w);
-		float cy = (float)(i / args->pix_w);
-		cx = cx / (float)(args->pix_w) * args->rect.w + args->rect.x;
-		cy = cy / (float)(args->pix_h) * args->rect.h + args->rect.y;
+	for (int i = args->thread_idx; i < args->pix_w * args->pix_h; i += args->nthreads) {
+		int px = i % args->pix_w;
+		int py = i / args->pix_w;
+		float cx = (float)px / (float)(args->pix_w) * args->rect.w + args->rect.x;
+		float cy = (float)py / (float)(args->pix_h) * args->rect.h + args->rect.y;
 
 		int iters = getIterationsCpu(cx, cy, args->escape_rad, args->max_iters, args->pow);
 		int color = iterationsToColorCpu(iters, args->max_iters);
-		args->out[i] = 0xff000000 | color; // Write color with full alpha into output
+		if(args->stats != NULL)
+			recordIterations(args->stats, iters, args->max_iters);
+		// Write color with full alpha into output
+		args->out[py * args->stride + px] = 0xff000000 | color;
+	}
+	return 0;
+}
+
+// Renders one tile of the image described by args on the calling thread.
+// Returns nonzero if the interval pre-pass filled it without iterating pixels.
+static int renderTile(const MandelbrotArgs *args, Tile tile) {
+	MandelbrotArgs tile_args = *args;
+	tile_args.pix_w = tile.w;
+	tile_args.pix_h = tile.h;
+	tile_args.rect = tileRect(args->rect, args->pix_w, args->pix_h, tile);
+	tile_args.out = args->out + tile.y * args->stride + tile.x;
+	tile_args.image_x += tile.x;
+	tile_args.image_y += tile.y;
+	tile_args.thread_idx = 0;
+	tile_args.nthreads = 1;
+	if(args->uniform_fill && fillUniformTile(&tile_args))
+		return 1;
+	args->kernel(&tile_args);
+	return 0;
+}
+
+// Workers take the next tile from a shared counter until all tiles are done,
+// so fast workers pick up the work of slow ones
+int mandelbrotTiles(void *voidargs) {
+	MandelbrotArgs *args = (MandelbrotArgs *)voidargs;
+	int ntiles = tileCount(args->pix_w, args->pix_h, args->tile_size);
+
+	int end = args->end_tile < ntiles ? args->end_tile : ntiles;
+	if(args->schedule != NULL)
+		end = args->end_tile;
+
+	int t;
+	while((t = __atomic_fetch_add(args->next_tile, 1, __ATOMIC_RELAXED)) < end) {
+		if(args->schedule != NULL) {
+			// Every entry is written by the one worker taking it
+			ScheduledTile *entry = &args->schedule[t];
+			long before = args->stats != NULL ? args->stats->iterations : 0;
+			int filled = renderTile(args, entry->tile);
+			// Filled tiles count their iterations without doing them
+			if(args->stats != NULL)
+				entry->cost = (filled ? 0 : args->stats->iterations - before) +
+						entry->tile.w * entry->tile.h;
+			continue;
+		}
+		int tile = args->tile_order != NULL ? args->tile_order[t] : t;
+		renderTile(args, tileAt(tile, args->pix_w, args->pix_h, args->tile_size));
+	}
+	return 0;
+}
+
+// Renders the tiles thread_idx, thread_idx + nthreads, ... into the worker's
+// own buffer and gathers them into the output afterwards
+int mandelbrotNumaTiles(void *voidworker) {
+	NumaWorker *worker = (NumaWorker *)voidworker;
+	MandelbrotArgs *args = &worker->args;
+
+	int ntiles = tileCount(args->pix_w, args->pix_h, TILE_SIZE);
+	int owned = (ntiles - args->thread_idx + args->nthreads - 1) / args->nthreads;
+	int needed = owned * TILE_SIZE * TILE_SIZE;
+	if(worker->alloc_size < needed) {
+		frameFree(worker->data);
+		worker->data = frameAlloc(needed);
+		worker->alloc_size = worker->data != NULL ? needed : 0;
+	}
+
+	int *local = worker->data;
+	for(int t = args->thread_idx; t < ntiles; t += args->nthreads) {
+		Tile tile = tileAt(t, args->pix_w, args->pix_h, TILE_SIZE);
+		if(local == NULL) {
+			// Out of memory for the local buffer, render the tile in place
+			renderTile(args, tile);
+			continue;
+		}
+		MandelbrotArgs tile_args = *args;
+		tile_args.pix_w = tile.w;
+		tile_args.pix_h = tile.h;
+		tile_args.rect = tileRect(args->rect, args->pix_w, args->pix_h, tile);
+		tile_args.image_x += tile.x;
+		tile_args.image_y += tile.y;
+		tile_args.thread_idx = 0;
+		tile_args.nthreads = 1;
+		tile_args.out = local;
+		tile_args.stride = tile.w;
+		if(!args->uniform_fill || !fillUniformTile(&tile_args))
+			args->kernel(&tile_args);
+		local += tile.w * tile.h;
+	}
+
+	// Gather our tiles into the output
+	local = worker->data;
+	if(local == NULL)
+		return 0;
+	for(int t = args->thread_idx; t < ntiles; t += args->nthreads) {
+		Tile tile = tileAt(t, args->pix_w, args->pix_h, TILE_SIZE);
+		for(int row = 0; row < tile.h; row++) {
+			memcpy(args->out + (tile.y + row) * args->stride + tile.x,
+					local + row * tile.w, tile.w * sizeof(int));
+		}
+		local += tile.w * tile.h;
 	}
 	return 0;
 }
 
-void changeIterationsCpu(int diff) {
-	int new_iters = clamp(max_iterations_cpu + diff, 1, 5000);
+void changeIterationsCpu(CpuEngine *cpu, int diff) {
+	int new_iters = clamp(cpu->max_iterations + diff, 1, MAX_ITERATIONS);
 	mandelLog(INFO, "Changing Maximum Iterations to %d\n", new_iters);
-	max_iterations_cpu = new_iters;
+	cpu->max_iterations = new_iters;
+	// Costs measured with other iterations don't predict the next image
+	costMapInvalidate(&cpu->cost_map);
 }
 
-void changeExponentCpu(int diff) {
-	int new_exponent = clamp(exponent_cpu + diff, 1, 200);
+void changeExponentCpu(CpuEngine *cpu, int diff) {
+	int new_exponent = clamp(cpu->exponent + diff, 1, MAX_EXPONENT);
 	mandelLog(INFO, "Changing Exponent to %d\n", new_exponent);
-	exponent_cpu = new_exponent;
+	cpu->exponent = new_exponent;
+	// The last image of another exponent says nothing about the next one
+	costMapInvalidate(&cpu->cost_map);
 }
 
-int mandelbrotCpuInit(int w, int h, int no_simd) {
+CpuEngine *mandelbrotCpuCreate(int w, int h, int no_simd, const CpuThreadConfig *threading) {
 	mandelLog(VERBOSE, "Starting CPU Mandelbrot Engine...\n");
-	int *img_data = (int *)malloc(w * h * sizeof(int));
-	if(img_data == NULL) {
+	const int *cpus = threading->cpus;
+	int ncpus = threading->ncpus;
+	int *default_cpus = NULL;
+
+	CpuEngine *cpu = (CpuEngine *)calloc(1, sizeof(CpuEngine));
+	if(cpu == NULL) {
+		mandelLog(ERROR, "Could not allocate engine!\n");
+		return NULL;
+	}
+	cpu->max_iterations = DEFAULT_ITERATIONS;
+	cpu->exponent = DEFAULT_EXPONENT;
+
+	if(mandelBufferResize(&cpu->buffer, w, h)) {
 		mandelLog(ERROR, "Could not allocate rgb buffer!\n");
 		goto error;
 	}
-	mandelbuffer_cpu = (MandelBuffer){w, h, w*h, img_data};
 
-	nthreads = SDL_GetCPUCount();
+	cpu->nthreads = threading->nthreads;
+	if(cpu->nthreads == 0)
+		cpu->nthreads = cpus != NULL ? ncpus : (int)sysconf(_SC_NPROCESSORS_ONLN);
 
-	if(nthreads < 1 || nthreads > 256) {
+	if(cpu->nthreads < 1 || cpu->nthreads > MAX_CPU_THREADS) {
 		mandelLog(WARN, "Could not determine CPU core count. "
 		          "Using a default of 8 threads.\n");
-		nthreads = 8;
+		cpu->nthreads = 8;
+	}
+
+	cpu->numa_mode = threading->numa;
+	if(cpu->numa_mode) {
+		cpu->numa_workers = (NumaWorker *)calloc(cpu->nthreads, sizeof(NumaWorker));
+		if(cpu->numa_workers == NULL) {
+			mandelLog(ERROR, "Could not allocate thread data!\n");
+			goto error;
+		}
+		// First touch placement only works when workers don't migrate
+		if(cpus == NULL) {
+			default_cpus = (int *)malloc(cpu->nthreads * sizeof(int));
+			if(default_cpus == NULL) {
+				mandelLog(ERROR, "Could not allocate thread data!\n");
+				goto error;
+			}
+			for(int i = 0; i < cpu->nthreads; i++)
+				default_cpus[i] = i;
+			cpus = default_cpus;
+			ncpus = cpu->nthreads;
+		}
+		mandelLog(VERBOSE, "NUMA mode: workers render into their own %dx%d tiles.\n",
+				TILE_SIZE, TILE_SIZE);
 	}
-	mandelLog(VERBOSE, "Rendering with %d threads.\n", nthreads);
+	mandelLog(VERBOSE, "Rendering with %d threads%s.\n", cpu->nthreads,
+			cpus != NULL ? " pinned to CPUs" : "");
 
-	threads = (SDL_Thread **)malloc(nthreads * sizeof(SDL_Thread *));
+	cpu->pool = threadPoolCreate(cpu->nthreads, cpus, ncpus);
+	cpu->pinned = cpus != NULL;
+	free(default_cpus);
 
-	if(threads == NULL) {
-		mandelLog(ERROR, "Could not allocate thread data!\n");
+	if(cpu->pool == NULL) {
+		mandelLog(ERROR, "Could not create worker threads!\n");
 		goto error;
 	}
 
-	mandelbrot_function = mandelbrot;
 #if ENABLE_AVX
 	if(__builtin_cpu_supports("avx2")) {
 		if(no_simd) {
@@ -130,133 +316,582 @@ int mandelbrotCpuInit(int w, int h, int no_simd) {
 		} else {
 			mandelLog(VERBOSE, "CPU supports AVX2. Using SIMD instructions to speed up rendering.\n");
 			mandelLog(VERBOSE, "To not use SIMD instructions specify the --no-simd command line flag.\n");
-			mandelbrot_function = mandelbrotIntrin;
 		}
 	} else {
 		mandelLog(VERBOSE, "CPU does not support AVX2. Not using SIMD instructions.\n");
 	}
 #endif
-
-	return 0;
+	cpu->simd_disabled = no_simd;
+	cpu->kernels[PRECISION_FLOAT] = defaultKernel(PRECISION_FLOAT, no_simd);
+	cpu->kernels[PRECISION_DOUBLE] = defaultKernel(PRECISION_DOUBLE, no_simd);
+	cpu->kernels[PRECISION_DOUBLE_DOUBLE] = defaultKernel(PRECISION_DOUBLE_DOUBLE, no_simd);
+	cpu->tile_size = 0;
+	cpu->unroll = DEFAULT_UNROLL;
+	cpu->uniform_fill = 1;
+
+	return cpu;
 error:
-	if(img_data != NULL)
-		free(img_data);
-	if(threads != NULL)
-		free(threads);
-	return -1;
+	mandelBufferFree(&cpu->buffer);
+	free(cpu->numa_workers);
+	free(cpu);
+	return NULL;
 }
 
-int resizeFramebufferCpu(int new_w, int new_h) {
-	mandelbuffer_cpu.rgb_data = (int *)realloc(mandelbuffer_cpu.rgb_data, new_w * new_h * sizeof(int));
-	if(mandelbuffer_cpu.rgb_data == NULL) {
+int resizeFramebufferCpu(CpuEngine *cpu, int new_w, int new_h) {
+	if(mandelBufferResize(&cpu->buffer, new_w, new_h)) {
 		mandelLog(ERROR, "Could not allocate rgb buffer!\n");
 		return -1;
 	}
-	mandelbuffer_cpu.w = new_w;
-	mandelbuffer_cpu.h = new_h;
 	return 0;
 }
 
-void mandelbrotCpuCleanup() {
+void mandelbrotCpuDestroy(CpuEngine *cpu) {
+	if(cpu == NULL)
+		return;
 	mandelLog(VERBOSE, "Cleaning up CPU Mandelbrot Engine...\n");
-	free(mandelbuffer_cpu.rgb_data);
-	free(threads);
+	threadPoolDestroy(cpu->pool);
+	mandelBufferFree(&cpu->buffer);
+	free(cpu->focus_order);
+	free(cpu->schedule);
+	costMapFree(&cpu->cost_map);
+	if(cpu->numa_workers != NULL) {
+		for(int i = 0; i < cpu->nthreads; i++)
+			frameFree(cpu->numa_workers[i].data);
+		free(cpu->numa_workers);
+	}
+	free(cpu);
+}
+
+void mandelbrotCpuSetUniformFill(CpuEngine *cpu, int enabled) {
+	cpu->uniform_fill = enabled;
 }
 
-void generateImageCpu(Rectangle coord_rect, int *out_argb) {
-	int SCALEDOWN = 1; // Optionally render in lower resolution on first pass
-	int scl_w = mandelbuffer_cpu.w / SCALEDOWN;
-	int scl_h = mandelbuffer_cpu.h / SCALEDOWN;
-	int *out_ptr = malloc(scl_w * scl_h * sizeof(int));
+ThreadPool *mandelbrotCpuPool(CpuEngine *cpu) {
+	return cpu->pool;
+}
 
-	MandelbrotArgs *args_list = (MandelbrotArgs *)malloc(nthreads * sizeof(MandelbrotArgs));
-	if(args_list == NULL) {
-		mandelLog(ERROR, "Could not create Argslist: %s\n", SDL_GetError());
-		return;
+void mandelbrotCpuGetTuning(CpuEngine *cpu, CpuTuning *tuning) {
+	memset(tuning, 0, sizeof(CpuTuning));
+	for(int p = 0; p < 3; p++) {
+		if(cpu->kernels[p] != NULL)
+			strncpy(tuning->kernels[p], cpu->kernels[p]->name, KERNEL_NAME_LENGTH - 1);
+	}
+	tuning->nthreads = cpu->nthreads;
+	tuning->tile_size = cpu->tile_size;
+	tuning->unroll = cpu->unroll;
+}
+
+// Applies every valid part of the tuning, invalid parts are ignored
+int mandelbrotCpuApplyTuning(CpuEngine *cpu, const CpuTuning *tuning) {
+	for(int p = 0; p < 3; p++) {
+		const KernelInfo *kernel = findKernel(tuning->kernels[p]);
+		if(kernel != NULL && kernel->precision == (KernelPrecision)p &&
+				kernelSupported(kernel, cpu->simd_disabled))
+			cpu->kernels[p] = kernel;
 	}
 
-	int i;
-	for(i = 0; i < nthreads; i++) {
-		args_list[i].pix_w = scl_w;
-		args_list[i].pix_h = scl_h;
-		args_list[i].rect = coord_rect;
-		args_list[i].escape_rad = ESCAPE_RADIUS;
-		args_list[i].max_iters = max_iterations_cpu;
-		args_list[i].pow = exponent_cpu;
-		args_list[i].out = out_ptr;
-		args_list[i].thread_idx = i;
-		args_list[i].nthreads = nthreads;
-		threads[i] = SDL_CreateThread(mandelbrot_function, "WorkerThread", args_list + i);
-		if(threads[i] == NULL) {
-			mandelLog(ERROR, "Could not create SDL_Thread: %s\n", SDL_GetError());
-			return;
+	// Workers of pinned and NUMA pools are placed explicitly, so keep them
+	if(tuning->nthreads != cpu->nthreads && tuning->nthreads >= 1 &&
+			tuning->nthreads <= MAX_CPU_THREADS && !cpu->pinned && !cpu->numa_mode) {
+		ThreadPool *new_pool = threadPoolCreate(tuning->nthreads, NULL, 0);
+		if(new_pool == NULL) {
+			mandelLog(ERROR, "Could not create worker threads!\n");
+			return -1;
 		}
+		threadPoolDestroy(cpu->pool);
+		cpu->pool = new_pool;
+		cpu->nthreads = tuning->nthreads;
+	}
+
+	if(tuning->tile_size >= 0)
+		cpu->tile_size = tuning->tile_size;
+	if(tuning->unroll >= 1)
+		cpu->unroll = tuning->unroll;
+	return 0;
+}
+
+// Picks the fastest kernel that still resolves the pixel spacing of the view
+static const KernelInfo *pickKernel(CpuEngine *cpu, Rectangle coord_rect, int w, int h) {
+	const KernelInfo *kernel = cpu->kernels[PRECISION_FLOAT];
+
+	double spacing = pixelSpacing(coord_rect, w, h);
+	if(cpu->fixed_kernel != NULL) {
+		kernel = cpu->fixed_kernel;
+		if(spacing < FIXED_SPACING_LIMIT && cpu->kernels[PRECISION_DOUBLE_DOUBLE] != NULL)
+			kernel = cpu->kernels[PRECISION_DOUBLE_DOUBLE];
+	} else if(spacing < FLOAT_SPACING_LIMIT && cpu->kernels[PRECISION_DOUBLE] != NULL) {
+		kernel = cpu->kernels[PRECISION_DOUBLE];
+		if(spacing < DOUBLE_SPACING_LIMIT && cpu->kernels[PRECISION_DOUBLE_DOUBLE] != NULL)
+			kernel = cpu->kernels[PRECISION_DOUBLE_DOUBLE];
 	}
-	for(i = 0; i < nthreads; i++) {
-		mandelLog(DEBUG, "Waiting for Thread %d\n", i);
-		SDL_WaitThread(threads[i], NULL);
+
+	if(kernel != cpu->last_kernel) {
+		mandelLog(VERBOSE, "Switching to %s kernel (pixel spacing %g)\n",
+				kernel->name, spacing);
+		cpu->last_kernel = kernel;
 	}
+	return kernel;
+}
+
+// Fills in the arguments every worker gets for rendering the pixels of band
+// of a w x h image of coord_rect into out_argb. The kernel is picked for the
+// whole image, so all parts of it are rendered alike.
+static void setupArgs(CpuEngine *cpu, MandelbrotArgs *args, int w, int h,
+		Rectangle coord_rect, Tile band, int iterations, int exponent, int *out_argb) {
+	const KernelInfo *kernel = pickKernel(cpu, coord_rect, w, h);
+	args->pix_w = band.w;
+	args->pix_h = band.h;
+	args->rect = tileRect(coord_rect, w, h, band);
+	args->image_rect = coord_rect;
+	args->image_w = w;
+	args->image_h = h;
+	args->image_x = band.x;
+	args->image_y = band.y;
+	args->escape_rad = ESCAPE_RADIUS;
+	args->max_iters = iterations;
+	args->pow = exponent;
+	args->out = out_argb;
+	args->stride = band.w;
+	args->thread_idx = 0;
+	args->nthreads = 1;
+	args->unroll = cpu->unroll < kernel->max_unroll ? cpu->unroll : kernel->max_unroll;
+	args->kernel = kernel->fn;
+	// Without a tuned size the default tiles still get the uniform tile pre-pass
+	args->tile_size = cpu->tile_size > 0 ? cpu->tile_size : TILE_SIZE;
+	args->next_tile = NULL;
+	args->end_tile = tileCount(band.w, band.h, args->tile_size);
+	args->tile_order = NULL;
+	args->schedule = NULL;
+	args->uniform_fill = cpu->uniform_fill;
+	args->stats = NULL;
+}
 
-	// Scale half res image to be full size
-	for(int y = 0; y < mandelbuffer_cpu.h; y++) {
-		for(int x = 0; x < mandelbuffer_cpu.w; x++) {
-			out_argb[y * mandelbuffer_cpu.w + x] = out_ptr[y / SCALEDOWN * scl_w + x / SCALEDOWN];
+// Renders a deep view once in one piece and once in odd tiles with the
+// fixed point kernel. Bit-exact output must not depend on the tiling.
+// Returns nonzero if both match, -1 if there was no memory for the check.
+static int checkFixedTiling(CpuEngine *cpu) {
+	const int w = 96, h = 54, tile_size = 40;
+	Rectangle rect = {-0.7436438870371587, -0.1318259042053119, 3.3e-9, 3.3e-9 * h / w, 0.0, 0.0};
+	Tile whole = {0, 0, w, h};
+	int *untiled = (int *)malloc(2 * w * h * sizeof(int));
+	if(untiled == NULL)
+		return -1;
+	int *tiled = untiled + w * h;
+
+	MandelbrotArgs args;
+	setupArgs(cpu, &args, w, h, rect, whole, 256, 2, untiled);
+	args.kernel(&args);
+
+	args.out = tiled;
+	args.tile_size = tile_size;
+	for(int t = 0; t < tileCount(w, h, tile_size); t++)
+		renderTile(&args, tileAt(t, w, h, tile_size));
+
+	int same = memcmp(untiled, tiled, w * h * sizeof(int)) == 0;
+	free(untiled);
+	return same;
+}
+
+void mandelbrotCpuSetFixedPoint(CpuEngine *cpu, int enabled) {
+	cpu->fixed_kernel = enabled ? defaultKernel(PRECISION_FIXED, cpu->simd_disabled) : NULL;
+	if(!enabled)
+		return;
+	mandelLog(VERBOSE, "Rendering bit-exact with the %s kernel\n", cpu->fixed_kernel->name);
+	int same = checkFixedTiling(cpu);
+	if(same == 0)
+		mandelLog(WARN, "Tiled renders of the %s kernel differ from untiled ones!\n",
+				cpu->fixed_kernel->name);
+	else if(same > 0)
+		mandelLog(DEBUG, "Tiled and untiled renders of the %s kernel match\n",
+				cpu->fixed_kernel->name);
+}
+
+// Sets up the arguments of every worker from those of the first one.
+// With collect_stats set the workers count iterations into cpu->stats,
+// which start over if reset_stats is set.
+static void workerArgs(CpuEngine *cpu, MandelbrotArgs *args_list, int collect_stats,
+		int reset_stats) {
+	args_list[0].nthreads = cpu->nthreads;
+	for(int i = 0; i < cpu->nthreads; i++) {
+		args_list[i] = args_list[0];
+		args_list[i].thread_idx = i;
+		if(collect_stats) {
+			if(reset_stats) {
+				memset(&cpu->stats[i], 0, sizeof(IterStats));
+				cpu->stats[i].max_iters = cpu->max_iterations;
+			}
+			args_list[i].stats = &cpu->stats[i];
 		}
 	}
-	free(out_ptr);
-	free(args_list);
+	if(reset_stats)
+		cpu->have_stats = collect_stats;
 }
 
-void generateImageCpuWH(int w, int h, Rectangle coord_rect, int *out_argb) {
-	if(w < 1 || h < 1 || out_argb == NULL)
+// Renders band of a w x h image of coord_rect into out_argb on all workers.
+// With collect_stats set the workers count iterations into cpu->stats.
+static void renderCpuDirect(CpuEngine *cpu, int w, int h, Rectangle coord_rect, Tile band,
+		int *out_argb, int collect_stats) {
+	MandelbrotArgs args_list[MAX_CPU_THREADS];
+	int next_tile = 0;
+
+	setupArgs(cpu, &args_list[0], w, h, coord_rect, band,
+			cpu->max_iterations, cpu->exponent, out_argb);
+	args_list[0].next_tile = &next_tile;
+	workerArgs(cpu, args_list, collect_stats, 1);
+
+	if(cpu->numa_mode) {
+		for(int i = 0; i < cpu->nthreads; i++)
+			cpu->numa_workers[i].args = args_list[i];
+		threadPoolRun(cpu->pool, mandelbrotNumaTiles, cpu->numa_workers, sizeof(NumaWorker));
 		return;
+	}
 
-	MandelbrotArgs *args_list = (MandelbrotArgs *)malloc(nthreads * sizeof(MandelbrotArgs));
-	if(args_list == NULL) {
-		mandelLog(ERROR, "Could not create Argslist: %s\n", SDL_GetError());
+	const MandelbrotArgs *args = &args_list[0];
+	// setupArgs just picked the kernel
+	int count = costSchedule(&cpu->cost_map, args->rect, band.w, band.h, args->tile_size,
+			cpu->last_kernel->vector_width, cpu->nthreads, &cpu->schedule, &cpu->schedule_alloc);
+	if(count < 0) {
+		mandelLog(WARN, "Could not allocate memory for the tile schedule\n");
+		threadPoolRun(cpu->pool, mandelbrotTiles, args_list, sizeof(MandelbrotArgs));
 		return;
 	}
+	for(int i = 0; i < cpu->nthreads; i++) {
+		args_list[i].schedule = cpu->schedule;
+		args_list[i].end_tile = count;
+	}
+	threadPoolRun(cpu->pool, mandelbrotTiles, args_list, sizeof(MandelbrotArgs));
 
-	int i;
-	for(i = 0; i < nthreads; i++) {
-		args_list[i].pix_w = w;
-		args_list[i].pix_h = h;
-		args_list[i].rect = coord_rect;
-		args_list[i].escape_rad = ESCAPE_RADIUS;
-		args_list[i].max_iters = max_iterations_cpu;
-		args_list[i].pow = exponent_cpu;
-		args_list[i].out = out_argb;
-		args_list[i].thread_idx = i;
-		args_list[i].nthreads = nthreads;
-		threads[i] = SDL_CreateThread(mandelbrot_function, "WorkerThread", args_list + i);
-		if(threads[i] == NULL) {
-			mandelLog(ERROR, "Could not create SDL_Thread: %s\n", SDL_GetError());
-			return;
+	// Costs are only measured along with the iteration counts
+	if(collect_stats && costMapUpdate(&cpu->cost_map, args->rect, band.w, band.h,
+			cpu->schedule, count))
+		mandelLog(WARN, "Could not allocate memory for the tile costs\n");
+}
+
+// Rows of a part of an image that have to be rendered, the others mirror them
+typedef struct MirrorPlan {
+	Tile band;       // Rendered pixels, in rows and columns of the whole image
+	Rectangle image; // Whole image on the grid the band is rendered on
+	int sum;         // Row j mirrors row sum - j
+	int first;       // Mirrored rows are [first, last], none when first > last
+	int last;
+} MirrorPlan;
+
+/*
+ * The set is symmetric to the real axis for every exponent, so when the view
+ * overlaps the real axis the rows on one side are mirror images of rows on
+ * the other side.
+ * Row j lies at y + j * dy and mirrors row k when j + k = -2y / dy.
+ * That sum is snapped to an integer by moving the sample grid by at most a
+ * quarter pixel, so mirrored rows line up exactly. Whether the grid is
+ * snapped only depends on the whole image, so every part of it is rendered
+ * on the same grid. Of the part, only a contiguous band containing the
+ * larger half and the non-mirrored rest is rendered.
+ */
+static void planMirror(const CpuEngine *cpu, int h, Rectangle coord_rect, Tile part,
+		MirrorPlan *plan) {
+	plan->band = part;
+	plan->image = coord_rect;
+	plan->sum = 0;
+	plan->first = 1;
+	plan->last = 0;
+
+	// Fixed point shifts round toward minus infinity, so a row and its mirror
+	// image don't come out exactly alike. Bit-exact renders compute every row.
+	if(cpu->fixed_kernel != NULL)
+		return;
+
+	double dy = coord_rect.h / (double)h;
+	double mirror_sum = -2.0 * (coord_rect.y + coord_rect.y_lo) / dy;
+	if(!(dy > 0.0) || mirror_sum < 0.0 || mirror_sum > 2.0 * (h - 1))
+		return;
+
+	int sum = (int)floor(mirror_sum + 0.5);
+	int first = sum - (h - 1) > 0 ? sum - (h - 1) : 0;
+	int last = sum < h - 1 ? sum : h - 1;
+	if(last - first + 1 < MIN_MIRRORED_ROWS)
+		return;
+
+	// Snap the grid so that row sum / 2 lies exactly on the real axis
+	Rectangle snapped = coord_rect;
+	snapped.y = -(double)sum * dy / 2.0;
+	snapped.y_lo = 0.0;
+	plan->image = snapped;
+
+	// Only rows whose mirror image is in the part as well are copied
+	int top = part.y;
+	int bottom = part.y + part.h - 1;
+	first = sum - bottom > top ? sum - bottom : top;
+	last = sum - top < bottom ? sum - top : bottom;
+	if(last - first + 1 < MIN_MIRRORED_ROWS)
+		return;
+
+	// The band holds the non-mirrored rows and one half of the mirrored rows
+	if(first > top) {
+		plan->band.y = top;
+		plan->band.h = sum / 2 + 1 - top;
+	} else {
+		plan->band.y = (sum + 1) / 2;
+		plan->band.h = bottom + 1 - plan->band.y;
+	}
+	plan->sum = sum;
+	plan->first = first;
+	plan->last = last;
+}
+
+// Copies the mirrored rows once the band is rendered. out_argb holds the
+// pixels of part.
+static void applyMirror(const MirrorPlan *plan, Tile part, int *out_argb) {
+	for(int row = plan->first; row <= plan->last; row++) {
+		if(row >= plan->band.y && row < plan->band.y + plan->band.h)
+			continue;
+		memcpy(out_argb + (row - part.y) * part.w,
+				out_argb + (plan->sum - row - part.y) * part.w, part.w * sizeof(int));
+	}
+}
+
+static void renderCpu(CpuEngine *cpu, int w, int h, Rectangle coord_rect, int *out_argb,
+		int collect_stats) {
+	Tile whole = {0, 0, w, h};
+	MirrorPlan plan;
+	planMirror(cpu, h, coord_rect, whole, &plan);
+	renderCpuDirect(cpu, w, h, plan.image, plan.band, out_argb + plan.band.y * w, collect_stats);
+	applyMirror(&plan, whole, out_argb);
+}
+
+void generateImageCpu(CpuEngine *cpu, Rectangle coord_rect, int *out_argb) {
+	if(out_argb == NULL)
+		return;
+
+	renderCpu(cpu, cpu->buffer.w, cpu->buffer.h, coord_rect, out_argb, 1);
+}
+
+void generateImageCpuWH(CpuEngine *cpu, int w, int h, Rectangle coord_rect, int *out_argb) {
+	if(w < 1 || h < 1 || out_argb == NULL)
+		return;
+
+	renderCpu(cpu, w, h, coord_rect, out_argb, 1);
+}
+
+typedef struct TileDistance {
+	long distance;
+	int index;
+} TileDistance;
+
+static int compareTileDistance(const void *a, const void *b) {
+	const TileDistance *x = (const TileDistance *)a, *y = (const TileDistance *)b;
+	if(x->distance != y->distance)
+		return x->distance < y->distance ? -1 : 1;
+	return x->index - y->index;
+}
+
+// Sorts the tiles of a w x h image by the distance of their centers to the focus
+static int orderTiles(CpuEngine *cpu, int w, int h, int tile_size, int focus_x, int focus_y) {
+	int ntiles = tileCount(w, h, tile_size);
+	if(cpu->focus_alloc < ntiles) {
+		int *order = (int *)realloc(cpu->focus_order, ntiles * sizeof(int));
+		if(order == NULL)
+			return -1;
+		cpu->focus_order = order;
+		cpu->focus_alloc = ntiles;
+	}
+	TileDistance *tiles = (TileDistance *)malloc(ntiles * sizeof(TileDistance));
+	if(tiles == NULL)
+		return -1;
+
+	for(int t = 0; t < ntiles; t++) {
+		Tile tile = tileAt(t, w, h, tile_size);
+		long dx = tile.x + tile.w / 2 - focus_x;
+		long dy = tile.y + tile.h / 2 - focus_y;
+		tiles[t].distance = dx * dx + dy * dy;
+		tiles[t].index = t;
+	}
+	qsort(tiles, ntiles, sizeof(TileDistance), compareTileDistance);
+	for(int t = 0; t < ntiles; t++)
+		cpu->focus_order[t] = tiles[t].index;
+	free(tiles);
+	return 0;
+}
+
+int generateImageCpuFocus(CpuEngine *cpu, int w, int h, Rectangle coord_rect, int *out_argb,
+		int focus_x, int focus_y, int part, int max_pixels, Tile *changed) {
+	*changed = (Tile){0, 0, 0, 0};
+	if(w < 1 || h < 1 || out_argb == NULL)
+		return 0;
+
+	Tile whole = {0, 0, w, h};
+	MirrorPlan plan;
+	planMirror(cpu, h, coord_rect, whole, &plan);
+	// Rows without tiles don't have an order, so render in tiles either way
+	int tile_size = cpu->tile_size > 0 ? cpu->tile_size : TILE_SIZE;
+	int ntiles = tileCount(w, plan.band.h, tile_size);
+
+	if(part == 0) {
+		// A focus on the mirrored rows is rendered through the rows they mirror
+		focus_y = clamp(focus_y, 0, h - 1);
+		if(focus_y >= plan.first && focus_y <= plan.last &&
+				(focus_y < plan.band.y || focus_y >= plan.band.y + plan.band.h))
+			focus_y = plan.sum - focus_y;
+		if(orderTiles(cpu, w, plan.band.h, tile_size, clamp(focus_x, 0, w - 1),
+				focus_y - plan.band.y)) {
+			mandelLog(WARN, "Could not allocate memory for the tile order\n");
+			renderCpu(cpu, w, h, coord_rect, out_argb, 1);
+			*changed = whole;
+			return 0;
 		}
 	}
-	for(i = 0; i < nthreads; i++) {
-		mandelLog(DEBUG, "Waiting for Thread %d\n", i);
-		SDL_WaitThread(threads[i], NULL);
+	if(part < 0 || part >= ntiles)
+		return 0;
+
+	// At least one tile per worker, so none of them idles
+	int count = max_pixels / (tile_size * tile_size);
+	if(count < cpu->nthreads)
+		count = cpu->nthreads;
+	int next_tile = part;
+	int end = part + count < ntiles ? part + count : ntiles;
+
+	MandelbrotArgs args_list[MAX_CPU_THREADS];
+	setupArgs(cpu, &args_list[0], w, h, plan.image, plan.band,
+			cpu->max_iterations, cpu->exponent, out_argb + plan.band.y * w);
+	args_list[0].tile_size = tile_size;
+	args_list[0].next_tile = &next_tile;
+	args_list[0].end_tile = end;
+	args_list[0].tile_order = cpu->focus_order;
+	workerArgs(cpu, args_list, 1, part == 0);
+	// NUMA workers own fixed tiles, here the order matters more
+	threadPoolRun(cpu->pool, mandelbrotTiles, args_list, sizeof(MandelbrotArgs));
+
+	int left = w, right = 0, top = h, bottom = 0;
+	for(int t = part; t < end; t++) {
+		Tile tile = tileAt(cpu->focus_order[t], w, plan.band.h, tile_size);
+		tile.y += plan.band.y;
+		left = tile.x < left ? tile.x : left;
+		right = tile.x + tile.w > right ? tile.x + tile.w : right;
+		top = tile.y < top ? tile.y : top;
+		bottom = tile.y + tile.h > bottom ? tile.y + tile.h : bottom;
+	}
+
+	// Only the mirror images of the rendered box are copied, so nothing
+	// outside of the box and its mirror image changes. Every part of the
+	// band is in some box, so the image is complete after the last part.
+	int changed_top = top, changed_bottom = bottom;
+	for(int row = plan.first; row <= plan.last && left < right; row++) {
+		int source = plan.sum - row;
+		if((row >= plan.band.y && row < plan.band.y + plan.band.h) ||
+				source < top || source >= bottom)
+			continue;
+		memcpy(out_argb + row * w + left, out_argb + source * w + left,
+				(right - left) * sizeof(int));
+		changed_top = row < changed_top ? row : changed_top;
+		changed_bottom = row + 1 > changed_bottom ? row + 1 : changed_bottom;
 	}
+	if(left < right)
+		*changed = (Tile){left, changed_top, right - left, changed_bottom - changed_top};
+	return end < ntiles ? end : 0;
+}
 
-	free(args_list);
+int getIterStatsCpu(CpuEngine *cpu, IterStats *stats) {
+	if(!cpu->have_stats)
+		return -1;
+	*stats = cpu->stats[0];
+	for(int i = 1; i < cpu->nthreads; i++)
+		mergeIterStats(stats, &cpu->stats[i]);
+	return 0;
+}
+
+// One image of a batch
+typedef struct BatchImage {
+	MandelbrotArgs args; // Describes the rendered band of the image
+	MirrorPlan mirror;
+	int first_tile; // Index of the first tile of the image in the batch
+} BatchImage;
+
+typedef struct Batch {
+	BatchImage *images;
+	int nimages;
+	int ntiles;
+	int tile_size;
+	int next_tile;
+} Batch;
+
+// Like mandelbrotTiles, but the tiles of all images share one counter
+static int mandelbrotBatchTiles(void *voidbatch) {
+	Batch *batch = (Batch *)voidbatch;
+	int image = 0;
+
+	int t;
+	while((t = __atomic_fetch_add(&batch->next_tile, 1, __ATOMIC_RELAXED)) < batch->ntiles) {
+		// Tiles are handed out in order, so the image only ever moves forward
+		while(image + 1 < batch->nimages && t >= batch->images[image + 1].first_tile)
+			image++;
+		const MandelbrotArgs *args = &batch->images[image].args;
+		renderTile(args, tileAt(t - batch->images[image].first_tile,
+				args->pix_w, args->pix_h, batch->tile_size));
+	}
+	return 0;
 }
 
-Vec2 calculateShift(Rectangle coord_rect, int aa_counter) {
-	float shift_amount_x, shift_amount_y;
-	float shift_x = 0;
-	float shift_y = 0;
+int renderBatchCpu(CpuEngine *cpu, const RenderJob *jobs, int *const *outs, int njobs) {
+	if(njobs < 1)
+		return 0;
+	Batch batch;
+	batch.images = (BatchImage *)malloc(njobs * sizeof(BatchImage));
+	if(batch.images == NULL) {
+		mandelLog(ERROR, "Could not allocate memory for the batch!\n");
+		return -1;
+	}
+	batch.nimages = njobs;
+	batch.ntiles = 0;
+	batch.tile_size = cpu->tile_size > 0 ? cpu->tile_size : TILE_SIZE;
+	batch.next_tile = 0;
+
+	for(int i = 0; i < njobs; i++) {
+		const RenderJob *job = &jobs[i];
+		BatchImage *image = &batch.images[i];
+		image->first_tile = batch.ntiles;
+		Tile part = renderJobPart(job);
+		if(job->width < 1 || job->height < 1 || outs[i] == NULL || part.w < 1 || part.h < 1 ||
+				part.x < 0 || part.y < 0 || part.x + part.w > job->width ||
+				part.y + part.h > job->height) {
+			// Has no tiles and nothing to mirror
+			image->args.pix_w = image->args.pix_h = 0;
+			image->mirror.first = 1;
+			image->mirror.last = 0;
+			continue;
+		}
+
+		planMirror(cpu, job->height, job->rect, part, &image->mirror);
+		Tile band = image->mirror.band;
+		setupArgs(cpu, &image->args, job->width, job->height, image->mirror.image, band,
+				clamp(job->iterations, 1, MAX_ITERATIONS),
+				clamp(job->exponent, 1, MAX_EXPONENT),
+				outs[i] + (band.y - part.y) * part.w);
+		batch.ntiles += tileCount(band.w, band.h, batch.tile_size);
+	}
+
+	threadPoolRun(cpu->pool, mandelbrotBatchTiles, &batch, 0);
+
+	for(int i = 0; i < njobs; i++)
+		applyMirror(&batch.images[i].mirror, renderJobPart(&jobs[i]), outs[i]);
+	free(batch.images);
+	return 0;
+}
+
+// Returns the offset of the sample grid for the given anti-alias pass
+static Vec2 calculateShift(CpuEngine *cpu, Rectangle coord_rect, int aa_counter) {
+	double shift_amount_x, shift_amount_y;
+	double shift_x = 0;
+	double shift_y = 0;
 	if(aa_counter < 4) {
-		shift_amount_x = coord_rect.w / (float)mandelbuffer_cpu.w / 3.0;
-		shift_amount_y = coord_rect.h / (float)mandelbuffer_cpu.h / 3.0;
+		shift_amount_x = coord_rect.w / (double)cpu->buffer.w / 3.0;
+		shift_amount_y = coord_rect.h / (double)cpu->buffer.h / 3.0;
 
 		/* Go for every corner by using bit pattern of last two bits */
-		shift_x = coord_rect.x + ((aa_counter & 2) ? 1.0 : -1.0) * shift_amount_x;
-		shift_y = coord_rect.y + ((aa_counter & 1) ? 1.0 : -1.0) * shift_amount_y;
+		shift_x = ((aa_counter & 2) ? 1.0 : -1.0) * shift_amount_x;
+		shift_y = ((aa_counter & 1) ? 1.0 : -1.0) * shift_amount_y;
 	}
 	else if(aa_counter < 8) {
-		shift_amount_x = coord_rect.w / (float)mandelbuffer_cpu.w / 2.0;
-		shift_amount_y = coord_rect.h / (float)mandelbuffer_cpu.h / 2.0;
+		shift_amount_x = coord_rect.w / (double)cpu->buffer.w / 2.0;
+		shift_amount_y = coord_rect.h / (double)cpu->buffer.h / 2.0;
 
 		/*
 		 * When aa_counter is:
@@ -266,9 +901,9 @@ Vec2 calculateShift(Rectangle coord_rect, int aa_counter) {
 		 * - 7: We shift in negative y direction
 		 */
 		int even = aa_counter % 2 == 0;
-		shift_x = coord_rect.x + ( even ? 1.0 : 0.0) *
+		shift_x = ( even ? 1.0 : 0.0) *
 				shift_amount_x * (aa_counter > 5 ? -1.0 : 1.0);
-		shift_y = coord_rect.y + (!even ? 1.0 : 0.0) *
+		shift_y = (!even ? 1.0 : 0.0) *
 				shift_amount_y * (aa_counter > 5 ? -1.0 : 1.0);
 	}
 
@@ -276,51 +911,21 @@ Vec2 calculateShift(Rectangle coord_rect, int aa_counter) {
 }
 
 // aa_counter defines the shift and blend percentage
-void doAntiAliasCpu(Rectangle coord_rect, int *argb_buf, int aa_counter) {
+void doAntiAliasCpu(CpuEngine *cpu, Rectangle coord_rect, int *argb_buf, int aa_counter) {
 	if(argb_buf == NULL)
 		return;
 	if(aa_counter < 0 || aa_counter > 7)
 		return;
 
-	Vec2 shift = calculateShift(coord_rect, aa_counter);
+	Vec2 shift = calculateShift(cpu, coord_rect, aa_counter);
 
-	MandelbrotArgs *args_list = (MandelbrotArgs *)malloc(nthreads * sizeof(MandelbrotArgs));
-	if(args_list == NULL) {
-		mandelLog(ERROR, "Could not create Argslist: %s\n", SDL_GetError());
-		return;
-	}
-	int i;
-	for(i = 0; i < nthreads; i++) {
-		args_list[i].pix_w = mandelbuffer_cpu.w;
-		args_list[i].pix_h = mandelbuffer_cpu.h;
-		args_list[i].rect.x = shift.x;
-		args_list[i].rect.y = shift.y;
-		args_list[i].rect.w = coord_rect.w;
-		args_list[i].rect.h = coord_rect.h;
-		args_list[i].escape_rad = ESCAPE_RADIUS;
-		args_list[i].max_iters = max_iterations_cpu;
-		args_list[i].pow = exponent_cpu;
-		args_list[i].out = mandelbuffer_cpu.rgb_data;
-		args_list[i].thread_idx = i;
-		args_list[i].nthreads = nthreads;
-		threads[i] = SDL_CreateThread(mandelbrotIntrin, "WorkerThread", args_list + i);
-		if(threads[i] == NULL) {
-			mandelLog(ERROR, "Could not create SDL_Thread: %s\n", SDL_GetError());
-			return;
-		}
-	}
-	for(i = 0; i < nthreads; i++) {
-		mandelLog(DEBUG, "Waiting for Thread %d\n", i);
-		SDL_WaitThread(threads[i], NULL);
-	}
-	free(args_list);
+	Rectangle shifted = coord_rect;
+	moveRect(&shifted, shift.x, shift.y);
+	renderCpu(cpu, cpu->buffer.w, cpu->buffer.h, shifted, cpu->buffer.rgb_data, 0);
 
 	aa_counter += 2;
 
 	// blend them together
-	for(i = 0; i < mandelbuffer_cpu.w * mandelbuffer_cpu.h; i++) {
-		int blend_color = blend(argb_buf[i],
-				mandelbuffer_cpu.rgb_data[i], 1.0 / aa_counter);
-		argb_buf[i] = 0xff000000 | blend_color; // apply full alpha
-	}
+	imageBlend(cpu->pool, argb_buf, cpu->buffer.rgb_data,
+			cpu->buffer.w * cpu->buffer.h, 1.0 / aa_counter);
 }
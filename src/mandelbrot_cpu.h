@@ -3,17 +3,71 @@
 
 #include "mandelbrot_common.h"
 #include "mandelbrot_cpu_intrin.h"
+#include "mandelbrot_cpu_dd.h"
+#include "mandelbrot_cpu_fixed.h"
+#include "kernel_registry.h"
+#include "threadpool.h"
 
-int mandelbrotCpuInit(int w, int h, int no_simd);
-void mandelbrotCpuCleanup();
+typedef struct CpuThreadConfig {
+	int nthreads; // 0 to pick a thread count automatically
+	int *cpus;    // CPUs the workers get pinned to, NULL to not pin
+	int ncpus;
+	int numa;     // Workers own and first-touch the tiles they render
+} CpuThreadConfig;
 
-int resizeFramebufferCpu(int new_w, int new_h);
+/*
+ * The CPU engine is a library that doesn't depend on SDL. All of its state
+ * lives in a CpuEngine context, so several contexts with different settings
+ * can render concurrently. A single context must only be used by one thread
+ * at a time.
+ */
+typedef struct CpuEngine CpuEngine;
 
-void generateImageCpu(Rectangle coord_rect, int *out_argb);
-void generateImageCpuWH(int w, int h, Rectangle coord_rect, int *out_argb);
-void doAntiAliasCpu(Rectangle coord_rect, int *argb_buf, int aa_counter);
+CpuEngine *mandelbrotCpuCreate(int w, int h, int no_simd, const CpuThreadConfig *threading);
+void mandelbrotCpuDestroy(CpuEngine *cpu);
 
-void changeIterationsCpu(int diff);
-void changeExponentCpu(int diff);
+// Renders with the fixed point kernel instead of the float and double ones,
+// so images are the same on every CPU. Deeper views still use double-double.
+void mandelbrotCpuSetFixedPoint(CpuEngine *cpu, int enabled);
+// Fills provably uniform tiles without running the kernel, on by default.
+// Benchmarks turn it off to measure the kernels alone.
+void mandelbrotCpuSetUniformFill(CpuEngine *cpu, int enabled);
+
+// Workers of the engine, other work like scaling images can share them
+ThreadPool *mandelbrotCpuPool(CpuEngine *cpu);
+
+void mandelbrotCpuGetTuning(CpuEngine *cpu, CpuTuning *tuning);
+int mandelbrotCpuApplyTuning(CpuEngine *cpu, const CpuTuning *tuning);
+
+int resizeFramebufferCpu(CpuEngine *cpu, int new_w, int new_h);
+
+void generateImageCpu(CpuEngine *cpu, Rectangle coord_rect, int *out_argb);
+void generateImageCpuWH(CpuEngine *cpu, int w, int h, Rectangle coord_rect, int *out_argb);
+// Renders a w x h image in parts of about max_pixels each, tiles closest
+// to the focus pixel first, so the image can be shown as it sharpens.
+// Start with part 0 and pass the returned part on to the next call, until
+// 0 is returned once the image is complete. *changed is set to a box around
+// every pixel the call wrote.
+int generateImageCpuFocus(CpuEngine *cpu, int w, int h, Rectangle coord_rect, int *out_argb,
+		int focus_x, int focus_y, int part, int max_pixels, Tile *changed);
+void doAntiAliasCpu(CpuEngine *cpu, Rectangle coord_rect, int *argb_buf, int aa_counter);
+
+// Iteration counts of the last image of generateImageCpu(WH) or
+// generateImageCpuFocus, complete or not. Rows that
+// mirror other rows are not counted. Returns nonzero if there is none.
+int getIterStatsCpu(CpuEngine *cpu, IterStats *stats);
+
+// Renders the part of every job into outs[i] with the job's own iterations
+// and exponent.
+// The tiles of all jobs are scheduled on the workers together, so a batch of
+// small images keeps all of them busy. tile_size of the jobs is not used.
+int renderBatchCpu(CpuEngine *cpu, const RenderJob *jobs, int *const *outs, int njobs);
+
+int mandelbrot(void *voidargs);
+int getIterationsCpu(float x0, float y0, float escape_rad, int max_iters, int pow);
+int iterationsToColorCpu(int iterations, int max_iters);
+
+void changeIterationsCpu(CpuEngine *cpu, int diff);
+void changeExponentCpu(CpuEngine *cpu, int diff);
 
 #endif
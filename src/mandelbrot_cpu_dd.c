@@ -0,0 +1,217 @@
+#include "mandelbrot_cpu_dd.h"
+#include "mandelbrot_cpu.h"
+
+#include <immintrin.h>
+
+// This file is compiled twice, once with -mfma -DDD_USE_FMA
+#ifdef DD_USE_FMA
+#define KERNEL_NAME(name) name##Fma
+#else
+#define KERNEL_NAME(name) name
+#endif
+
+// Four double-double numbers
+typedef struct DD4 {
+	__m256d hi;
+	__m256d lo;
+} DD4;
+
+// Error free transformations, see Dekker (1971) and Shewchuk (1997)
+static inline DD4 twoSum(__m256d a, __m256d b) {
+	__m256d s = _mm256_add_pd(a, b);
+	__m256d bb = _mm256_sub_pd(s, a);
+	__m256d err = _mm256_add_pd(_mm256_sub_pd(a, _mm256_sub_pd(s, bb)),
+			_mm256_sub_pd(b, bb));
+	return (DD4){s, err};
+}
+
+// Like twoSum but requires |a| >= |b|
+static inline DD4 quickTwoSum(__m256d a, __m256d b) {
+	__m256d s = _mm256_add_pd(a, b);
+	__m256d err = _mm256_sub_pd(b, _mm256_sub_pd(s, a));
+	return (DD4){s, err};
+}
+
+static inline DD4 twoProd(__m256d a, __m256d b) {
+	__m256d p = _mm256_mul_pd(a, b);
+#ifdef DD_USE_FMA
+	__m256d err = _mm256_fmsub_pd(a, b, p);
+#else
+	// Split both factors into halves of 26 bits so their products are exact
+	const __m256d split = _mm256_set1_pd(134217729.0); // 2^27 + 1
+	__m256d t = _mm256_mul_pd(split, a);
+	__m256d a_hi = _mm256_sub_pd(t, _mm256_sub_pd(t, a));
+	__m256d a_lo = _mm256_sub_pd(a, a_hi);
+	t = _mm256_mul_pd(split, b);
+	__m256d b_hi = _mm256_sub_pd(t, _mm256_sub_pd(t, b));
+	__m256d b_lo = _mm256_sub_pd(b, b_hi);
+
+	__m256d err = _mm256_sub_pd(_mm256_mul_pd(a_hi, b_hi), p);
+	err = _mm256_add_pd(err, _mm256_mul_pd(a_hi, b_lo));
+	err = _mm256_add_pd(err, _mm256_mul_pd(a_lo, b_hi));
+	err = _mm256_add_pd(err, _mm256_mul_pd(a_lo, b_lo));
+#endif
+	return (DD4){p, err};
+}
+
+static inline DD4 ddAdd(DD4 a, DD4 b) {
+	DD4 s = twoSum(a.hi, b.hi);
+	DD4 t = twoSum(a.lo, b.lo);
+	s.lo = _mm256_add_pd(s.lo, t.hi);
+	s = quickTwoSum(s.hi, s.lo);
+	s.lo = _mm256_add_pd(s.lo, t.lo);
+	return quickTwoSum(s.hi, s.lo);
+}
+
+static inline DD4 ddNeg(DD4 a) {
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	return (DD4){_mm256_xor_pd(a.hi, sign), _mm256_xor_pd(a.lo, sign)};
+}
+
+static inline DD4 ddMul(DD4 a, DD4 b) {
+	DD4 p = twoProd(a.hi, b.hi);
+#ifdef DD_USE_FMA
+	p.lo = _mm256_fmadd_pd(a.hi, b.lo, p.lo);
+	p.lo = _mm256_fmadd_pd(a.lo, b.hi, p.lo);
+#else
+	p.lo = _mm256_add_pd(p.lo, _mm256_add_pd(_mm256_mul_pd(a.hi, b.lo),
+			_mm256_mul_pd(a.lo, b.hi)));
+#endif
+	return quickTwoSum(p.hi, p.lo);
+}
+
+// Multiplication by a power of two is exact
+static inline DD4 ddMul2(DD4 a) {
+	return (DD4){_mm256_add_pd(a.hi, a.hi), _mm256_add_pd(a.lo, a.lo)};
+}
+
+static void writeColors(MandelbrotArgs *args, int x, int y, __m256i iterations) {
+	long long counts[4];
+	_mm256_storeu_si256((__m256i *)counts, iterations);
+
+	int *out = args->out + y * args->stride;
+	for(int i = 0; i < 4 && x + i < args->pix_w; i++) {
+		// Write color with full alpha into output
+		out[x + i] = 0xff000000 | iterationsToColorCpu((int)counts[i], args->max_iters);
+		if(args->stats != NULL)
+			recordIterations(args->stats, (int)counts[i], args->max_iters);
+	}
+}
+
+static __m256i getIterationsDouble(__m256d x0, __m256d y0, double escape_rad_sq,
+		int max_iters, int pow) {
+	__m256d x = _mm256_setzero_pd();
+	__m256d y = _mm256_setzero_pd();
+	__m256d escapeRadVec = _mm256_set1_pd(escape_rad_sq);
+	__m256i retVal = _mm256_setzero_si256();
+
+	for(int iteration = 0; iteration < max_iters; iteration++) {
+		__m256d dist = _mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y));
+		__m256d comp = _mm256_cmp_pd(dist, escapeRadVec, _CMP_LE_OQ);
+		if(_mm256_testz_pd(comp, comp))
+			break;
+		retVal = _mm256_sub_epi64(retVal, _mm256_castpd_si256(comp));
+
+		__m256d retx = x;
+		__m256d rety = y;
+		for(int i = 0; i < pow - 1; i++) {
+			__m256d tmpx = _mm256_sub_pd(_mm256_mul_pd(retx, x), _mm256_mul_pd(rety, y));
+			rety = _mm256_add_pd(_mm256_mul_pd(retx, y), _mm256_mul_pd(rety, x));
+			retx = tmpx;
+		}
+		x = _mm256_add_pd(retx, x0);
+		y = _mm256_add_pd(rety, y0);
+	}
+	return retVal;
+}
+
+static __m256i getIterationsDD(DD4 x0, DD4 y0, double escape_rad_sq,
+		int max_iters, int pow) {
+	DD4 x = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+	DD4 y = x;
+	__m256d escapeRadVec = _mm256_set1_pd(escape_rad_sq);
+	__m256i retVal = _mm256_setzero_si256();
+
+	for(int iteration = 0; iteration < max_iters; iteration++) {
+		// The escape check doesn't need more than double precision
+		__m256d dist = _mm256_add_pd(_mm256_mul_pd(x.hi, x.hi), _mm256_mul_pd(y.hi, y.hi));
+		__m256d comp = _mm256_cmp_pd(dist, escapeRadVec, _CMP_LE_OQ);
+		if(_mm256_testz_pd(comp, comp))
+			break;
+		retVal = _mm256_sub_epi64(retVal, _mm256_castpd_si256(comp));
+
+		if(pow == 2) {
+			DD4 xy = ddMul(x, y);
+			DD4 xx = ddMul(x, x);
+			DD4 yy = ddMul(y, y);
+			x = ddAdd(ddAdd(xx, ddNeg(yy)), x0);
+			y = ddAdd(ddMul2(xy), y0);
+		} else {
+			DD4 retx = x;
+			DD4 rety = y;
+			for(int i = 0; i < pow - 1; i++) {
+				DD4 tmpx = ddAdd(ddMul(retx, x), ddNeg(ddMul(rety, y)));
+				rety = ddAdd(ddMul(retx, y), ddMul(rety, x));
+				retx = tmpx;
+			}
+			x = ddAdd(retx, x0);
+			y = ddAdd(rety, y0);
+		}
+	}
+	return retVal;
+}
+
+int KERNEL_NAME(mandelbrotDouble)(void *voidargs) {
+	MandelbrotArgs *args = (MandelbrotArgs *)voidargs;
+
+	double dx = args->rect.w / (double)args->pix_w;
+	double dy = args->rect.h / (double)args->pix_h;
+	double escapeRadSq = (double)args->escape_rad * (double)args->escape_rad;
+	__m256d counter = _mm256_set_pd(3, 2, 1, 0);
+
+	// Rows are interleaved between the threads, pixels in a row are contiguous
+	for(int y = args->thread_idx; y < args->pix_h; y += args->nthreads) {
+		__m256d vecY = _mm256_set1_pd(args->rect.y + (double)y * dy);
+		for(int x = 0; x < args->pix_w; x += 4) {
+			__m256d vecX = _mm256_add_pd(_mm256_set1_pd((double)x), counter);
+			vecX = _mm256_add_pd(_mm256_mul_pd(vecX, _mm256_set1_pd(dx)),
+					_mm256_set1_pd(args->rect.x));
+
+			__m256i iterations = getIterationsDouble(vecX, vecY, escapeRadSq,
+					args->max_iters, args->pow);
+			writeColors(args, x, y, iterations);
+		}
+	}
+	return 0;
+}
+
+int KERNEL_NAME(mandelbrotDD)(void *voidargs) {
+	MandelbrotArgs *args = (MandelbrotArgs *)voidargs;
+
+	double dx = args->rect.w / (double)args->pix_w;
+	double dy = args->rect.h / (double)args->pix_h;
+	double escapeRadSq = (double)args->escape_rad * (double)args->escape_rad;
+	__m256d counter = _mm256_set_pd(3, 2, 1, 0);
+
+	// The corner of the rectangle in double-double precision
+	DD4 rectX = {_mm256_set1_pd(args->rect.x), _mm256_set1_pd(args->rect.x_lo)};
+	DD4 rectY = {_mm256_set1_pd(args->rect.y), _mm256_set1_pd(args->rect.y_lo)};
+	__m256d zero = _mm256_setzero_pd();
+
+	for(int y = args->thread_idx; y < args->pix_h; y += args->nthreads) {
+		// Offsets from the corner are far larger than the pixel spacing,
+		// so a double is precise enough for them
+		DD4 offY = {_mm256_set1_pd((double)y * dy), zero};
+		DD4 vecY = ddAdd(rectY, offY);
+		for(int x = 0; x < args->pix_w; x += 4) {
+			__m256d off = _mm256_add_pd(_mm256_set1_pd((double)x), counter);
+			DD4 offX = {_mm256_mul_pd(off, _mm256_set1_pd(dx)), zero};
+			DD4 vecX = ddAdd(rectX, offX);
+
+			__m256i iterations = getIterationsDD(vecX, vecY, escapeRadSq,
+					args->max_iters, args->pow);
+			writeColors(args, x, y, iterations);
+		}
+	}
+	return 0;
+}
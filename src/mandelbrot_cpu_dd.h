@@ -0,0 +1,19 @@
+#ifndef _MANDELBROT_CPU_DD_H_
+#define _MANDELBROT_CPU_DD_H_
+
+#include "mandelbrot_common.h"
+
+/*
+ * AVX2 kernels for views that are too deep for float.
+ * mandelbrotDouble iterates in double precision, mandelbrotDD in
+ * double-double precision (each number is the unevaluated sum of two doubles,
+ * about 106 bits of mantissa).
+ * The Fma variants are the same kernels built with FMA instructions.
+ */
+int mandelbrotDouble(void *voidargs);
+int mandelbrotDD(void *voidargs);
+
+int mandelbrotDoubleFma(void *voidargs);
+int mandelbrotDDFma(void *voidargs);
+
+#endif
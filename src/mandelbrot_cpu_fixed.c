@@ -0,0 +1,103 @@
+#include "mandelbrot_cpu_fixed.h"
+#include "mandelbrot_cpu.h"
+
+
+#define FIXED_ONE ((double)(1ll << FIXED_FRAC_BITS))
+// |c| beyond this escapes after the first iteration, whatever c is exactly
+#define FIXED_C_LIMIT 4.0
+// Larger radii could overflow x * x - y * y + c
+#define FIXED_MAX_RADIUS 3.0f
+
+// Larger corners and extents are clamped, so origin + index * step fits
+// into 128 bits for every index of an int
+#define FIXED_MAX_EXTENT ((double)(1ll << 40))
+
+static double clampExtent(double d) {
+	return d > FIXED_MAX_EXTENT ? FIXED_MAX_EXTENT : d < -FIXED_MAX_EXTENT ? -FIXED_MAX_EXTENT : d;
+}
+
+FixedAxis fixedAxis(double corner, double corner_lo, double extent, int pixels) {
+	FixedAxis axis;
+	// Each part is converted exactly up to the truncated bits below 2^-59
+	axis.origin = (__int128)(clampExtent(corner) * FIXED_ONE) +
+			(__int128)(clampExtent(corner_lo) * FIXED_ONE);
+	axis.step = (__int128)(clampExtent(extent / pixels) * FIXED_ONE);
+	return axis;
+}
+
+int64_t fixedAt(FixedAxis axis, int index) {
+	const int64_t limit = (int64_t)(FIXED_C_LIMIT * FIXED_ONE);
+	__int128 c = axis.origin + index * axis.step;
+	return c < -limit ? -limit : c > limit ? limit : (int64_t)c;
+}
+
+int64_t fixedEscapeRadius(float escape_rad) {
+	if(escape_rad > FIXED_MAX_RADIUS)
+		escape_rad = FIXED_MAX_RADIUS;
+	return (int64_t)((double)escape_rad * FIXED_ONE);
+}
+
+int64_t fixedEscapeRadiusSq(float escape_rad) {
+	if(escape_rad > FIXED_MAX_RADIUS)
+		escape_rad = FIXED_MAX_RADIUS;
+	return (int64_t)((double)escape_rad * (double)escape_rad * FIXED_ONE);
+}
+
+// Product of two non-negative fixed point numbers, truncated
+static inline uint64_t mulFixed(uint64_t a, uint64_t b) {
+	return (uint64_t)(((unsigned __int128)a * b) >> FIXED_FRAC_BITS);
+}
+
+// Same iteration as getIterationsCpu. Arithmetic wraps around on unsigned
+// integers like the vector kernel, although it never overflows.
+static int getIterationsFixed(int64_t cx, int64_t cy, int64_t radius, int64_t radius_sq,
+		int max_iters) {
+	uint64_t x = 0, y = 0;
+	int iteration = 0;
+	while(iteration < max_iters) {
+		uint64_t ax = (int64_t)x < 0 ? -x : x;
+		uint64_t ay = (int64_t)y < 0 ? -y : y;
+		// Both parts are at most the radius, so their squares can't overflow
+		if(ax > (uint64_t)radius || ay > (uint64_t)radius)
+			break;
+		uint64_t xx = mulFixed(ax, ax);
+		uint64_t yy = mulFixed(ay, ay);
+		if(xx > (uint64_t)radius_sq - yy)
+			break;
+		iteration++;
+
+		uint64_t xy = mulFixed(ax, ay);
+		if((int64_t)(x ^ y) < 0)
+			xy = -xy;
+		x = xx - yy + (uint64_t)cx;
+		y = xy + xy + (uint64_t)cy;
+	}
+	return iteration;
+}
+
+int mandelbrotFixed(void *voidargs) {
+	MandelbrotArgs *args = (MandelbrotArgs *)voidargs;
+	if(args->pow != 2)
+		return mandelbrot(voidargs);
+
+	// Coordinates come from the whole image, not from the rect of the tile
+	const Rectangle *image = &args->image_rect;
+	FixedAxis axis_x = fixedAxis(image->x, image->x_lo, image->w, args->image_w);
+	FixedAxis axis_y = fixedAxis(image->y, image->y_lo, image->h, args->image_h);
+	int64_t radius = fixedEscapeRadius(args->escape_rad);
+	int64_t radius_sq = fixedEscapeRadiusSq(args->escape_rad);
+
+	for(int y = args->thread_idx; y < args->pix_h; y += args->nthreads) {
+		int64_t cy = fixedAt(axis_y, args->image_y + y);
+		int *out = args->out + y * args->stride;
+		for(int x = 0; x < args->pix_w; x++) {
+			int64_t cx = fixedAt(axis_x, args->image_x + x);
+			int iters = getIterationsFixed(cx, cy, radius, radius_sq, args->max_iters);
+			if(args->stats != NULL)
+				recordIterations(args->stats, iters, args->max_iters);
+			// Write color with full alpha into output
+			out[x] = 0xff000000 | iterationsToColorCpu(iters, args->max_iters);
+		}
+	}
+	return 0;
+}
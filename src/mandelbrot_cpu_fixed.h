@@ -0,0 +1,42 @@
+#ifndef _MANDELBROT_CPU_FIXED_H_
+#define _MANDELBROT_CPU_FIXED_H_
+
+#include <stdint.h>
+
+#include "mandelbrot_common.h"
+
+/*
+ * Kernels iterating in Q4.59 fixed point: 64 bit integers with 59
+ * fractional bits. Integer arithmetic gives the same pixels on every CPU,
+ * with either kernel and any compiler. Near the origin the precision is
+ * about 6 bits better than double.
+ *
+ * Products are truncated towards zero. Points escape once |z| > 3, so no
+ * intermediate result leaves the range of +-16. Only exponent 2 is
+ * iterated in fixed point, others fall back to the scalar float kernel.
+ */
+#define FIXED_FRAC_BITS 59
+
+int mandelbrotFixed(void *voidargs);
+int mandelbrotFixedAvx2(void *voidargs);
+
+// Pixel i along one axis of an image lies at origin + i * step. Both are
+// converted once from the whole image, and every pixel is computed from
+// them in integers, so a pixel gets the same coordinate in every tile.
+typedef struct FixedAxis {
+	__int128 origin;
+	__int128 step;
+} FixedAxis;
+
+// Axis of pixels pixels starting at corner + corner_lo and spanning extent
+FixedAxis fixedAxis(double corner, double corner_lo, double extent, int pixels);
+
+// Coordinate of pixel index of the axis. Points that far out that they
+// escape right away are saturated.
+int64_t fixedAt(FixedAxis axis, int index);
+
+// Escape radius and its square in fixed point
+int64_t fixedEscapeRadius(float escape_rad);
+int64_t fixedEscapeRadiusSq(float escape_rad);
+
+#endif
@@ -0,0 +1,98 @@
+#include "mandelbrot_cpu_fixed.h"
+#include "mandelbrot_cpu.h"
+
+#include <immintrin.h>
+
+// Product of non-negative fixed point numbers, truncated. AVX2 only
+// multiplies 32 bit halves, so the 128 bit product is put together from
+// four partial products.
+static inline __m256i mulFixed(__m256i a, __m256i b) {
+	const __m256i low = _mm256_set1_epi64x(0xffffffff);
+	__m256i a_hi = _mm256_srli_epi64(a, 32);
+	__m256i b_hi = _mm256_srli_epi64(b, 32);
+	__m256i ll = _mm256_mul_epu32(a, b);
+	__m256i lh = _mm256_mul_epu32(a, b_hi);
+	__m256i hl = _mm256_mul_epu32(a_hi, b);
+	__m256i hh = _mm256_mul_epu32(a_hi, b_hi);
+
+	__m256i mid = _mm256_add_epi64(_mm256_srli_epi64(ll, 32),
+			_mm256_add_epi64(_mm256_and_si256(lh, low), _mm256_and_si256(hl, low)));
+	__m256i hi = _mm256_add_epi64(_mm256_add_epi64(hh, _mm256_srli_epi64(mid, 32)),
+			_mm256_add_epi64(_mm256_srli_epi64(lh, 32), _mm256_srli_epi64(hl, 32)));
+	__m256i lo = _mm256_or_si256(_mm256_slli_epi64(mid, 32), _mm256_and_si256(ll, low));
+	return _mm256_or_si256(_mm256_slli_epi64(hi, 64 - FIXED_FRAC_BITS),
+			_mm256_srli_epi64(lo, FIXED_FRAC_BITS));
+}
+
+// Same iteration as getIterationsFixed. Lanes stay escaped once they
+// escaped, their values may overflow afterwards.
+static __m256i getIterationsFixedAvx2(__m256i cx, __m256i cy, int64_t radius,
+		int64_t radius_sq, int max_iters) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i radius_vec = _mm256_set1_epi64x(radius);
+	const __m256i radius_sq_vec = _mm256_set1_epi64x(radius_sq);
+	__m256i x = zero;
+	__m256i y = zero;
+	__m256i active = _mm256_cmpeq_epi64(zero, zero);
+	__m256i count = zero;
+
+	for(int iteration = 0; iteration < max_iters; iteration++) {
+		__m256i neg_x = _mm256_cmpgt_epi64(zero, x);
+		__m256i neg_y = _mm256_cmpgt_epi64(zero, y);
+		__m256i ax = _mm256_sub_epi64(_mm256_xor_si256(x, neg_x), neg_x);
+		__m256i ay = _mm256_sub_epi64(_mm256_xor_si256(y, neg_y), neg_y);
+		// The values of active lanes are at most 16, so signed compares work
+		__m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(ax, radius_vec),
+				_mm256_cmpgt_epi64(ay, radius_vec));
+		__m256i xx = mulFixed(ax, ax);
+		__m256i yy = mulFixed(ay, ay);
+		outside = _mm256_or_si256(outside,
+				_mm256_cmpgt_epi64(xx, _mm256_sub_epi64(radius_sq_vec, yy)));
+		active = _mm256_andnot_si256(outside, active);
+		if(_mm256_testz_si256(active, active))
+			break;
+		count = _mm256_sub_epi64(count, active);
+
+		__m256i xy = mulFixed(ax, ay);
+		__m256i neg = _mm256_xor_si256(neg_x, neg_y);
+		xy = _mm256_sub_epi64(_mm256_xor_si256(xy, neg), neg);
+		x = _mm256_add_epi64(_mm256_sub_epi64(xx, yy), cx);
+		y = _mm256_add_epi64(_mm256_add_epi64(xy, xy), cy);
+	}
+	return count;
+}
+
+int mandelbrotFixedAvx2(void *voidargs) {
+	MandelbrotArgs *args = (MandelbrotArgs *)voidargs;
+	if(args->pow != 2)
+		return mandelbrot(voidargs);
+
+	// Coordinates come from the whole image like in the scalar kernel
+	const Rectangle *image = &args->image_rect;
+	FixedAxis axis_x = fixedAxis(image->x, image->x_lo, image->w, args->image_w);
+	FixedAxis axis_y = fixedAxis(image->y, image->y_lo, image->h, args->image_h);
+	int64_t radius = fixedEscapeRadius(args->escape_rad);
+	int64_t radius_sq = fixedEscapeRadiusSq(args->escape_rad);
+
+	for(int y = args->thread_idx; y < args->pix_h; y += args->nthreads) {
+		__m256i cy = _mm256_set1_epi64x(fixedAt(axis_y, args->image_y + y));
+		int *out = args->out + y * args->stride;
+		for(int x = 0; x < args->pix_w; x += 4) {
+			long long cx[4], counts[4];
+			for(int i = 0; i < 4; i++)
+				cx[i] = fixedAt(axis_x, args->image_x + x + i);
+			__m256i iterations = getIterationsFixedAvx2(
+					_mm256_loadu_si256((const __m256i *)cx), cy,
+					radius, radius_sq, args->max_iters);
+			_mm256_storeu_si256((__m256i *)counts, iterations);
+
+			for(int i = 0; i < 4 && x + i < args->pix_w; i++) {
+				if(args->stats != NULL)
+					recordIterations(args->stats, (int)counts[i], args->max_iters);
+				// Write color with full alpha into output
+				out[x + i] = 0xff000000 | iterationsToColorCpu((int)counts[i], args->max_iters);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,171 @@
+#include "mandelbrot_cpu_intrin.h"
+#include "mandelbrot_cpu.h"
+#include "config.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+// Highest number of independent vectors iterated at once
+#define MAX_VECTORS 4
+
+/*
+ * A single vector spends most of every iteration waiting for the result of
+ * the previous multiply-add. Iterating n independent vectors interleaved
+ * keeps the FMA units busy during that latency. n is a compile time constant
+ * at every call site, so all loops over it are unrolled.
+ */
+static inline __attribute__((always_inline)) void getIterationsFma(
+		const __m256 *x0, const __m256 *y0, __m256i *counts, const int n,
+		float escape_rad_sq, int max_iters, int pow) {
+	__m256 x[MAX_VECTORS], y[MAX_VECTORS];
+	__m256 escapeRadVec = _mm256_set1_ps(escape_rad_sq);
+	for(int v = 0; v < n; v++) {
+		x[v] = _mm256_setzero_ps();
+		y[v] = _mm256_setzero_ps();
+		counts[v] = _mm256_setzero_si256();
+	}
+
+	for(int iteration = 0; iteration < max_iters; iteration++) {
+		__m256 active = _mm256_setzero_ps();
+		for(int v = 0; v < n; v++) {
+			__m256 dist = _mm256_fmadd_ps(x[v], x[v], _mm256_mul_ps(y[v], y[v]));
+			__m256 comp = _mm256_cmp_ps(dist, escapeRadVec, _CMP_LE_OS);
+			counts[v] = _mm256_sub_epi32(counts[v], _mm256_castps_si256(comp));
+			active = _mm256_or_ps(active, comp);
+		}
+		if(_mm256_testz_ps(active, active))
+			break;
+
+		for(int v = 0; v < n; v++) {
+			if(pow == 2) {
+				__m256 xy = _mm256_mul_ps(x[v], y[v]);
+				__m256 tmpx = _mm256_fmadd_ps(x[v], x[v], x0[v]);
+				x[v] = _mm256_fnmadd_ps(y[v], y[v], tmpx);
+				y[v] = _mm256_add_ps(_mm256_add_ps(xy, xy), y0[v]);
+				continue;
+			}
+			__m256 retx = x[v];
+			__m256 rety = y[v];
+			for(int i = 0; i < pow - 1; i++) {
+				__m256 tmpx = _mm256_fmsub_ps(retx, x[v], _mm256_mul_ps(rety, y[v]));
+				rety = _mm256_fmadd_ps(retx, y[v], _mm256_mul_ps(rety, x[v]));
+				retx = tmpx;
+			}
+			x[v] = _mm256_add_ps(retx, x0[v]);
+			y[v] = _mm256_add_ps(rety, y0[v]);
+		}
+	}
+}
+
+// Writes the colors of count <= 8 pixels with contiguous stores
+static inline void storeSpan(int *out, int count, __m256i iterations, int max_iters,
+		IterStats *stats) {
+	int counts[8] __attribute__((aligned(32)));
+	int colors[8] __attribute__((aligned(32)));
+	_mm256_store_si256((__m256i *)counts, iterations);
+	for(int i = 0; i < 8; i++) {
+		// Write color with full alpha into output
+		colors[i] = 0xff000000 | iterationsToColorCpu(counts[i], max_iters);
+	}
+	for(int i = 0; stats != NULL && i < count; i++)
+		recordIterations(stats, counts[i], max_iters);
+
+	if(count < 8) {
+		memcpy(out, colors, count * sizeof(int));
+		return;
+	}
+	__m256i vec = _mm256_load_si256((__m256i *)colors);
+#if ENABLE_STREAMING_STORES
+	if(((uintptr_t)out & 31) == 0) {
+		_mm256_stream_si256((__m256i *)out, vec);
+		return;
+	}
+#endif
+	_mm256_storeu_si256((__m256i *)out, vec);
+}
+
+// Renders n spans of 8 pixels of row y, starting at pixel x
+static inline __attribute__((always_inline)) void renderSpans(MandelbrotArgs *args,
+		int x, int y, const int n, __m256 vecY, __m256 dx, __m256 rectX) {
+	__m256 x0[MAX_VECTORS], y0[MAX_VECTORS];
+	__m256i counts[MAX_VECTORS];
+	const __m256 counter = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+	for(int v = 0; v < n; v++) {
+		__m256 px = _mm256_add_ps(_mm256_set1_ps((float)(x + 8 * v)), counter);
+		x0[v] = _mm256_fmadd_ps(px, dx, rectX);
+		y0[v] = vecY;
+	}
+
+	getIterationsFma(x0, y0, counts, n, args->escape_rad * args->escape_rad,
+			args->max_iters, args->pow);
+
+	int *out = args->out + y * args->stride;
+	for(int v = 0; v < n; v++) {
+		int start = x + 8 * v;
+		int count = args->pix_w - start < 8 ? args->pix_w - start : 8;
+		storeSpan(out + start, count, counts[v], args->max_iters, args->stats);
+	}
+}
+
+int mandelbrotIntrinFma(void *voidargs) {
+	MandelbrotArgs *args = (MandelbrotArgs *)voidargs;
+	int unroll = args->unroll < 1 ? 1 : args->unroll > MAX_VECTORS ? MAX_VECTORS : args->unroll;
+
+	double dx = args->rect.w / (double)args->pix_w;
+	double dy = args->rect.h / (double)args->pix_h;
+	__m256 vecDx = _mm256_set1_ps((float)dx);
+	__m256 rectX = _mm256_set1_ps((float)args->rect.x);
+
+	// Rows are interleaved between the threads, pixels in a row are contiguous
+	for(int y = args->thread_idx; y < args->pix_h; y += args->nthreads) {
+		__m256 vecY = _mm256_set1_ps((float)(args->rect.y + (double)y * dy));
+		for(int x = 0; x < args->pix_w; x += 8 * unroll) {
+			// Don't iterate spans past the end of the row
+			int spans = (args->pix_w - x + 7) / 8;
+			spans = spans < unroll ? spans : unroll;
+			switch(spans) {
+				case 1: renderSpans(args, x, y, 1, vecY, vecDx, rectX); break;
+				case 2: renderSpans(args, x, y, 2, vecY, vecDx, rectX); break;
+				case 3: renderSpans(args, x, y, 3, vecY, vecDx, rectX); break;
+				default: renderSpans(args, x, y, 4, vecY, vecDx, rectX); break;
+			}
+		}
+	}
+
+#if ENABLE_STREAMING_STORES
+	// Streaming stores are weakly ordered, make them visible before returning
+	_mm_sfence();
+#endif
+	return 0;
+}
+
+void escapeIterationsFma(const float *cx, const float *cy, int *counts, int n,
+		float escape_rad, int max_iters, int pow) {
+	const int batch = 8 * MAX_VECTORS;
+	float x[8 * MAX_VECTORS] __attribute__((aligned(32)));
+	float y[8 * MAX_VECTORS] __attribute__((aligned(32)));
+	int out[8 * MAX_VECTORS] __attribute__((aligned(32)));
+
+	for(int first = 0; first < n; first += batch) {
+		int count = n - first < batch ? n - first : batch;
+		memcpy(x, cx + first, count * sizeof(float));
+		memcpy(y, cy + first, count * sizeof(float));
+		// Padding escapes right away
+		for(int i = count; i < batch; i++) {
+			x[i] = escape_rad;
+			y[i] = escape_rad;
+		}
+
+		__m256 x0[MAX_VECTORS], y0[MAX_VECTORS];
+		__m256i iterations[MAX_VECTORS];
+		for(int v = 0; v < MAX_VECTORS; v++) {
+			x0[v] = _mm256_load_ps(x + 8 * v);
+			y0[v] = _mm256_load_ps(y + 8 * v);
+		}
+		getIterationsFma(x0, y0, iterations, MAX_VECTORS, escape_rad * escape_rad, max_iters, pow);
+		for(int v = 0; v < MAX_VECTORS; v++)
+			_mm256_store_si256((__m256i *)(out + 8 * v), iterations[v]);
+		memcpy(counts + first, out, count * sizeof(int));
+	}
+}
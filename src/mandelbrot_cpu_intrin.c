@@ -119,10 +119,13 @@ int mandelbrotIntrin(void *voidargs) {
 			__m256i iterations = getIterationsCpuIntrin(vecX, vecY, escapeRadSq, args->max_iters, args->pow);
 
 			for(int i = 0; i < 8 && y + i < args->pix_h; i++) {
-				int color = iterationsToColorCpuIntrin(extractInt(iterations, i), args->max_iters);
+				int iters = extractInt(iterations, i);
+				int color = iterationsToColorCpuIntrin(iters, args->max_iters);
+				if(args->stats != NULL)
+					recordIterations(args->stats, iters, args->max_iters);
 
 				// Write color with full alpha into output
-				args->out[(y + i) * args->pix_w + x] = 0xff000000 | color;
+				args->out[(y + i) * args->stride + x] = 0xff000000 | color;
 			}
 		}
 	}
@@ -5,4 +5,11 @@
 
 int mandelbrotIntrin(void *voidargs);
 
+// Row-major AVX2 kernel with FMA that keeps args->unroll vectors in flight
+int mandelbrotIntrinFma(void *voidargs);
+
+// Escape iterations of n arbitrary points, with the same vector code
+void escapeIterationsFma(const float *cx, const float *cy, int *counts, int n,
+		float escape_rad, int max_iters, int pow);
+
 #endif
@@ -2,17 +2,24 @@ extern "C" {
 #include "mandelbrot_cuda.h"
 
 #include "util.h"
+#include "image_ops.h"
 #include "logger.h"
 #include "config.h"
+#include "frame_arena.h"
 
 #include <stdlib.h>
 #include <string.h>
 }
 
-MandelBuffer mandelbuffer;
-
-int max_iterations = DEFAULT_ITERATIONS;
-int exponent = DEFAULT_EXPONENT;
+struct CudaEngine {
+	MandelBuffer mandelbuffer; // Device buffer of the framebuffer size
+	// Device buffer for renders in arbitrary sizes, reused between calls
+	MandelBuffer mandelbuffer_wh;
+	// Host buffer the anti-alias passes are copied into before blending
+	MandelBuffer aa_buffer;
+	int max_iterations;
+	int exponent;
+};
 
 __device__
 void iterate(float x0, float y0, int power, float *x, float *y) {
@@ -91,19 +98,19 @@ void mandelbrot(int pix_w, int pix_h, float coord_x, float coord_y,
 /* Host functions declared extern "C" to be linkable with C code */
 extern "C" {
 
-void changeIterationsCuda(int diff) {
-	int new_iters = clamp(max_iterations + diff, 1, 5000);
+void changeIterationsCuda(CudaEngine *cuda, int diff) {
+	int new_iters = clamp(cuda->max_iterations + diff, 1, MAX_ITERATIONS);
 	mandelLog(INFO, "Changing Maximum Iterations to %d\n", new_iters);
-	max_iterations = new_iters;
+	cuda->max_iterations = new_iters;
 }
 
-void changeExponentCuda(int diff) {
-	int new_exponent = clamp(exponent + diff, 1, 200);
+void changeExponentCuda(CudaEngine *cuda, int diff) {
+	int new_exponent = clamp(cuda->exponent + diff, 1, MAX_EXPONENT);
 	mandelLog(INFO, "Changing Exponent to %d\n", new_exponent);
-	exponent = new_exponent;
+	cuda->exponent = new_exponent;
 }
 
-int getDeviceAttributes() {
+static int getDeviceAttributes() {
 	int ret;
 	int cur_device;
 
@@ -124,85 +131,115 @@ error:
 	return -1;
 }
 
-int mandelbrotCudaInit(int w, int h) {
+CudaEngine *mandelbrotCudaCreate(int w, int h) {
 	mandelLog(VERBOSE, "Starting Cuda Mandelbrot Engine...\n");
 	mandelLog(VERBOSE, "To not use Cuda, specify the --force-cpu command line flag.\n");
 	int *img_data = NULL;
+	CudaEngine *cuda = (CudaEngine *)calloc(1, sizeof(CudaEngine));
+	if(cuda == NULL)
+		return NULL;
+	cuda->max_iterations = DEFAULT_ITERATIONS;
+	cuda->exponent = DEFAULT_EXPONENT;
+
 	int ret = cudaMalloc(&img_data, w * h * sizeof(int));
 	if(ret != cudaSuccess) goto error;
-	mandelbuffer = {w, h, w*h, img_data};
+	cuda->mandelbuffer = {w, h, w*h, img_data};
 
 	ret = getDeviceAttributes();
 	if(ret != cudaSuccess) goto error;
 
-	return 0;
+	return cuda;
 error:
 	if(img_data != NULL)
 		cudaFree(img_data);
-	return ret;
+	free(cuda);
+	return NULL;
 }
 
-void mandelbrotCudaCleanup() {
+void mandelbrotCudaDestroy(CudaEngine *cuda) {
+	if(cuda == NULL)
+		return;
 	mandelLog(VERBOSE, "Cleaning up Cuda Mandelbrot Engine...\n");
-	cudaFree(mandelbuffer.rgb_data);
+	cudaFree(cuda->mandelbuffer.rgb_data);
+	if(cuda->mandelbuffer_wh.rgb_data != NULL)
+		cudaFree(cuda->mandelbuffer_wh.rgb_data);
+	mandelBufferFree(&cuda->aa_buffer);
+	free(cuda);
 }
 
-int resizeFramebufferCuda(int new_w, int new_h) {
-	int alloc_diff = mandelbuffer.alloc_size - new_w * new_h;
+int resizeFramebufferCuda(CudaEngine *cuda, int new_w, int new_h) {
+	MandelBuffer *mandelbuffer = &cuda->mandelbuffer;
+	int alloc_diff = mandelbuffer->alloc_size - new_w * new_h;
 	if(alloc_diff > 0 && alloc_diff < OVERALLOC_LIMIT) {
 		// When the necessary size is already overallocated and below the
 		// overallocation-limit we don't reallocate
-		mandelbuffer.w = new_w;
-		mandelbuffer.h = new_h;
+		mandelbuffer->w = new_w;
+		mandelbuffer->h = new_h;
 		return 0;
 	}
 
 	// Reallocation is needed
 	// We overallocate half of the overallocation limit for good flexibility
-	cudaFree(mandelbuffer.rgb_data);
+	cudaFree(mandelbuffer->rgb_data);
+	*mandelbuffer = {0, 0, 0, NULL};
 	int *img_data = NULL;
 	int alloc_size = new_w * new_h + (OVERALLOC_LIMIT / 2);
 	if(cudaMalloc(&img_data, alloc_size * sizeof(int)) != cudaSuccess) {
 		return -1;
 	}
-	mandelbuffer = {new_w, new_h, alloc_size, img_data};
+	*mandelbuffer = {new_w, new_h, alloc_size, img_data};
 	return 0;
 }
 
-void generateImageCuda(Rectangle coord_rect, int *out_argb) {
+void generateImageCuda(CudaEngine *cuda, Rectangle coord_rect, int *out_argb) {
 	if(out_argb == NULL)
 		return;
+	MandelBuffer &mandelbuffer = cuda->mandelbuffer;
 
 	mandelbrot<<<RENDER_THREAD_BLOCKS, RENDER_THREADS>>>(mandelbuffer.w, mandelbuffer.h,
 			coord_rect.x, coord_rect.y,
-			coord_rect.w, coord_rect.h, ESCAPE_RADIUS, mandelbuffer.rgb_data, max_iterations, exponent);
+			coord_rect.w, coord_rect.h, ESCAPE_RADIUS, mandelbuffer.rgb_data,
+			cuda->max_iterations, cuda->exponent);
 	cudaDeviceSynchronize();
 
 	cudaMemcpy(out_argb, mandelbuffer.rgb_data,
 			mandelbuffer.w * mandelbuffer.h * sizeof(int), cudaMemcpyDeviceToHost);
 }
 
-void generateImageCudaWH(int w, int h, Rectangle coord_rect, int *out_argb) {
+void generateImageCudaWH(CudaEngine *cuda, int w, int h, Rectangle coord_rect, int *out_argb) {
 	if(out_argb == NULL)
 		return;
-
-	int *out;
-	if(cudaMalloc(&out, w * h * sizeof(int)) != cudaSuccess) {
-		// Allocation error
-		return;
+	MandelBuffer &mandelbuffer_wh = cuda->mandelbuffer_wh;
+
+	// Only reallocate when the buffer is too small or way too large
+	int alloc_diff = mandelbuffer_wh.alloc_size - w * h;
+	if(mandelbuffer_wh.rgb_data == NULL || alloc_diff < 0 || alloc_diff >= OVERALLOC_LIMIT) {
+		if(mandelbuffer_wh.rgb_data != NULL)
+			cudaFree(mandelbuffer_wh.rgb_data);
+		int *img_data = NULL;
+		int alloc_size = w * h + (OVERALLOC_LIMIT / 2);
+		if(cudaMalloc(&img_data, alloc_size * sizeof(int)) != cudaSuccess) {
+			// Allocation error
+			mandelbuffer_wh = {0, 0, 0, NULL};
+			return;
+		}
+		mandelbuffer_wh = {w, h, alloc_size, img_data};
 	}
+	int *out = mandelbuffer_wh.rgb_data;
+
 	mandelbrot<<<RENDER_THREAD_BLOCKS, RENDER_THREADS>>>(w, h, coord_rect.x, coord_rect.y,
-			coord_rect.w, coord_rect.h, ESCAPE_RADIUS, out, max_iterations, exponent);
+			coord_rect.w, coord_rect.h, ESCAPE_RADIUS, out, cuda->max_iterations, cuda->exponent);
 	cudaDeviceSynchronize();
 
 	cudaMemcpy(out_argb, out, w * h * sizeof(int), cudaMemcpyDeviceToHost);
-	cudaFree(out);
 }
 
 // aa_counter defines the shift and blend percentage
-void doAntiAliasCuda(Rectangle coord_rect, int *argb_buf, int aa_counter) {
+void doAntiAliasCuda(CudaEngine *cuda, Rectangle coord_rect, int *argb_buf, int aa_counter) {
 	if(argb_buf == NULL)
 		return;
+	MandelBuffer &mandelbuffer = cuda->mandelbuffer;
+	MandelBuffer &aa_buffer = cuda->aa_buffer;
 	if(aa_counter < 0 || aa_counter > 7)
 		return;
 
@@ -236,21 +273,20 @@ void doAntiAliasCuda(Rectangle coord_rect, int *argb_buf, int aa_counter) {
 
 	mandelbrot<<<RENDER_THREAD_BLOCKS, RENDER_THREADS>>>(mandelbuffer.w, mandelbuffer.h,
 			shift_x, shift_y,
-			coord_rect.w, coord_rect.h, ESCAPE_RADIUS, mandelbuffer.rgb_data, max_iterations, exponent);
+			coord_rect.w, coord_rect.h, ESCAPE_RADIUS, mandelbuffer.rgb_data,
+			cuda->max_iterations, cuda->exponent);
 	cudaDeviceSynchronize();
 
 	aa_counter += 2;
 
-	int *rgb_data = (int *)malloc(mandelbuffer.w * mandelbuffer.h * sizeof(int));
+	if(mandelBufferResize(&aa_buffer, mandelbuffer.w, mandelbuffer.h))
+		return;
+	int *rgb_data = aa_buffer.rgb_data;
 	cudaMemcpy(rgb_data, mandelbuffer.rgb_data,
 			mandelbuffer.w * mandelbuffer.h * sizeof(int), cudaMemcpyDeviceToHost);
 
 	// blend them together
-	for(int i = 0; i < mandelbuffer.w * mandelbuffer.h; i++) {
-		int blend_color = blend(argb_buf[i], rgb_data[i], 1.0 / aa_counter);
-		argb_buf[i] = 0xff000000 | blend_color; // apply full alpha
-	}
-	free(rgb_data);
+	imageBlend(NULL, argb_buf, rgb_data, mandelbuffer.w * mandelbuffer.h, 1.0 / aa_counter);
 }
 
 }
@@ -3,16 +3,25 @@
 
 #include "mandelbrot_common.h"
 
-int mandelbrotCudaInit(int w, int h);
-void mandelbrotCudaCleanup();
+/*
+ * All state of the Cuda engine lives in a CudaEngine context like that of
+ * the CPU engine, so several contexts with different settings can render
+ * on the same device. A single context must only be used by one thread at
+ * a time.
+ */
+typedef struct CudaEngine CudaEngine;
 
-int resizeFramebufferCuda(int new_w, int new_h);
+// Returns NULL if there is no usable device
+CudaEngine *mandelbrotCudaCreate(int w, int h);
+void mandelbrotCudaDestroy(CudaEngine *cuda);
 
-void generateImageCuda(Rectangle coord_rect, int *out_argb);
-void generateImageCudaWH(int w, int h, Rectangle coord_rect, int *out_argb);
-void doAntiAliasCuda(Rectangle coord_rect, int *argb_buf, int aa_counter);
+int resizeFramebufferCuda(CudaEngine *cuda, int new_w, int new_h);
 
-void changeIterationsCuda(int diff);
-void changeExponentCuda(int diff);
+void generateImageCuda(CudaEngine *cuda, Rectangle coord_rect, int *out_argb);
+void generateImageCudaWH(CudaEngine *cuda, int w, int h, Rectangle coord_rect, int *out_argb);
+void doAntiAliasCuda(CudaEngine *cuda, Rectangle coord_rect, int *argb_buf, int aa_counter);
+
+void changeIterationsCuda(CudaEngine *cuda, int diff);
+void changeExponentCuda(CudaEngine *cuda, int diff);
 
 #endif
@@ -0,0 +1,111 @@
+#include "net.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+int netIsUnixAddress(const char *address) {
+	return strchr(address, '/') != NULL || strrchr(address, ':') == NULL;
+}
+
+static int unixAddress(const char *path, struct sockaddr_un *addr) {
+	if(strlen(path) >= sizeof(addr->sun_path))
+		return -1;
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+// Resolves host:port, an empty host means every local interface
+static struct addrinfo *tcpAddress(const char *address, int passive) {
+	char host[256];
+	const char *colon = strrchr(address, ':');
+	int host_len = colon - address;
+	if(host_len >= (int)sizeof(host))
+		return NULL;
+	memcpy(host, address, host_len);
+	host[host_len] = '\0';
+
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	if(getaddrinfo(host_len > 0 ? host : NULL, colon + 1, &hints, &result) != 0)
+		return NULL;
+	return result;
+}
+
+int netListen(const char *address) {
+	int fd = -1;
+	if(netIsUnixAddress(address)) {
+		struct sockaddr_un addr;
+		if(unixAddress(address, &addr))
+			return -1;
+		// Remove the socket a previous process left behind, but nothing else
+		struct stat st;
+		if(stat(address, &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(address);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+			goto error;
+	} else {
+		struct addrinfo *info = tcpAddress(address, 1);
+		if(info == NULL)
+			return -1;
+		fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		int reuse = 1;
+		if(fd >= 0)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		int ret = fd < 0 ? -1 : bind(fd, info->ai_addr, info->ai_addrlen);
+		freeaddrinfo(info);
+		if(ret != 0)
+			goto error;
+	}
+	if(listen(fd, 16) != 0)
+		goto error;
+	return fd;
+
+error:
+	if(fd >= 0)
+		close(fd);
+	return -1;
+}
+
+int netConnect(const char *address) {
+	int fd = -1;
+	if(netIsUnixAddress(address)) {
+		struct sockaddr_un addr;
+		if(unixAddress(address, &addr))
+			return -1;
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+			goto error;
+	} else {
+		struct addrinfo *info = tcpAddress(address, 0);
+		if(info == NULL)
+			return -1;
+		fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		int ret = fd < 0 ? -1 : connect(fd, info->ai_addr, info->ai_addrlen);
+		freeaddrinfo(info);
+		if(ret != 0)
+			goto error;
+		// Requests are small lines that should go out immediately
+		int nodelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	}
+	return fd;
+
+error:
+	if(fd >= 0)
+		close(fd);
+	return -1;
+}
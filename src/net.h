@@ -0,0 +1,12 @@
+#ifndef _NET_H_
+#define _NET_H_
+
+// Addresses are either host:port for TCP or the path of a Unix domain socket.
+// Anything containing a '/' or no ':' at all is taken as a path.
+int netIsUnixAddress(const char *address);
+
+// Return a socket or -1 on error
+int netListen(const char *address);
+int netConnect(const char *address);
+
+#endif
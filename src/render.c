@@ -1,5 +1,7 @@
 #include "render.h"
 
+#include <limits.h>
+
 Renderer createRenderer(int init_w, int init_h) {	
 	int ret = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
 	if(ret != 0) {
@@ -25,52 +27,86 @@ Renderer createRenderer(int init_w, int init_h) {
 	SDL_RenderClear(renderer);
 	SDL_RenderPresent(renderer);
 
-	Renderer r = {window, renderer, init_w, init_h};
+	// The texture is created lazily on the first upload
+	Renderer r = {window, renderer, NULL, 0, 0, init_w, init_h};
 
 	return r;
 }
 
-void destroyRenderer(Renderer to_destroy) {
-	SDL_DestroyRenderer(to_destroy.renderer);
-	SDL_DestroyWindow(to_destroy.window);
+void destroyRenderer(Renderer *to_destroy) {
+	if(to_destroy->texture != NULL)
+		SDL_DestroyTexture(to_destroy->texture);
+	SDL_DestroyRenderer(to_destroy->renderer);
+	SDL_DestroyWindow(to_destroy->window);
 	SDL_Quit();
 }
 
-void renderImage(Renderer renderer, int w, int h, int *argb_data) {
-	Uint32 rmask, gmask, bmask, amask;
-	rmask = 0x000000ff;
-	gmask = 0x0000ff00;
-	bmask = 0x00ff0000;
-	amask = 0xff000000;
-
-	SDL_Surface *surface = SDL_CreateRGBSurfaceFrom(argb_data, w, h, 32, w * 4,
-			rmask, gmask, bmask, amask);
-	if(surface == NULL) {
-		mandelLog(WARN, "Surface was null! Dropping frame.\n");
-		return;
+// (Re)creates the streaming texture only when the framebuffer size changed
+static int ensureTexture(Renderer *renderer, int w, int h) {
+	if(renderer->texture != NULL && renderer->tex_w == w && renderer->tex_h == h)
+		return 0;
+
+	if(renderer->texture != NULL)
+		SDL_DestroyTexture(renderer->texture);
+
+	// Our pixels are 0xAABBGGRR integers, which is what ABGR8888 describes
+	renderer->texture = SDL_CreateTexture(renderer->renderer,
+			SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, w, h);
+	if(renderer->texture == NULL) {
+		mandelLog(WARN, "Could not create texture: %s\n", SDL_GetError());
+		renderer->tex_w = 0;
+		renderer->tex_h = 0;
+		return -1;
 	}
+	mandelLog(DEBUG, "Created streaming texture of size %dx%d\n", w, h);
+	renderer->tex_w = w;
+	renderer->tex_h = h;
+	return 0;
+}
+
+void presentImage(Renderer *renderer) {
+	SDL_RenderClear(renderer->renderer);
+	if(renderer->texture != NULL)
+		SDL_RenderCopy(renderer->renderer, renderer->texture, NULL, NULL);
+	SDL_RenderPresent(renderer->renderer);
+}
 
-	SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer.renderer,
-			surface);
-	SDL_FreeSurface(surface);
-	if(texture == NULL) {
+void renderImageRects(Renderer *renderer, int w, int h, int *argb_data,
+		const SDL_Rect *dirty, int ndirty) {
+	int recreated = renderer->texture == NULL ||
+			renderer->tex_w != w || renderer->tex_h != h;
+	if(ensureTexture(renderer, w, h)) {
 		mandelLog(WARN, "Texture was null! Dropping frame.\n");
 		return;
 	}
 
-	SDL_RenderClear(renderer.renderer);
-	SDL_RenderCopy(renderer.renderer, texture, NULL, NULL);
-	SDL_RenderPresent(renderer.renderer);
+	// A fresh texture has undefined content so it always needs a full upload
+	if(dirty == NULL || recreated) {
+		SDL_UpdateTexture(renderer->texture, NULL, argb_data, w * 4);
+	} else {
+		for(int i = 0; i < ndirty; i++) {
+			SDL_Rect r = dirty[i];
+			if(r.w <= 0 || r.h <= 0)
+				continue;
+			SDL_UpdateTexture(renderer->texture, &r,
+					argb_data + r.y * w + r.x, w * 4);
+		}
+	}
 
-	SDL_DestroyTexture(texture);
+	presentImage(renderer);
 }
 
-void writeToBmp(const char *path, short width, short height, int *data) {
-	FILE *out_fd = fopen(path, "wb");
-	if(out_fd == NULL) {
-		mandelLog(ERROR, "Could not open file for writing BMP data: %s\n", path);
-		return;
-	}
+void renderImage(Renderer *renderer, int w, int h, int *argb_data) {
+	renderImageRects(renderer, w, h, argb_data, NULL, 0);
+}
+
+long long bmpFileSize(int width, int height) {
+	return 54 + ((long long)width * 3 + width % 4) * height;
+}
+
+// Encodes the image as a 24 bit BMP file in memory
+// Returns a buffer of *size bytes that has to be freed, or NULL on error
+unsigned char *encodeBmp(short width, short height, const int *data, int *size) {
 	int line_padding = width % 4;
 	unsigned char header[] = {0x42, 0x4d, 0x36, 0xa2, 0x4a, 0x04, 0x00, 0x00,
 							0x00, 0x00, 0x36, 0x00, 0x00, 0x00, 0x28, 0x00,
@@ -79,25 +115,53 @@ void writeToBmp(const char *path, short width, short height, int *data) {
 							0x00, 0x00, 0x00, 0xa2, 0x4a, 0x04, 0x00, 0x00,
 							0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 							0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-	int file_size = 54 + width * height * 3 + height * line_padding;
-	mandelLog(INFO, "Writing %d bytes of data to %s\n", file_size, path);
+	if(bmpFileSize(width, height) > INT_MAX) {
+		mandelLog(ERROR, "A %dx%d image is too large for a BMP file\n", width, height);
+		return NULL;
+	}
+	int file_size = (int)bmpFileSize(width, height);
+	unsigned char *bmp = (unsigned char *)malloc(file_size);
+	if(bmp == NULL)
+		return NULL;
 	memcpy(header + 0x02, &file_size, 4);
 	memcpy(header + 0x12, &width, 2);
 	memcpy(header + 0x16, &height, 2);
-	fwrite(header, 1, 0x36, out_fd);
+	memcpy(bmp, header, 0x36);
 
-	int zero = 0;
+	unsigned char *pos = bmp + 0x36;
 	int col;
 	for (int i = 0; i < height; i++) {
-        	for(int j = 0; j < width; j++) {
+		for(int j = 0; j < width; j++) {
 			col = data[i * width + j];
-			col = ((col & 0xff) << 16) | (col & 0xff00) |
-					((col & 0xff0000) >> 16);
-        		fwrite(&col, 1, 3, out_fd);
-        	}
-	        fwrite(&zero, 1, line_padding, out_fd);
+			// Pixels are 0xAABBGGRR, BMP stores blue, green, red
+			*pos++ = (col >> 16) & 0xff;
+			*pos++ = (col >> 8) & 0xff;
+			*pos++ = col & 0xff;
+		}
+		memset(pos, 0, line_padding);
+		pos += line_padding;
 	}
 
+	*size = file_size;
+	return bmp;
+}
+
+void writeToBmp(const char *path, short width, short height, int *data) {
+	int file_size;
+	unsigned char *bmp = encodeBmp(width, height, data, &file_size);
+	if(bmp == NULL) {
+		mandelLog(ERROR, "Could not allocate memory for BMP data!\n");
+		return;
+	}
+	FILE *out_fd = fopen(path, "wb");
+	if(out_fd == NULL) {
+		mandelLog(ERROR, "Could not open file for writing BMP data: %s\n", path);
+		free(bmp);
+		return;
+	}
+	mandelLog(INFO, "Writing %d bytes of data to %s\n", file_size, path);
+	fwrite(bmp, 1, file_size, out_fd);
 	fclose(out_fd);
+	free(bmp);
 }
 
@@ -10,16 +10,31 @@
 typedef struct Renderer {
 	SDL_Window *window;
 	SDL_Renderer *renderer;
+	// Persistent streaming texture, sized to the framebuffer
+	SDL_Texture *texture;
+	int tex_w;
+	int tex_h;
 	int width;
 	int height;
 } Renderer;
 
 Renderer createRenderer(int init_w, int init_h);
 
-void renderImage(Renderer renderer, int w, int h, int *argb_data);
-
-void destroyRenderer(Renderer to_destroy);
-
+// Uploads the whole image and presents it
+void renderImage(Renderer *renderer, int w, int h, int *argb_data);
+// Uploads only the dirty rectangles of the image and presents it
+// A dirty list of NULL uploads the whole image
+void renderImageRects(Renderer *renderer, int w, int h, int *argb_data,
+		const SDL_Rect *dirty, int ndirty);
+// Presents the texture again without uploading anything
+void presentImage(Renderer *renderer);
+
+void destroyRenderer(Renderer *to_destroy);
+
+// Bytes of the BMP file of a width x height image. Images whose file
+// doesn't fit into an int can't be encoded.
+long long bmpFileSize(int width, int height);
+unsigned char *encodeBmp(short width, short height, const int *data, int *size);
 void writeToBmp(const char *path, short width, short height, int *data);
 
 #endif
@@ -0,0 +1,189 @@
+#include "screenshot.h"
+#include "image_ops.h"
+#include "render.h"
+#include "logger.h"
+#include "config.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct BmpWriter {
+	char path[SCREENSHOT_MAX_PATH];
+	int w;
+	int h;
+	int *image;
+	atomic_int *writers;
+} BmpWriter;
+
+static int writeBmp(void *voidwriter) {
+	BmpWriter *writer = (BmpWriter *)voidwriter;
+	writeToBmp(writer->path, writer->w, writer->h, writer->image);
+	atomic_fetch_sub(writer->writers, 1);
+	free(writer->image);
+	free(writer);
+	return 0;
+}
+
+// Takes ownership of image
+static void startWriter(ScreenshotQueue *queue, const char *path, int w, int h, int *image) {
+	BmpWriter *writer = (BmpWriter *)malloc(sizeof(BmpWriter));
+	if(writer == NULL) {
+		writeToBmp(path, w, h, image);
+		free(image);
+		return;
+	}
+	snprintf(writer->path, sizeof(writer->path), "%s", path);
+	writer->w = w;
+	writer->h = h;
+	writer->image = image;
+	writer->writers = &queue->writers;
+
+	atomic_fetch_add(&queue->writers, 1);
+	SDL_Thread *thread = SDL_CreateThread(writeBmp, "ScreenshotWriter", writer);
+	if(thread == NULL) {
+		// Write it on this thread instead
+		writeBmp(writer);
+		return;
+	}
+	SDL_DetachThread(thread);
+}
+
+void screenshotQueueInit(ScreenshotQueue *queue, const char *dir) {
+	memset(queue, 0, sizeof(ScreenshotQueue));
+	queue->next_id = 1;
+	queue->dir = dir;
+	atomic_init(&queue->writers, 0);
+}
+
+void screenshotQueueFree(ScreenshotQueue *queue) {
+	for(int i = 0; i < queue->count; i++) {
+		ScreenshotJob *job = &queue->jobs[(queue->first + i) % SCREENSHOT_MAX_JOBS];
+		mandelLog(WARN, "Dropping unfinished screenshot %u\n", job->id);
+		free(job->image);
+	}
+	queue->count = 0;
+	free(queue->band);
+	queue->band = NULL;
+	queue->band_size = 0;
+
+	while(atomic_load(&queue->writers) > 0)
+		SDL_Delay(10);
+}
+
+int screenshotQueueAdd(ScreenshotQueue *queue, const ViewState *view,
+		int width, int height, int supersample) {
+	// Sizes are stored in 16 bits in the BMP header
+	if(width < 1 || height < 1 || width > 32767 || height > 32767) {
+		mandelLog(ERROR, "Invalid screenshot size %dx%d\n", width, height);
+		return -1;
+	}
+	// Checked before rendering for minutes only to lose the image
+	if(bmpFileSize(width, height) > INT_MAX) {
+		mandelLog(ERROR, "A %dx%d screenshot is too large for a BMP file\n", width, height);
+		return -1;
+	}
+	if(supersample < 1 || supersample > IMAGE_MAX_BOX_FACTOR) {
+		mandelLog(ERROR, "Supersampling has to be between 1 and %d\n", IMAGE_MAX_BOX_FACTOR);
+		return -1;
+	}
+	if(queue->count == SCREENSHOT_MAX_JOBS) {
+		mandelLog(WARN, "Too many screenshots in progress, dropping Screenshot\n");
+		return -1;
+	}
+
+	ScreenshotJob *job = &queue->jobs[(queue->first + queue->count) % SCREENSHOT_MAX_JOBS];
+	memset(job, 0, sizeof(ScreenshotJob));
+
+	// Never overwrites files, also not those of earlier runs
+	char stamp[32];
+	time_t now = time(NULL);
+	struct tm local;
+	localtime_r(&now, &local);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+	do {
+		job->id = queue->next_id++;
+		snprintf(job->path, sizeof(job->path), "%s/mandelbrot-%s-%u.bmp",
+				queue->dir, stamp, job->id);
+	} while(access(job->path, F_OK) == 0);
+
+	job->job = (RenderJob) {view->rect, width, height, view->iterations, view->exponent,
+			0, {0, 0, 0, 0}};
+	job->supersample = supersample;
+	queue->count++;
+	mandelLog(INFO, "Queued screenshot %u: %dx%d with %dx%d samples per pixel, saving to %s\n",
+			job->id, width, height, supersample, supersample, job->path);
+	return 0;
+}
+
+int screenshotPending(const ScreenshotQueue *queue) {
+	return queue->count > 0;
+}
+
+static void dropFirst(ScreenshotQueue *queue) {
+	queue->first = (queue->first + 1) % SCREENSHOT_MAX_JOBS;
+	queue->count--;
+}
+
+void screenshotRenderBand(ScreenshotQueue *queue, const Engine *engine,
+		ThreadPool *pool, int max_samples) {
+	if(queue->count == 0)
+		return;
+	ScreenshotJob *job = &queue->jobs[queue->first];
+	int w = job->job.width;
+	int h = job->job.height;
+	int ss = job->supersample;
+
+	if(job->image == NULL) {
+		job->image = (int *)malloc((size_t)w * h * sizeof(int));
+		if(job->image == NULL) {
+			mandelLog(ERROR, "Could not allocate memory for Screenshot %u!\n", job->id);
+			dropFirst(queue);
+			return;
+		}
+		job->start_ticks = SDL_GetTicks();
+	}
+
+	int rows = max_samples / (w * ss * ss);
+	rows = rows < 1 ? 1 : rows > h - job->next_row ? h - job->next_row : rows;
+	int band_size = w * ss * rows * ss;
+	if(band_size > queue->band_size) {
+		free(queue->band);
+		queue->band = (int *)malloc(band_size * sizeof(int));
+		queue->band_size = queue->band != NULL ? band_size : 0;
+	}
+
+	// The band is a part of the supersampled image, so bands meet seamlessly
+	RenderJob band = job->job;
+	band.width = w * ss;
+	band.height = h * ss;
+	band.part = (Tile){0, job->next_row * ss, w * ss, rows * ss};
+	if(queue->band == NULL || engine->renderBatch(&band, &queue->band, 1) ||
+			imageDownscaleBox(pool, queue->band, band.part.w, band.part.h, ss,
+				job->image + job->next_row * w)) {
+		mandelLog(ERROR, "Could not render Screenshot %u!\n", job->id);
+		free(job->image);
+		dropFirst(queue);
+		return;
+	}
+
+	job->next_row += rows;
+	int progress = (int)((long)job->next_row * 100 / h);
+	if(job->next_row < h) {
+		if(progress / SCREENSHOT_PROGRESS_STEP > job->reported / SCREENSHOT_PROGRESS_STEP) {
+			mandelLog(INFO, "Screenshot %u: %d%%\n", job->id, progress);
+			job->reported = progress;
+		}
+		return;
+	}
+
+	mandelLog(INFO, "Screenshot %u rendered in %.2f s\n", job->id,
+			(SDL_GetTicks() - job->start_ticks) / 1000.0);
+	startWriter(queue, job->path, w, h, job->image);
+	dropFirst(queue);
+}
@@ -0,0 +1,60 @@
+#ifndef _SCREENSHOT_H_
+#define _SCREENSHOT_H_
+
+#include <stdatomic.h>
+
+#include "engine.h"
+#include "view_state.h"
+#include "threadpool.h"
+
+#define SCREENSHOT_MAX_JOBS 8
+#define SCREENSHOT_MAX_PATH 512
+
+typedef struct ScreenshotJob {
+	unsigned int id;
+	char path[SCREENSHOT_MAX_PATH];
+	RenderJob job;   // Of the image at its final size
+	int supersample; // Samples per pixel along each axis
+	int next_row;    // First row that isn't rendered yet
+	int *image;      // Allocated once rendering starts
+	int reported;    // Progress in percent that was last reported
+	unsigned int start_ticks; // When rendering started
+} ScreenshotJob;
+
+/*
+ * Screenshots waiting to be rendered by the compute stage. They are
+ * rendered in bands of rows whenever there is no interactive work, so a
+ * large screenshot never holds up frames for more than one band. Complete
+ * images are written by a background thread.
+ */
+typedef struct ScreenshotQueue {
+	ScreenshotJob jobs[SCREENSHOT_MAX_JOBS];
+	int first;
+	int count;
+	unsigned int next_id;
+	const char *dir;
+	// Supersampled rows of the current band
+	int *band;
+	int band_size;
+	atomic_int writers; // Images that are still being written
+} ScreenshotQueue;
+
+void screenshotQueueInit(ScreenshotQueue *queue, const char *dir);
+
+// Waits for images that are being written, drops unfinished screenshots
+void screenshotQueueFree(ScreenshotQueue *queue);
+
+// Queues a width x height screenshot of the view, rendered with
+// supersample x supersample samples per pixel. Returns nonzero on errors.
+int screenshotQueueAdd(ScreenshotQueue *queue, const ViewState *view,
+		int width, int height, int supersample);
+
+int screenshotPending(const ScreenshotQueue *queue);
+
+// Renders the next band of the oldest screenshot, with roughly max_samples
+// samples in it, and hands the image to the writer once it is complete.
+// The band is downscaled on the workers of pool, if not NULL.
+void screenshotRenderBand(ScreenshotQueue *queue, const Engine *engine,
+		ThreadPool *pool, int max_samples);
+
+#endif
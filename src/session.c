@@ -0,0 +1,372 @@
+#include "session.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SESSION_HEADER "# mandelbrot session 1\n"
+// Followed by x y w h x_lo y_lo of the rectangle, width, height, iterations,
+// exponent and whether the iterations are automatic
+#define SESSION_VIEW "# view"
+// Time the replay waits for the view of the last event to complete
+#define REPLAY_SETTLE_MS 30000
+
+static FILE *record_file = NULL;
+static Uint32 record_start;
+
+typedef struct ReplayEvent {
+	Uint32 time; // Milliseconds after the start of the session
+	SDL_Event ev;
+} ReplayEvent;
+
+static ReplayEvent *replay_events = NULL;
+static int nreplay_events = 0;
+static SDL_Thread *replay_thread = NULL;
+static volatile int replay_stop = 0;
+
+typedef struct LatencyRecord {
+	InputKind kind;
+	unsigned int view_seq;
+	Uint64 input;
+	double first_ms; // Until the first frame showing the input, -1 until then
+	double final_ms; // Until the view is complete, -1 if another input came first
+} LatencyRecord;
+
+static const char *kind_names[INPUT_KINDS] = {"wheel", "key", "drag", "resize"};
+
+static SDL_mutex *latency_mutex = NULL;
+static LatencyRecord *records = NULL;
+static int nrecords = 0;
+static int records_alloc = 0;
+// Records before these indices have their first or final frame
+static int first_pending = 0;
+static int final_pending = 0;
+
+int sessionRecordStart(const char *path, const ViewState *view) {
+	record_file = fopen(path, "w");
+	if(record_file == NULL) {
+		mandelLog(ERROR, "Could not open %s for recording\n", path);
+		return -1;
+	}
+	fputs(SESSION_HEADER, record_file);
+	const Rectangle *r = &view->rect;
+	fprintf(record_file, SESSION_VIEW " %.17g %.17g %.17g %.17g %.17g %.17g %d %d %d %d %d\n",
+			r->x, r->y, r->w, r->h, r->x_lo, r->y_lo, view->w, view->h,
+			view->iterations, view->exponent, view->auto_iters);
+	record_start = SDL_GetTicks();
+	mandelLog(INFO, "Recording input session to %s\n", path);
+	return 0;
+}
+
+void sessionRecord(const SDL_Event *ev, int mouse_x, int mouse_y) {
+	if(record_file == NULL)
+		return;
+	Uint32 t = SDL_GetTicks() - record_start;
+
+	switch(ev->type) {
+		case SDL_MOUSEWHEEL:
+			fprintf(record_file, "%u wheel %d %d %d\n", t, ev->wheel.y, mouse_x, mouse_y);
+			break;
+		case SDL_KEYDOWN:
+			// The replay ends the session by itself
+			if(ev->key.keysym.sym == SDLK_q || ev->key.keysym.sym == SDLK_ESCAPE)
+				break;
+			fprintf(record_file, "%u key %d %d\n", t, (int)ev->key.keysym.sym,
+					(int)ev->key.keysym.mod);
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			fprintf(record_file, "%u button %s %d %d %d\n", t,
+					ev->type == SDL_MOUSEBUTTONDOWN ? "down" : "up",
+					ev->button.button, ev->button.x, ev->button.y);
+			break;
+		case SDL_MOUSEMOTION:
+			// Only drags change the view
+			if(ev->motion.state != 0)
+				fprintf(record_file, "%u motion %d %d %d %d\n", t, ev->motion.x,
+						ev->motion.y, ev->motion.xrel, ev->motion.yrel);
+			break;
+		case SDL_WINDOWEVENT:
+			if(ev->window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+				fprintf(record_file, "%u resize %d %d\n", t, ev->window.data1, ev->window.data2);
+			break;
+	}
+}
+
+void sessionRecordStop() {
+	if(record_file == NULL)
+		return;
+	fclose(record_file);
+	record_file = NULL;
+}
+
+static ReplayEvent *addReplayEvent(Uint32 time, Uint32 type) {
+	ReplayEvent *events = (ReplayEvent *)realloc(replay_events,
+			(nreplay_events + 1) * sizeof(ReplayEvent));
+	if(events == NULL)
+		return NULL;
+	replay_events = events;
+	ReplayEvent *event = &replay_events[nreplay_events++];
+	memset(event, 0, sizeof(ReplayEvent));
+	event->time = time;
+	event->ev.type = type;
+	return event;
+}
+
+static int loadSession(const char *path) {
+	FILE *file = fopen(path, "r");
+	if(file == NULL) {
+		mandelLog(ERROR, "Could not open session %s\n", path);
+		return -1;
+	}
+
+	char line[256];
+	int line_nr = 0;
+	while(fgets(line, sizeof(line), file) != NULL) {
+		line_nr++;
+		unsigned int t;
+		char kind[16], dir[8];
+		int a, b, c, d;
+		ReplayEvent *event = NULL;
+
+		if(line[0] == '#' || line[0] == '\n')
+			continue;
+		if(sscanf(line, "%u %15s", &t, kind) != 2)
+			goto malformed;
+
+		if(strcmp(kind, "wheel") == 0 && sscanf(line, "%*u %*s %d %d %d", &a, &b, &c) == 3) {
+			// Moves the mouse to where the wheel was turned first
+			event = addReplayEvent(t, SDL_MOUSEMOTION);
+			if(event != NULL) {
+				event->ev.motion.x = b;
+				event->ev.motion.y = c;
+				event = addReplayEvent(t, SDL_MOUSEWHEEL);
+			}
+			if(event != NULL)
+				event->ev.wheel.y = a;
+		} else if(strcmp(kind, "key") == 0 && sscanf(line, "%*u %*s %d %d", &a, &b) == 2) {
+			event = addReplayEvent(t, SDL_KEYDOWN);
+			if(event != NULL) {
+				event->ev.key.state = SDL_PRESSED;
+				event->ev.key.keysym.sym = a;
+				event->ev.key.keysym.mod = b;
+			}
+		} else if(strcmp(kind, "button") == 0 &&
+				sscanf(line, "%*u %*s %7s %d %d %d", dir, &a, &b, &c) == 4) {
+			int down = strcmp(dir, "down") == 0;
+			event = addReplayEvent(t, down ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP);
+			if(event != NULL) {
+				event->ev.button.state = down ? SDL_PRESSED : SDL_RELEASED;
+				event->ev.button.button = a;
+				event->ev.button.x = b;
+				event->ev.button.y = c;
+			}
+		} else if(strcmp(kind, "motion") == 0 &&
+				sscanf(line, "%*u %*s %d %d %d %d", &a, &b, &c, &d) == 4) {
+			event = addReplayEvent(t, SDL_MOUSEMOTION);
+			if(event != NULL) {
+				event->ev.motion.state = SDL_BUTTON_LMASK;
+				event->ev.motion.x = a;
+				event->ev.motion.y = b;
+				event->ev.motion.xrel = c;
+				event->ev.motion.yrel = d;
+			}
+		} else if(strcmp(kind, "resize") == 0 && sscanf(line, "%*u %*s %d %d", &a, &b) == 2) {
+			event = addReplayEvent(t, SDL_WINDOWEVENT);
+			if(event != NULL) {
+				event->ev.window.event = SDL_WINDOWEVENT_SIZE_CHANGED;
+				event->ev.window.data1 = a;
+				event->ev.window.data2 = b;
+			}
+		} else {
+			goto malformed;
+		}
+
+		if(event == NULL) {
+			mandelLog(ERROR, "Could not allocate memory for the session!\n");
+			fclose(file);
+			return -1;
+		}
+	}
+	fclose(file);
+	return 0;
+
+malformed:
+	mandelLog(ERROR, "Malformed line %d in session %s\n", line_nr, path);
+	fclose(file);
+	return -1;
+}
+
+int sessionReplayView(const char *path, ViewState *view) {
+	FILE *file = fopen(path, "r");
+	if(file == NULL) {
+		mandelLog(ERROR, "Could not open session %s\n", path);
+		return -1;
+	}
+
+	char line[256];
+	int found = 0;
+	while(!found && fgets(line, sizeof(line), file) != NULL && line[0] == '#') {
+		ViewState v;
+		memset(&v, 0, sizeof(v));
+		Rectangle *r = &v.rect;
+		found = sscanf(line, SESSION_VIEW " %lf %lf %lf %lf %lf %lf %d %d %d %d %d",
+				&r->x, &r->y, &r->w, &r->h, &r->x_lo, &r->y_lo, &v.w, &v.h,
+				&v.iterations, &v.exponent, &v.auto_iters) == 11;
+		if(found)
+			*view = v;
+	}
+	fclose(file);
+	return found ? 0 : 1;
+}
+
+static int lastViewComplete() {
+	SDL_LockMutex(latency_mutex);
+	int complete = final_pending == nrecords;
+	SDL_UnlockMutex(latency_mutex);
+	return complete;
+}
+
+// Sleeps until the given ticks, returns nonzero if the replay got stopped
+static int sleepUntil(Uint32 ticks) {
+	while(!replay_stop) {
+		Uint32 now = SDL_GetTicks();
+		if((Sint32)(ticks - now) <= 0)
+			return 0;
+		SDL_Delay(ticks - now < 10 ? ticks - now : 10);
+	}
+	return 1;
+}
+
+static int replayEvents(void *data) {
+	(void)data;
+	Uint32 start = SDL_GetTicks();
+	for(int i = 0; i < nreplay_events; i++) {
+		if(sleepUntil(start + replay_events[i].time))
+			return 0;
+		SDL_PushEvent(&replay_events[i].ev);
+	}
+
+	Uint32 settle_start = SDL_GetTicks();
+	while(!lastViewComplete() && SDL_GetTicks() - settle_start < REPLAY_SETTLE_MS) {
+		if(sleepUntil(SDL_GetTicks() + 10))
+			return 0;
+	}
+	mandelLog(INFO, "Replay finished after %.2f s\n", (SDL_GetTicks() - start) / 1000.0);
+
+	SDL_Event quit;
+	memset(&quit, 0, sizeof(quit));
+	quit.type = SDL_QUIT;
+	SDL_PushEvent(&quit);
+	return 0;
+}
+
+int sessionReplayStart(const char *path) {
+	if(loadSession(path))
+		return -1;
+	mandelLog(INFO, "Replaying %d events from %s\n", nreplay_events, path);
+	latencyEnable();
+	replay_stop = 0;
+	replay_thread = SDL_CreateThread(replayEvents, "ReplayThread", NULL);
+	if(replay_thread == NULL) {
+		mandelLog(ERROR, "Could not create Replay Thread!\n");
+		return -1;
+	}
+	return 0;
+}
+
+void sessionReplayStop() {
+	if(replay_thread != NULL) {
+		replay_stop = 1;
+		SDL_WaitThread(replay_thread, NULL);
+		replay_thread = NULL;
+	}
+	free(replay_events);
+	replay_events = NULL;
+	nreplay_events = 0;
+}
+
+void latencyEnable() {
+	if(latency_mutex == NULL)
+		latency_mutex = SDL_CreateMutex();
+}
+
+void latencyInput(InputKind kind, unsigned int view_seq) {
+	if(latency_mutex == NULL)
+		return;
+	SDL_LockMutex(latency_mutex);
+	if(nrecords == records_alloc) {
+		int new_alloc = records_alloc ? records_alloc * 2 : 1024;
+		LatencyRecord *new_records = (LatencyRecord *)realloc(records,
+				new_alloc * sizeof(LatencyRecord));
+		if(new_records == NULL) {
+			SDL_UnlockMutex(latency_mutex);
+			return;
+		}
+		records = new_records;
+		records_alloc = new_alloc;
+	}
+	records[nrecords++] = (LatencyRecord) {kind, view_seq,
+			SDL_GetPerformanceCounter(), -1.0, -1.0};
+	SDL_UnlockMutex(latency_mutex);
+}
+
+void latencyPresented(unsigned int view_seq, int final) {
+	if(latency_mutex == NULL)
+		return;
+	Uint64 now = SDL_GetPerformanceCounter();
+	double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+	SDL_LockMutex(latency_mutex);
+	for(; first_pending < nrecords && records[first_pending].view_seq <= view_seq; first_pending++)
+		records[first_pending].first_ms = (now - records[first_pending].input) * ms_per_tick;
+	for(; final && final_pending < nrecords && records[final_pending].view_seq <= view_seq; final_pending++) {
+		// Views that were replaced before completing have no final frame
+		if(records[final_pending].view_seq == view_seq)
+			records[final_pending].final_ms = (now - records[final_pending].input) * ms_per_tick;
+	}
+	SDL_UnlockMutex(latency_mutex);
+}
+
+static int compareDouble(const void *a, const void *b) {
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+// Logs count and percentiles of the measured latencies of one kind of input
+static void reportKind(const char *name, double *values, int n) {
+	if(n == 0) {
+		mandelLog(INFO, "  %-14s %6d\n", name, 0);
+		return;
+	}
+	qsort(values, n, sizeof(double), compareDouble);
+	mandelLog(INFO, "  %-14s %6d %8.2f %8.2f %8.2f %8.2f\n", name, n,
+			values[n / 2], values[n * 90 / 100], values[n * 99 / 100], values[n - 1]);
+}
+
+void latencyReport() {
+	if(latency_mutex == NULL)
+		return;
+	double *values = (double *)malloc((nrecords + 1) * sizeof(double));
+	if(values == NULL)
+		return;
+
+	mandelLog(INFO, "Input latency in ms over %d inputs:\n", nrecords);
+	mandelLog(INFO, "  %-14s %6s %8s %8s %8s %8s\n", "", "count", "p50", "p90", "p99", "max");
+	for(int kind = 0; kind < INPUT_KINDS; kind++) {
+		char name[32];
+		for(int final = 0; final < 2; final++) {
+			int n = 0;
+			for(int i = 0; i < nrecords; i++) {
+				double ms = final ? records[i].final_ms : records[i].first_ms;
+				if(records[i].kind == (InputKind)kind && ms >= 0.0)
+					values[n++] = ms;
+			}
+			snprintf(name, sizeof(name), "%s %s", kind_names[kind], final ? "final" : "first");
+			reportKind(name, values, n);
+		}
+	}
+	free(values);
+}
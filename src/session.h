@@ -0,0 +1,43 @@
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <SDL.h>
+
+#include "view_state.h"
+
+/*
+ * Recording and replay of input sessions, and the input latency statistics
+ * used to compare scheduler and kernel changes on realistic sessions.
+ */
+
+typedef enum {
+	INPUT_WHEEL,
+	INPUT_KEY,
+	INPUT_DRAG,
+	INPUT_RESIZE,
+	INPUT_KINDS
+} InputKind;
+
+// Writes the input events the view depends on into a session file, after
+// the view the session starts from.
+// Wheel events need the mouse position, which SDL doesn't put into them.
+int sessionRecordStart(const char *path, const ViewState *view);
+void sessionRecord(const SDL_Event *ev, int mouse_x, int mouse_y);
+void sessionRecordStop();
+
+// Pushes the events of a session file into the SDL event queue at their
+// recorded times and SDL_QUIT once the view of the last one is complete
+int sessionReplayStart(const char *path);
+// Reads the view a session file starts from into *view. Returns 1 for
+// sessions recorded without one, -1 if the file can't be read.
+int sessionReplayView(const char *path, ViewState *view);
+void sessionReplayStop();
+
+// Input latency tracking. view_seq numbers the views inputs lead to,
+// frames carry the number of the view they show.
+void latencyEnable();
+void latencyInput(InputKind kind, unsigned int view_seq);
+void latencyPresented(unsigned int view_seq, int final);
+void latencyReport();
+
+#endif
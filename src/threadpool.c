@@ -0,0 +1,148 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include <pthread.h>
+
+#include "threadpool.h"
+#include "logger.h"
+
+#include <stdlib.h>
+
+typedef struct PoolWorker {
+	ThreadPool *pool;
+	int idx;
+	int cpu; // -1 when not pinned
+	pthread_t thread;
+} PoolWorker;
+
+struct ThreadPool {
+	int nthreads;
+	PoolWorker *workers;
+	pthread_mutex_t run_mutex; // Serializes threadPoolRun
+
+	// Protects everything below
+	pthread_mutex_t lock;
+	pthread_cond_t start; // Broadcast when a new job was set
+	pthread_cond_t done;  // Signaled when the last worker finished the job
+	unsigned long generation; // Incremented with every job
+	int running; // Workers that haven't finished the current job yet
+	int quit;
+
+	// The current job, only written while all workers are idle
+	PoolJob job;
+	char *args;
+	size_t arg_size;
+};
+
+static void pinCurrentThread(int cpu) {
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		mandelLog(WARN, "Could not pin worker thread to CPU %d\n", cpu);
+		return;
+	}
+	mandelLog(DEBUG, "Pinned worker thread to CPU %d\n", cpu);
+#else
+	mandelLog(WARN, "Pinning threads is not supported on this platform\n");
+#endif
+}
+
+static void *workerMain(void *voidworker) {
+	PoolWorker *worker = (PoolWorker *)voidworker;
+	ThreadPool *pool = worker->pool;
+	unsigned long generation = 0;
+
+	if(worker->cpu >= 0)
+		pinCurrentThread(worker->cpu);
+
+	pthread_mutex_lock(&pool->lock);
+	while(1) {
+		while(pool->generation == generation && !pool->quit)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if(pool->quit)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		pool->job(pool->args + worker->idx * pool->arg_size);
+
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->running == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+ThreadPool *threadPoolCreate(int nthreads, const int *cpus, int ncpus) {
+	ThreadPool *pool = (ThreadPool *)calloc(1, sizeof(ThreadPool));
+	if(pool == NULL)
+		return NULL;
+
+	pool->workers = (PoolWorker *)calloc(nthreads, sizeof(PoolWorker));
+	if(pool->workers == NULL) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->run_mutex, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for(int i = 0; i < nthreads; i++) {
+		PoolWorker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->idx = i;
+		worker->cpu = (cpus != NULL && ncpus > 0) ? cpus[i % ncpus] : -1;
+		if(pthread_create(&worker->thread, NULL, workerMain, worker) != 0) {
+			mandelLog(ERROR, "Could not create worker thread!\n");
+			threadPoolDestroy(pool);
+			return NULL;
+		}
+		pool->nthreads++;
+	}
+
+	return pool;
+}
+
+void threadPoolDestroy(ThreadPool *pool) {
+	if(pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for(int i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->run_mutex);
+	free(pool->workers);
+	free(pool);
+}
+
+int threadPoolSize(ThreadPool *pool) {
+	return pool->nthreads;
+}
+
+void threadPoolRun(ThreadPool *pool, PoolJob job, void *args, size_t arg_size) {
+	pthread_mutex_lock(&pool->run_mutex);
+	pthread_mutex_lock(&pool->lock);
+	pool->job = job;
+	pool->args = (char *)args;
+	pool->arg_size = arg_size;
+	pool->running = pool->nthreads;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+
+	while(pool->running > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->run_mutex);
+}
@@ -0,0 +1,22 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <stddef.h>
+
+typedef struct ThreadPool ThreadPool;
+
+typedef int (*PoolJob)(void *args);
+
+// Creates nthreads persistent workers.
+// When cpus is not NULL worker i is pinned to cpus[i % ncpus].
+ThreadPool *threadPoolCreate(int nthreads, const int *cpus, int ncpus);
+void threadPoolDestroy(ThreadPool *pool);
+
+int threadPoolSize(ThreadPool *pool);
+
+// Runs job on every worker, worker i gets (char *)args + i * arg_size.
+// With an arg_size of 0 all workers share the same args.
+// Blocks until all workers are done. Concurrent calls are serialized.
+void threadPoolRun(ThreadPool *pool, PoolJob job, void *args, size_t arg_size);
+
+#endif
@@ -0,0 +1,169 @@
+#include "tile_cost.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+void costMapFree(CostMap *map) {
+	free(map->cells);
+	map->cells = NULL;
+	map->alloc = 0;
+	map->valid = 0;
+}
+
+void costMapInvalidate(CostMap *map) {
+	map->valid = 0;
+}
+
+// Iterations per pixel the map predicts at pixel (px, py) of a w x h image of rect
+static double predictPixel(const CostMap *map, Rectangle rect, int w, int h,
+		double px, double py) {
+	// Offsets are taken in double-double so deep views still line up
+	double dx = (rect.x - map->rect.x) + (rect.x_lo - map->rect.x_lo) + px * rect.w / w;
+	double dy = (rect.y - map->rect.y) + (rect.y_lo - map->rect.y_lo) + py * rect.h / h;
+	double col = floor(dx / map->rect.w * map->w / COST_CELL_SIZE);
+	double row = floor(dy / map->rect.h * map->h / COST_CELL_SIZE);
+	if(!(col >= 0 && col < map->cols && row >= 0 && row < map->rows))
+		return map->mean;
+	return map->cells[(int)row * map->cols + (int)col];
+}
+
+// Samples the tile about once per cell
+static long predictTile(const CostMap *map, Rectangle rect, int w, int h, Tile tile) {
+	int nx = (tile.w + COST_CELL_SIZE - 1) / COST_CELL_SIZE;
+	int ny = (tile.h + COST_CELL_SIZE - 1) / COST_CELL_SIZE;
+	double sum = 0.0;
+	for(int j = 0; j < ny; j++) {
+		for(int i = 0; i < nx; i++) {
+			sum += predictPixel(map, rect, w, h,
+					tile.x + (i + 0.5) * tile.w / nx, tile.y + (j + 0.5) * tile.h / ny);
+		}
+	}
+	return (long)(sum / (nx * ny) * tile.w * tile.h);
+}
+
+static int appendTile(ScheduledTile **schedule, int *alloc, int count, Tile tile, long cost) {
+	if(count == *alloc) {
+		int new_alloc = *alloc > 0 ? *alloc * 2 : 256;
+		ScheduledTile *grown = (ScheduledTile *)realloc(*schedule,
+				new_alloc * sizeof(ScheduledTile));
+		if(grown == NULL)
+			return -1;
+		*schedule = grown;
+		*alloc = new_alloc;
+	}
+	(*schedule)[count].tile = tile;
+	(*schedule)[count].cost = cost;
+	return count + 1;
+}
+
+// Halves the tile along its splittable edges until every part is cheaper
+// than target or reaches the minimum size
+static int splitTile(const CostMap *map, Rectangle rect, int w, int h, Tile tile, long cost,
+		long target, int vector_width, ScheduledTile **schedule, int *alloc, int count) {
+	// The left half ends on a vector, so only the right half may end in a partial one
+	int left = tile.w / 2 / vector_width * vector_width;
+	int split_x = left >= COST_MIN_TILE_SIZE && tile.w - left >= COST_MIN_TILE_SIZE;
+	int split_y = tile.h >= 2 * COST_MIN_TILE_SIZE;
+	if(cost <= target || (!split_x && !split_y))
+		return appendTile(schedule, alloc, count, tile, cost);
+
+	left = split_x ? left : tile.w;
+	int top = split_y ? tile.h / 2 : tile.h;
+	for(int j = 0; j < (split_y ? 2 : 1) && count >= 0; j++) {
+		for(int i = 0; i < (split_x ? 2 : 1) && count >= 0; i++) {
+			Tile part;
+			part.x = tile.x + i * left;
+			part.y = tile.y + j * top;
+			part.w = i == 0 ? left : tile.w - left;
+			part.h = j == 0 ? top : tile.h - top;
+			count = splitTile(map, rect, w, h, part, predictTile(map, rect, w, h, part),
+					target, vector_width, schedule, alloc, count);
+		}
+	}
+	return count;
+}
+
+static int compareCost(const void *a, const void *b) {
+	const ScheduledTile *x = (const ScheduledTile *)a, *y = (const ScheduledTile *)b;
+	if(x->cost != y->cost)
+		return x->cost < y->cost ? 1 : -1;
+	// Keep equally expensive tiles in row order
+	if(x->tile.y != y->tile.y)
+		return x->tile.y < y->tile.y ? -1 : 1;
+	return x->tile.x < y->tile.x ? -1 : x->tile.x > y->tile.x;
+}
+
+int costSchedule(const CostMap *map, Rectangle rect, int w, int h, int tile_size,
+		int vector_width, int nthreads, ScheduledTile **schedule, int *alloc) {
+	int ntiles = tileCount(w, h, tile_size);
+	int count = 0;
+
+	// A single worker takes all tiles, the order doesn't matter
+	if(!map->valid || nthreads < 2) {
+		for(int t = 0; t < ntiles && count >= 0; t++)
+			count = appendTile(schedule, alloc, count, tileAt(t, w, h, tile_size), 0);
+		return count;
+	}
+
+	long total = 0;
+	for(int t = 0; t < ntiles; t++)
+		total += predictTile(map, rect, w, h, tileAt(t, w, h, tile_size));
+	long target = total / ((long)nthreads * COST_CHUNKS_PER_THREAD);
+
+	for(int t = 0; t < ntiles && count >= 0; t++) {
+		Tile tile = tileAt(t, w, h, tile_size);
+		count = splitTile(map, rect, w, h, tile, predictTile(map, rect, w, h, tile),
+				target, vector_width, schedule, alloc, count);
+	}
+	if(count < 0)
+		return -1;
+
+	// The longest tiles go first, so the short ones fill the gaps at the end
+	qsort(*schedule, count, sizeof(ScheduledTile), compareCost);
+	return count;
+}
+
+int costMapUpdate(CostMap *map, Rectangle rect, int w, int h,
+		const ScheduledTile *schedule, int count) {
+	int cols = (w + COST_CELL_SIZE - 1) / COST_CELL_SIZE;
+	int rows = (h + COST_CELL_SIZE - 1) / COST_CELL_SIZE;
+	if(cols * rows > map->alloc) {
+		float *cells = (float *)realloc(map->cells, cols * rows * sizeof(float));
+		if(cells == NULL) {
+			map->valid = 0;
+			return -1;
+		}
+		map->cells = cells;
+		map->alloc = cols * rows;
+	}
+
+	// Every cell takes the cost of the tile its center lies in
+	double total = 0.0;
+	for(int s = 0; s < count; s++) {
+		Tile tile = schedule[s].tile;
+		float density = (float)schedule[s].cost / (float)(tile.w * tile.h);
+		total += schedule[s].cost;
+		for(int row = tile.y / COST_CELL_SIZE; row <= (tile.y + tile.h - 1) / COST_CELL_SIZE; row++) {
+			int cy = row * COST_CELL_SIZE + COST_CELL_SIZE / 2;
+			cy = cy < h ? cy : h - 1;
+			if(cy < tile.y || cy >= tile.y + tile.h)
+				continue;
+			for(int col = tile.x / COST_CELL_SIZE; col <= (tile.x + tile.w - 1) / COST_CELL_SIZE; col++) {
+				int cx = col * COST_CELL_SIZE + COST_CELL_SIZE / 2;
+				cx = cx < w ? cx : w - 1;
+				if(cx >= tile.x && cx < tile.x + tile.w)
+					map->cells[row * cols + col] = density;
+			}
+		}
+	}
+
+	map->rect = rect;
+	map->w = w;
+	map->h = h;
+	map->cols = cols;
+	map->rows = rows;
+	map->mean = total / ((double)w * h);
+	map->valid = 1;
+	return 0;
+}
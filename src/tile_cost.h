@@ -0,0 +1,42 @@
+#ifndef _TILE_COST_H_
+#define _TILE_COST_H_
+
+#include "mandelbrot_common.h"
+
+/*
+ * Iterations per pixel of the last image, in cells of COST_CELL_SIZE pixels.
+ * Consecutive frames look alike, so the map of one frame, moved and scaled
+ * to the view of the next one, predicts which of its tiles take longest.
+ */
+typedef struct CostMap {
+	Rectangle rect; // View of the image the map was measured on
+	int w;          // Size of that image in pixels
+	int h;
+	int cols;
+	int rows;
+	float *cells;   // Iterations per pixel, row by row
+	int alloc;
+	double mean;    // Over the whole image, predicts parts outside of rect
+	int valid;
+} CostMap;
+
+void costMapFree(CostMap *map);
+
+// Forgets the measurements, e.g. after the iterations or exponent changed
+void costMapInvalidate(CostMap *map);
+
+// Fills *schedule with the tiles of a w x h image of rect, split so that
+// no tile is predicted to take more than a share of the image meant for
+// COST_CHUNKS_PER_THREAD tiles per worker, most expensive first. Without
+// a valid map these are the tile_size tiles in row order. Tiles are only
+// split after a multiple of vector_width columns, so the kernel's vectors
+// stay full.
+// Returns the number of tiles, or -1 if *schedule could not be grown.
+int costSchedule(const CostMap *map, Rectangle rect, int w, int h, int tile_size,
+		int vector_width, int nthreads, ScheduledTile **schedule, int *alloc);
+
+// Replaces the map with the costs measured for the count tiles of schedule
+int costMapUpdate(CostMap *map, Rectangle rect, int w, int h,
+		const ScheduledTile *schedule, int count);
+
+#endif
@@ -0,0 +1,119 @@
+#include "tile_interval.h"
+#include "mandelbrot_cpu.h"
+
+#include <float.h>
+#include <math.h>
+
+// Relative margin to the escape radius. It covers the rounding of the
+// kernels, which may iterate in float, so a pixel whose orbit comes close
+// to the radius is never classified.
+#define ROUNDING_MARGIN 1e-3
+
+typedef struct Interval {
+	double lo;
+	double hi;
+} Interval;
+
+static Interval add(Interval a, Interval b) {
+	return (Interval){a.lo + b.lo, a.hi + b.hi};
+}
+
+static Interval sub(Interval a, Interval b) {
+	return (Interval){a.lo - b.hi, a.hi - b.lo};
+}
+
+static Interval mul(Interval a, Interval b) {
+	double p[4] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+	Interval r = {p[0], p[0]};
+	for(int i = 1; i < 4; i++) {
+		r.lo = p[i] < r.lo ? p[i] : r.lo;
+		r.hi = p[i] > r.hi ? p[i] : r.hi;
+	}
+	return r;
+}
+
+// Tighter than mul(a, a), the square is never negative
+static Interval sqr(Interval a) {
+	double l = a.lo * a.lo, h = a.hi * a.hi;
+	if(a.lo <= 0.0 && a.hi >= 0.0)
+		return (Interval){0.0, l > h ? l : h};
+	return l < h ? (Interval){l, h} : (Interval){h, l};
+}
+
+static Interval shift(Interval a, double d) {
+	return (Interval){a.lo + d, a.hi + d};
+}
+
+/*
+ * The main cardioid is q * (q + x - 1/4) < y^2 / 4 with q = (x - 1/4)^2 + y^2,
+ * the period 2 bulb is (x + 1)^2 + y^2 < 1/16. The left sides are evaluated
+ * over the whole box in interval arithmetic, so a test holds for every point
+ * of the box if it holds for the upper bound of its interval.
+ */
+static int insideCardioidOrBulb(Interval x, Interval y) {
+	Interval y2 = sqr(y);
+	Interval u = shift(x, -0.25);
+	Interval q = add(sqr(u), y2);
+	Interval cardioid = sub(mul(q, add(q, u)), mul(y2, (Interval){0.25, 0.25}));
+	if(cardioid.hi < 0.0)
+		return 1;
+
+	Interval bulb = add(sqr(shift(x, 1.0)), y2);
+	return bulb.hi < 1.0 / 16.0;
+}
+
+// Iteration count every point of the box gets, -1 if that isn't certain
+static int uniformIterations(Interval cx, Interval cy, double escape_rad_sq, int max_iters) {
+	if(insideCardioidOrBulb(cx, cy))
+		return max_iters;
+
+	Interval x = {0.0, 0.0}, y = {0.0, 0.0};
+	for(int iteration = 0; iteration < max_iters; iteration++) {
+		Interval x2 = sqr(x), y2 = sqr(y);
+		Interval dist = add(x2, y2);
+		if(dist.lo > escape_rad_sq * (1.0 + ROUNDING_MARGIN)) {
+			// Every point was inside after the last iteration
+			return iteration;
+		}
+		if(!(dist.hi <= escape_rad_sq * (1.0 - ROUNDING_MARGIN))) {
+			// Some points may escape now and others later
+			return -1;
+		}
+		Interval xy = mul(x, y);
+		x = add(sub(x2, y2), cx);
+		y = add(add(xy, xy), cy);
+	}
+	return max_iters;
+}
+
+int fillUniformTile(const MandelbrotArgs *args) {
+	if(args->pow != 2 || args->pix_w < 1 || args->pix_h < 1)
+		return 0;
+
+	// Pixels are sampled at rect.x + i * dx for i < pix_w. The box is one
+	// pixel larger on every side to cover the rounding of the kernels'
+	// coordinates, and the low parts of deep views.
+	double dx = args->rect.w / args->pix_w;
+	double dy = args->rect.h / args->pix_h;
+	double x = args->rect.x + args->rect.x_lo;
+	double y = args->rect.y + args->rect.y_lo;
+	double pad_x = dx + 4.0 * DBL_EPSILON * fabs(x);
+	double pad_y = dy + 4.0 * DBL_EPSILON * fabs(y);
+	Interval cx = {x - pad_x, x + (args->pix_w - 1) * dx + pad_x};
+	Interval cy = {y - pad_y, y + (args->pix_h - 1) * dy + pad_y};
+
+	double escape_rad_sq = (double)args->escape_rad * args->escape_rad;
+	int iters = uniformIterations(cx, cy, escape_rad_sq, args->max_iters);
+	if(iters < 0)
+		return 0;
+
+	int color = 0xff000000 | iterationsToColorCpu(iters, args->max_iters);
+	for(int py = 0; py < args->pix_h; py++) {
+		int *row = args->out + py * args->stride;
+		for(int px = 0; px < args->pix_w; px++)
+			row[px] = color;
+	}
+	for(int i = 0; args->stats != NULL && i < args->pix_w * args->pix_h; i++)
+		recordIterations(args->stats, iters, args->max_iters);
+	return 1;
+}
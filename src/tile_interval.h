@@ -0,0 +1,23 @@
+#ifndef _TILE_INTERVAL_H_
+#define _TILE_INTERVAL_H_
+
+#include "mandelbrot_common.h"
+
+/*
+ * Pre-pass of tiled rendering. The tile is iterated once as a box of the
+ * complex plane instead of pixel by pixel, with interval arithmetic. When
+ * the box is certainly inside the main cardioid or the period 2 bulb, or
+ * all of its points provably escape in the same iteration or stay inside
+ * for max_iters iterations, every pixel gets the same count and the tile
+ * is filled without iterating a single pixel.
+ *
+ * Only exponent 2 is classified, which is what the cardioid and bulb
+ * tests are made for.
+ */
+
+// Renders the pixels described by args like a kernel on a single thread
+// if they are provably uniform. Returns nonzero if the tile was filled,
+// zero if it has to be rendered by the kernel.
+int fillUniformTile(const MandelbrotArgs *args);
+
+#endif
@@ -1,25 +1,71 @@
 #include "util.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+
 int round_simple(float f) {
 	return (int)(f + 0.5);
 }
 
-int blend(int in_color, int blend_color, float ratio) {
-	float r_in = in_color & 0xff;
-	float g_in = (in_color & 0xff00) >> 8;
-	float b_in = (in_color & 0xff0000) >> 16;
-
-	float r_blend = blend_color & 0xff;
-	float g_blend = (blend_color & 0xff00) >> 8;
-	float b_blend = (blend_color & 0xff0000) >> 16;
+int clamp(int i, int min, int max) {
+	return i < min ? min : i > max ? max : i;
+}
 
-	r_in = r_in * (1.0 - ratio) + r_blend * ratio;
-	g_in = g_in * (1.0 - ratio) + g_blend * ratio;
-	b_in = b_in * (1.0 - ratio) + b_blend * ratio;
+// Parses a list of CPUs like "0-7,16,18-19" into cpus
+// Returns the number of CPUs or -1 if the list is malformed
+int parseCpuList(const char *list, int *cpus, int max_cpus) {
+	int count = 0;
+	const char *p = list;
+	while(*p) {
+		char *end;
+		long first = strtol(p, &end, 10);
+		if(end == p || first < 0)
+			return -1;
+		long last = first;
+		p = end;
+		if(*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if(end == p || last < first)
+				return -1;
+			p = end;
+		}
+		for(long cpu = first; cpu <= last; cpu++) {
+			if(count >= max_cpus)
+				return -1;
+			cpus[count++] = (int)cpu;
+		}
+		if(*p == ',')
+			p++;
+		else if(*p != '\0')
+			return -1;
+	}
+	return count;
+}
 
-	return (int)r_in + (int)g_in * 256 + (int)b_in * 65536;
+static int makeDir(const char *path) {
+	return mkdir(path, 0755) != 0 && errno != EEXIST ? -1 : 0;
 }
 
-int clamp(int i, int min, int max) {
-	return i < min ? min : i > max ? max : i;
+int cachePath(char *path, int len, const char *name, int create_dirs) {
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int written;
+	if(cache_home != NULL && cache_home[0] != '\0')
+		written = snprintf(path, len, "%s", cache_home);
+	else if(home != NULL && home[0] != '\0')
+		written = snprintf(path, len, "%s/.cache", home);
+	else
+		return -1;
+	if(written >= len || (create_dirs && makeDir(path)))
+		return -1;
+
+	written += snprintf(path + written, len - written, "/mandelbrot");
+	if(written >= len || (create_dirs && makeDir(path)))
+		return -1;
+
+	written += snprintf(path + written, len - written, "/%s", name);
+	return written >= len ? -1 : 0;
 }
@@ -3,8 +3,12 @@
 
 int round_simple(float f);
 
-int blend(int in_color, int blend_color, float ratio);
-
 int clamp(int i, int min, int max);
 
+int parseCpuList(const char *list, int *cpus, int max_cpus);
+
+// Writes the path of the file name in the cache directory into path,
+// creating the directories if asked to. Returns nonzero on errors.
+int cachePath(char *path, int len, const char *name, int create_dirs);
+
 #endif
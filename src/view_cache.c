@@ -0,0 +1,116 @@
+#include "view_cache.h"
+#include "logger.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define VIEW_CACHE_MAGIC "MANDVIEW"
+#define VIEW_CACHE_VERSION 1
+#define VIEW_CACHE_NAME "last-view"
+#define CACHE_PATH_LENGTH 4096
+
+typedef struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	int32_t w;
+	int32_t h;
+	int32_t iterations;
+	int32_t exponent;
+	int32_t auto_iters;
+	int32_t has_image;
+	int32_t reserved;
+	double rect[6];
+} CacheHeader;
+
+int viewCacheLoad(ViewCache *cache) {
+	char path[CACHE_PATH_LENGTH];
+	cache->image = NULL;
+	if(cachePath(path, sizeof(path), VIEW_CACHE_NAME, 0))
+		return -1;
+	FILE *file = fopen(path, "rb");
+	if(file == NULL)
+		return -1;
+
+	CacheHeader header;
+	if(fread(&header, sizeof(header), 1, file) != 1 ||
+			memcmp(header.magic, VIEW_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+			header.version != VIEW_CACHE_VERSION ||
+			header.w < 1 || header.h < 1 || header.w > 16383 || header.h > 16383 ||
+			!(header.rect[2] > 0.0) || !(header.rect[3] > 0.0)) {
+		mandelLog(VERBOSE, "Ignoring invalid view cache %s\n", path);
+		fclose(file);
+		return -1;
+	}
+
+	ViewState *view = &cache->view;
+	view->rect = (Rectangle) {header.rect[0], header.rect[1], header.rect[2],
+			header.rect[3], header.rect[4], header.rect[5]};
+	view->w = header.w;
+	view->h = header.h;
+	view->iterations = header.iterations;
+	view->exponent = header.exponent;
+	view->auto_iters = header.auto_iters;
+	view->seq = 0;
+
+	if(header.has_image) {
+		size_t npixels = (size_t)header.w * header.h;
+		cache->image = (int *)malloc(npixels * sizeof(int));
+		if(cache->image != NULL && fread(cache->image, sizeof(int), npixels, file) != npixels) {
+			// The view alone is still worth resuming
+			free(cache->image);
+			cache->image = NULL;
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+void viewCacheStore(const ViewState *view, const int *image) {
+	char path[CACHE_PATH_LENGTH];
+	char tmp_path[CACHE_PATH_LENGTH + 4];
+	if(cachePath(path, sizeof(path), VIEW_CACHE_NAME, 1)) {
+		mandelLog(WARN, "Could not create cache directory for the view\n");
+		return;
+	}
+	// Written next to the cache and renamed, a crash never leaves half a file
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *file = fopen(tmp_path, "wb");
+	if(file == NULL) {
+		mandelLog(WARN, "Could not write view cache %s\n", tmp_path);
+		return;
+	}
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VIEW_CACHE_MAGIC, sizeof(header.magic));
+	header.version = VIEW_CACHE_VERSION;
+	header.w = view->w;
+	header.h = view->h;
+	header.iterations = view->iterations;
+	header.exponent = view->exponent;
+	header.auto_iters = view->auto_iters;
+	header.has_image = image != NULL;
+	double rect[6] = {view->rect.x, view->rect.y, view->rect.w, view->rect.h,
+			view->rect.x_lo, view->rect.y_lo};
+	memcpy(header.rect, rect, sizeof(rect));
+
+	size_t npixels = (size_t)view->w * view->h;
+	int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+	if(image != NULL && !failed)
+		failed = fwrite(image, sizeof(int), npixels, file) != npixels;
+	failed |= fclose(file) != 0;
+	if(failed || rename(tmp_path, path) != 0) {
+		mandelLog(WARN, "Could not write view cache %s\n", path);
+		remove(tmp_path);
+		return;
+	}
+	mandelLog(VERBOSE, "Stored view in %s\n", path);
+}
+
+void viewCacheFree(ViewCache *cache) {
+	free(cache->image);
+	cache->image = NULL;
+}
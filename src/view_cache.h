@@ -0,0 +1,24 @@
+#ifndef _VIEW_CACHE_H_
+#define _VIEW_CACHE_H_
+
+#include "view_state.h"
+
+/*
+ * The view a session ended with and the image shown of it, kept in the
+ * cache directory. The next session starts with that view and shows the
+ * image while the engines are still initializing.
+ */
+typedef struct ViewCache {
+	ViewState view;
+	int *image; // view.w x view.h pixels, NULL if there was none
+} ViewCache;
+
+// Returns nonzero if there is no usable cache
+int viewCacheLoad(ViewCache *cache);
+
+// The image is optional, it has to show the view
+void viewCacheStore(const ViewState *view, const int *image);
+
+void viewCacheFree(ViewCache *cache);
+
+#endif
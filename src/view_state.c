@@ -0,0 +1,29 @@
+#include "view_state.h"
+
+#define FRESH_BIT 0x100
+#define INDEX_MASK 0xff
+
+void viewExchangeInit(ViewExchange *exchange, const ViewState *initial) {
+	for(int i = 0; i < VIEW_STATES; i++) {
+		exchange->states[i] = *initial;
+	}
+	exchange->back = 0;
+	atomic_init(&exchange->middle, 1);
+	exchange->front = 2;
+}
+
+void viewPublish(ViewExchange *exchange, const ViewState *state) {
+	exchange->states[exchange->back] = *state;
+	int old = atomic_exchange(&exchange->middle, exchange->back | FRESH_BIT);
+	exchange->back = old & INDEX_MASK;
+}
+
+int viewLatest(ViewExchange *exchange, ViewState *out) {
+	int fresh = atomic_load(&exchange->middle) & FRESH_BIT;
+	if(fresh) {
+		int old = atomic_exchange(&exchange->middle, exchange->front);
+		exchange->front = old & INDEX_MASK;
+	}
+	*out = exchange->states[exchange->front];
+	return fresh;
+}
@@ -0,0 +1,44 @@
+#ifndef _VIEW_STATE_H_
+#define _VIEW_STATE_H_
+
+#include <stdatomic.h>
+
+#include "mandelbrot_common.h"
+
+#define VIEW_STATES 3
+
+// Everything a frame depends on, published as a whole so the compute stage
+// never sees half of an input
+typedef struct ViewState {
+	Rectangle rect;
+	int w;
+	int h;
+	int iterations;
+	int exponent;
+	int auto_iters; // Iterations are picked by the compute stage
+	unsigned int seq; // Incremented with every published change
+} ViewState;
+
+/*
+ * Triple buffer of view states between the event loop (producer) and the
+ * compute stage (consumer), working like the FramePipeline.
+ * The consumer only ever sees the newest state, so any number of inputs
+ * published while a frame renders lead to a single new frame.
+ */
+typedef struct ViewExchange {
+	ViewState states[VIEW_STATES];
+	int back;
+	int front;
+	atomic_int middle; // index of the middle state, ORed with a fresh bit
+} ViewExchange;
+
+void viewExchangeInit(ViewExchange *exchange, const ViewState *initial);
+
+// Producer side
+void viewPublish(ViewExchange *exchange, const ViewState *state);
+
+// Consumer side, copies the newest state into out.
+// Returns nonzero if a state was published since the last call.
+int viewLatest(ViewExchange *exchange, ViewState *out);
+
+#endif